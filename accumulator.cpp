@@ -0,0 +1,193 @@
+#include "accumulator.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+ImageAccumulator::ImageAccumulator(size_t budget)
+  : cells(0)
+  , xMin(-1.0), xMax(1.0)
+  , yMin(-1.0), yMax(1.0)
+  , background(0.0)
+{
+  set_budget(budget);
+}
+
+
+// The largest power of two edge, up to 4096, whose image and pyramid
+// (4/3 of the base level) fit into the budget. What was binned so far is
+// kept: a smaller image drops the finest levels of the pyramid, which
+// already hold it downsampled, and a larger one repeats every cell.
+void ImageAccumulator::set_budget(size_t budget)
+{
+  int n = 4096;
+  while(n > 256 && (size_t)n*n*sizeof(float)*4/3 > budget)
+    n /= 2;
+  if(n == cells)
+    return;
+
+  if(levels.empty())
+    {
+      for(int l = n; l >= 1; l /= 2)
+        levels.push_back(std::vector<float>((size_t)l*l, NAN));
+      cells = n;
+    }
+  else
+    update_pyramid();
+
+  while(cells > n)
+    {
+      levels.erase(levels.begin());
+      cells /= 2;
+    }
+  while(cells < n)
+    {
+      const std::vector<float> & fine = levels.front();
+      std::vector<float>         base((size_t)4*cells*cells);
+      for(int y = 0; y < 2*cells; y++)
+        for(int x = 0; x < 2*cells; x++)
+          base[(size_t)y*2*cells + x] = fine[(size_t)(y/2)*cells + x/2];
+      levels.insert(levels.begin(), std::move(base));
+      cells *= 2;
+    }
+
+  tiles    = (cells + ACCUMULATOR_TILE - 1)/ACCUMULATOR_TILE;
+  dirty    = std::vector<uint8_t>(tiles*tiles, 0);
+  anyDirty = false;
+  xScale   = cells/(xMax - xMin);
+  yScale   = cells/(yMax - yMin);
+}
+
+
+int ImageAccumulator::size()
+{
+  return cells;
+}
+
+
+size_t ImageAccumulator::bytes()
+{
+  size_t sum = 0;
+  for(auto & l: levels)
+    sum += l.size()*sizeof(float);
+  return sum;
+}
+
+
+void ImageAccumulator::set_range(double x0, double x1, double y0, double y1)
+{
+  xMin   = x0;
+  xMax   = x1 > x0 ? x1 : x0 + 1.0;
+  yMin   = y0;
+  yMax   = y1 > y0 ? y1 : y0 + 1.0;
+  xScale = cells/(xMax - xMin);
+  yScale = cells/(yMax - yMin);
+  clear(background);
+}
+
+
+// Cells that were never binned hold NaN and show the background value.
+void ImageAccumulator::clear(double value)
+{
+  background = value;
+  for(auto & l: levels)
+    std::fill(l.begin(), l.end(), NAN);
+  std::fill(dirty.begin(), dirty.end(), 0);
+  anyDirty = false;
+}
+
+
+// x, y and z of a whole block; NaN positions are skipped.
+void ImageAccumulator::bin_block(const double * x, const double * y, const double * z, int n)
+{
+  float * base = levels[0].data();
+  for(int i = 0; i < n; i++)
+    {
+      double fx = (x[i] - xMin)*xScale;
+      double fy = (y[i] - yMin)*yScale;
+      if(!(fx >= 0.0 && fx < cells && fy >= 0.0 && fy < cells))
+        continue;
+      int cx = (int)fx, cy = (int)fy;
+      base[(size_t)cy*cells + cx] = (float)z[i];
+      dirty[(cy/ACCUMULATOR_TILE)*tiles + cx/ACCUMULATOR_TILE] = 1;
+      anyDirty = true;
+    }
+}
+
+
+// Recomputes the region of every dirty base tile on all coarser levels. A
+// coarse cell is the mean of its binned children only, so sparse scans do
+// not fade into the background when zoomed out.
+void ImageAccumulator::update_pyramid()
+{
+  if(!anyDirty)
+    return;
+
+  for(int ty = 0; ty < tiles; ty++)
+    for(int tx = 0; tx < tiles; tx++)
+      {
+        if(!dirty[ty*tiles + tx])
+          continue;
+        dirty[ty*tiles + tx] = 0;
+
+        for(size_t l = 1; l < levels.size(); l++)
+          {
+            int n  = cells >> l;
+            int x0 = (tx*ACCUMULATOR_TILE) >> l, x1 = std::max(x0 + 1, ((tx+1)*ACCUMULATOR_TILE) >> l);
+            int y0 = (ty*ACCUMULATOR_TILE) >> l, y1 = std::max(y0 + 1, ((ty+1)*ACCUMULATOR_TILE) >> l);
+            const float * fine   = levels[l-1].data();
+            float *       coarse = levels[l].data();
+
+            for(int y = y0; y < std::min(y1, n); y++)
+              for(int x = x0; x < std::min(x1, n); x++)
+                {
+                  const float * c = fine + (size_t)(2*y)*(2*n) + 2*x;
+                  float v[4] = {c[0], c[1], c[2*n], c[2*n+1]};
+                  float sum  = 0.0f;
+                  int   k    = 0;
+                  for(float f: v)
+                    if(!std::isnan(f))
+                      {
+                        sum += f;
+                        k++;
+                      }
+                  coarse[(size_t)y*n + x] = k ? sum/k : NAN;
+                }
+          }
+      }
+  anyDirty = false;
+}
+
+
+// Fills a w x h view of the given data range, row-major with row 0 at y0,
+// from the coarsest level that still has a cell per output pixel.
+void ImageAccumulator::render(double x0, double x1, double y0, double y1, int w, int h, double * out)
+{
+  update_pyramid();
+
+  double span  = std::max((x1 - x0)*xScale/w, (y1 - y0)*yScale/h);
+  int    level = 0;
+  while(level + 1 < (int)levels.size() && span >= 2.0)
+    {
+      span /= 2.0;
+      level++;
+    }
+
+  int           n    = cells >> level;
+  const float * data = levels[level].data();
+  double        sx   = xScale/(1 << level);
+  double        sy   = yScale/(1 << level);
+
+  for(int j = 0; j < h; j++)
+    {
+      double y  = y0 + (j + 0.5)*(y1 - y0)/h;
+      int    cy = (int)std::floor((y - yMin)*sy);
+      for(int i = 0; i < w; i++)
+        {
+          double x  = x0 + (i + 0.5)*(x1 - x0)/w;
+          int    cx = (int)std::floor((x - xMin)*sx);
+          float  v  = cx < 0 || cx >= n || cy < 0 || cy >= n ? NAN : data[(size_t)cy*n + cx];
+          out[j*w + i] = std::isnan(v) ? background : v;
+        }
+    }
+}
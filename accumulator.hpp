@@ -0,0 +1,44 @@
+#ifndef ACCUMULATOR_H
+#define ACCUMULATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+#define ACCUMULATOR_TILE 64
+
+
+
+// High resolution XY image that acquisition bins into, independent of the
+// displayed size. A mip pyramid is kept next to it and refreshed per dirty
+// tile, so any view is resampled from the level closest to its resolution.
+class ImageAccumulator
+{
+public:
+                            ImageAccumulator(size_t);
+
+  void                      set_budget(size_t);
+  void                      set_range(double, double, double, double);
+  void                      clear(double);
+  void                      bin_block(const double *, const double *, const double *, int);
+  void                      render(double, double, double, double, int, int, double *);
+  int                       size();
+  size_t                    bytes();
+
+private:
+  void                      update_pyramid();
+
+  int                       cells;
+  double                    xMin, xMax, yMin, yMax;
+  double                    xScale, yScale;
+  double                    background;
+
+  std::vector<std::vector<float>>   levels;
+  std::vector<uint8_t>              dirty;
+  int                               tiles;
+  bool                              anyDirty;
+};
+
+
+#endif //ACCUMULATOR_H
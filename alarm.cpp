@@ -0,0 +1,253 @@
+#include "alarm.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+
+// events one rule may raise in one block; a source chattering on its
+// limit without hysteresis would otherwise flood the log
+#define ALARM_BURST 32
+
+
+
+AlarmMonitor::AlarmMonitor()
+  : changed(false)
+  , sampleRate(1.0)
+{
+}
+
+
+// Any thread. The worker takes the rules over before its next block.
+void AlarmMonitor::set_rules(const std::vector<ALARM_RULE> & rules)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  pending = rules;
+  changed = true;
+}
+
+
+std::vector<ALARM_RULE> AlarmMonitor::rules()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return pending;
+}
+
+
+// Worker thread, when the stream starts. The variables are the slot
+// variables in slot order.
+void AlarmMonitor::start(double rate, const std::vector<std::string> & variableNames)
+{
+  sampleRate = rate;
+  names      = variableNames;
+  state.clear();
+  symbols.clear();
+  variables.assign(names.size(), 0.0);
+  for(size_t v = 0; v < names.size(); v++)
+    symbols.add_variable(names[v], variables[v]);
+  symbols.add_constants();
+  changed = true;
+}
+
+
+// Compiles what set_rules handed over. A rule whose source does not
+// compile stays in the list, so the event indices keep matching, but is
+// never evaluated.
+void AlarmMonitor::rebuild()
+{
+  std::vector<ALARM_RULE> rules;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    rules   = pending;
+    changed = false;
+  }
+
+  exprtk::parser<double> parser;
+  state = std::vector<ALARM_STATE>(rules.size());
+  scratch.resize(rules.size());
+  for(size_t r = 0; r < rules.size(); r++)
+    {
+      ALARM_STATE & s = state[r];
+      s.rule        = rules[r];
+      s.slot        = std::find(names.begin(), names.end(), s.rule.source) - names.begin();
+      s.valid       = true;
+      s.holdSamples = std::max<int64_t>(1, (int64_t)std::llround(s.rule.hold*sampleRate));
+      s.run         = 0;
+      s.onset       = 0;
+      s.raised      = false;
+      s.previous    = 0.0;
+      s.primed      = false;
+      if(s.slot < (int)names.size())
+        continue;
+
+      s.slot = -1;
+      s.expression.register_symbol_table(symbols);
+      if(!parser.compile(s.rule.source, s.expression))
+        {
+          printf("Alarm %s: %s\n", s.rule.name.c_str(), parser.error().c_str());
+          s.valid = false;
+        }
+    }
+}
+
+
+// True if the block cannot change the state of a level rule: while it is
+// clear no sample crosses the limit, while it is raised none is back
+// inside it.
+bool AlarmMonitor::quiet(const ALARM_STATE & s, const double * v, int n)
+{
+  if(s.rule.kind == AL_RATE || s.run > 0)
+    return false;
+
+  double sum, sumsq, min, max;
+  simd_moments(v, n, &sum, &sumsq, &min, &max);
+  if(std::isnan(sum))
+    return false;
+
+  double level = s.rule.level, h = s.rule.hysteresis;
+  if(!s.raised)
+    switch(s.rule.kind)
+      {
+      case AL_ABOVE:   return max <= level;
+      case AL_BELOW:   return min >= level;
+      case AL_OUTSIDE: return min >= level && max <= s.rule.upper;
+      default:         return false;
+      }
+  switch(s.rule.kind)
+    {
+    case AL_ABOVE:   return min >= level - h;
+    case AL_BELOW:   return max <= level + h;
+    default:         return false;
+    }
+}
+
+
+// The violation is dated to its first sample, the event to the sample at
+// which it had lasted the hold time. Past the burst limit only the last
+// transition of the block is reported, so the state shown stays right.
+void AlarmMonitor::evaluate(int r, const double * v, int n, uint64_t first, std::vector<ALARM_EVENT> & events)
+{
+  ALARM_STATE & s = state[r];
+  if(quiet(s, v, n))
+    {
+      s.previous = v[n-1];
+      s.primed   = true;
+      return;
+    }
+
+  const ALARM_RULE & rule  = s.rule;
+  int                burst = 0;
+  bool               shown = s.raised;   // state of the last event reported
+  bool               held  = false;
+  ALARM_EVENT        last  = {};
+  for(int i = 0; i < n; i++)
+    {
+      double x = v[i];
+      double d = s.primed ? std::fabs(x - s.previous)*sampleRate : 0.0;
+      s.previous = x;
+      s.primed   = true;
+
+      bool over = false, back = false;
+      switch(rule.kind)
+        {
+        case AL_ABOVE:
+          over = x > rule.level;
+          back = x < rule.level - rule.hysteresis;
+          break;
+        case AL_BELOW:
+          over = x < rule.level;
+          back = x > rule.level + rule.hysteresis;
+          break;
+        case AL_OUTSIDE:
+          over = x < rule.level || x > rule.upper;
+          back = x > rule.level + rule.hysteresis && x < rule.upper - rule.hysteresis;
+          break;
+        case AL_RATE:
+          over = d > rule.level;
+          back = d < rule.level - rule.hysteresis;
+          break;
+        }
+
+      ALARM_EVENT e;
+      if(!s.raised)
+        {
+          if(!over)
+            {
+              s.run = 0;
+              continue;
+            }
+          if(s.run++ == 0)
+            s.onset = first + i;
+          if(s.run < s.holdSamples)
+            continue;
+          s.raised = true;
+          e.sample = s.onset;
+        }
+      else if(back)
+        {
+          s.raised = false;
+          s.run    = 0;
+          e.sample = first + i;
+        }
+      else
+        continue;
+
+      e.rule     = r;
+      e.raised   = s.raised;
+      e.detected = first + i;
+      e.value    = x;
+      e.latency  = 0;
+      if(burst++ >= ALARM_BURST)
+        {
+          last = e;
+          held = true;
+          continue;
+        }
+      events.push_back(e);
+      shown = s.raised;
+    }
+  if(held && last.raised != shown)
+    events.push_back(last);
+}
+
+
+// slot_block holds one block per slot, nullptr for slots without data;
+// first is the stream sample of the block. Events are appended.
+void AlarmMonitor::process(const double * const * slot_block, int slots, int n, uint64_t first,
+                           std::vector<ALARM_EVENT> & events)
+{
+  if(changed)
+    rebuild();
+  if(state.empty() || n <= 0)
+    return;
+
+  // every expression rule in one pass over the samples
+  bool expressions = false;
+  for(auto & s: state)
+    expressions |= s.valid && s.rule.enabled && s.slot < 0;
+  if(expressions)
+    {
+      int bound = std::min(slots, (int)variables.size());
+      for(size_t r = 0; r < state.size(); r++)
+        if((int)scratch[r].size() < n)
+          scratch[r].resize(n);
+      for(int i = 0; i < n; i++)
+        {
+          for(int v = 0; v < bound; v++)
+            variables[v] = slot_block[v] ? slot_block[v][i] : 0.0;
+          for(size_t r = 0; r < state.size(); r++)
+            if(state[r].valid && state[r].rule.enabled && state[r].slot < 0)
+              scratch[r][i] = state[r].expression.value();
+        }
+    }
+
+  for(size_t r = 0; r < state.size(); r++)
+    {
+      const ALARM_STATE & s = state[r];
+      if(!s.valid || !s.rule.enabled)
+        continue;
+      const double * v = s.slot < 0 ? scratch[r].data() : s.slot < slots ? slot_block[s.slot] : nullptr;
+      if(v)
+        evaluate(r, v, n, first, events);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "exprtk.hpp"
+
+
+
+typedef enum
+  {
+    AL_ABOVE, AL_BELOW, AL_OUTSIDE, AL_RATE
+  }ALARM_KIND;
+
+
+// One limit rule. The source is a slot variable such as z0 or u1_c, read
+// straight from its block, or a math expression of them.
+typedef struct
+{
+  std::string               name;
+  std::string               source;
+  ALARM_KIND                kind;
+  double                    level;        // mV like the slots, AL_OUTSIDE the lower limit, AL_RATE mV/s
+  double                    upper;        // mV, AL_OUTSIDE only
+  double                    hold;         // s the condition has to last before it is raised
+  double                    hysteresis;   // how far back inside the limit it clears
+  bool                      enabled;
+}ALARM_RULE;
+
+
+typedef struct
+{
+  int                       rule;
+  bool                      raised;       // false when it cleared
+  uint64_t                  sample;       // stream sample the violation started or ended at
+  uint64_t                  detected;     // stream sample it was recognised at, after the hold
+  double                    value;        // source at the detecting sample
+  int64_t                   latency;      // ns from the driver callback of the block to detection
+}ALARM_EVENT;
+
+
+// Where a rule stands: how many samples its condition has held so far,
+// and the last sample for the rate.
+typedef struct
+{
+  ALARM_RULE                  rule;
+  int                         slot;         // -1 for an expression
+  exprtk::expression<double>  expression;
+  bool                        valid;
+  int64_t                     holdSamples;
+  int64_t                     run;
+  uint64_t                    onset;
+  bool                        raised;
+  double                      previous;
+  bool                        primed;
+}ALARM_STATE;
+
+
+
+// Evaluates the rules on the acquisition thread, block by block but to the
+// sample. Level rules first compare the block extremes with the limit and
+// only walk the samples of blocks that can change their state, so a quiet
+// rule costs one min/max pass. Rules are set from any thread and taken
+// over at the start of the next block.
+class AlarmMonitor
+{
+public:
+                            AlarmMonitor();
+
+  void                      set_rules(const std::vector<ALARM_RULE> &);
+  std::vector<ALARM_RULE>   rules();
+  void                      start(double, const std::vector<std::string> &);
+  void                      process(const double * const *, int, int, uint64_t, std::vector<ALARM_EVENT> &);
+
+private:
+  void                      rebuild();
+  bool                      quiet(const ALARM_STATE &, const double *, int);
+  void                      evaluate(int, const double *, int, uint64_t, std::vector<ALARM_EVENT> &);
+
+  std::mutex                mutex;
+  std::vector<ALARM_RULE>   pending;
+  std::atomic<bool>         changed;
+
+  double                    sampleRate;
+  std::vector<std::string>  names;
+  std::vector<ALARM_STATE>  state;
+  std::vector<double>       variables;    // bound by the expressions, never resized after start
+  exprtk::symbol_table<double>  symbols;
+  std::vector<std::vector<double>>  scratch;
+};
+
+
+#endif //ALARM_H
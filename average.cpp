@@ -0,0 +1,102 @@
+#include "average.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+
+Averager::Averager(AVERAGE_SETTINGS s)
+  : settings(s)
+{
+  settings.length = std::max(settings.length, 1);
+  settings.sweeps = std::max(settings.sweeps, 1);
+
+  segment = std::vector<double>(settings.length);
+  mean    = std::vector<double>(settings.length);
+  var     = std::vector<double>(settings.length);
+  reset();
+}
+
+
+void Averager::reset()
+{
+  std::fill(mean.begin(), mean.end(), 0.0);
+  std::fill(var.begin(), var.end(), 0.0);
+  fill     = -1;
+  previous = settings.rising ? INFINITY : -INFINITY;
+  sweeps   = 0;
+  fresh    = false;
+}
+
+
+long Averager::count()
+{
+  return sweeps;
+}
+
+
+bool Averager::updated()
+{
+  return fresh;
+}
+
+
+void Averager::results(std::vector<double> & m, std::vector<double> & sigma)
+{
+  m     = mean;
+  sigma = std::vector<double>(var.size());
+  for(size_t i = 0; i < var.size(); i++)
+    sigma[i] = std::sqrt(var[i]);
+  fresh = false;
+}
+
+
+// Sweeps shorter than the block are captured back to back; the trigger is
+// re-armed as soon as a sweep is complete.
+void Averager::process(const double * trigger, const double * signal, int n)
+{
+  int i = 0;
+  while(i < n)
+    {
+      if(fill < 0)
+        {
+          for(; i < n; i++)
+            {
+              bool edge = settings.rising ? previous <  settings.level && trigger[i] >= settings.level
+                                          : previous >  settings.level && trigger[i] <= settings.level;
+              previous = trigger[i];
+              if(edge)
+                {
+                  fill = 0;
+                  break;
+                }
+            }
+          continue;
+        }
+
+      int c = std::min(n - i, settings.length - fill);
+      std::memcpy(&segment[fill], signal + i, c*sizeof(double));
+      fill     += c;
+      i        += c;
+      previous  = trigger[i-1];
+
+      if(fill == settings.length)
+        {
+          accumulate();
+          fill = -1;
+        }
+    }
+}
+
+
+void Averager::accumulate()
+{
+  if(settings.mode == AVG_COUNT && sweeps >= settings.sweeps)
+    return;
+
+  sweeps++;
+  double a = std::max(1.0/sweeps, 1.0/settings.sweeps);
+  simd_ensemble_update(segment.data(), settings.length, a, mean.data(), var.data());
+  fresh = true;
+}
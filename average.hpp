@@ -0,0 +1,54 @@
+#ifndef AVERAGE_H
+#define AVERAGE_H
+
+#include <vector>
+
+
+
+typedef enum
+  {
+    AVG_COUNT, AVG_EXPONENTIAL
+  }AVERAGE_MODE;
+
+
+typedef struct
+{
+  int                       source;       // data slot that is averaged, -1 = off
+  int                       trigger;      // data slot the sweeps are aligned to
+  double                    level;
+  bool                      rising;
+  int                       length;       // samples per sweep
+  AVERAGE_MODE              mode;
+  int                       sweeps;       // count limit, or 1/weight of the exponential average
+}AVERAGE_SETTINGS;
+
+
+
+// Ensemble averager: captures one sweep per trigger edge and folds it into
+// running mean and variance buffers.
+class Averager
+{
+public:
+                            Averager(AVERAGE_SETTINGS);
+
+  void                      process(const double *, const double *, int);
+  bool                      updated();
+  void                      results(std::vector<double> &, std::vector<double> &);
+  long                      count();
+  void                      reset();
+
+private:
+  void                      accumulate();
+
+  AVERAGE_SETTINGS          settings;
+  std::vector<double>       segment;
+  std::vector<double>       mean;
+  std::vector<double>       var;
+  int                       fill;         // -1 while armed
+  double                    previous;
+  long                      sweeps;
+  bool                      fresh;
+};
+
+
+#endif //AVERAGE_H
@@ -0,0 +1,164 @@
+#include "budget.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <unistd.h>
+
+
+MemoryGovernor::MemoryGovernor()
+  : maxBytes((size_t)2048 << 20)
+  , used(0)
+  , squeezed(false)
+{
+}
+
+
+// Returns the id of the entry.
+int MemoryGovernor::add(const std::string & name, int priority, size_t reserved,
+                        std::function<size_t()> usage, std::function<void(size_t)> enforce, bool resident)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  BUDGET_ENTRY e;
+  e.name     = name;
+  e.priority = priority;
+  e.reserved = reserved;
+  e.usage    = usage;
+  e.enforce  = enforce;
+  e.resident = resident;
+  e.bytes    = 0;
+  e.allowed  = reserved ? reserved : SIZE_MAX;
+  entries.push_back(e);
+  return (int)entries.size() - 1;
+}
+
+
+void MemoryGovernor::set_reserved(int id, size_t reserved)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(id >= 0 && id < (int)entries.size())
+    entries[id].reserved = reserved;
+}
+
+
+void MemoryGovernor::set_limit(size_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  maxBytes = bytes;
+}
+
+
+size_t MemoryGovernor::limit()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return maxBytes;
+}
+
+
+// Polls every entry and applies the policies. The callbacks run without
+// the lock held, so a policy may read the governor itself.
+size_t MemoryGovernor::update()
+{
+  std::vector<BUDGET_ENTRY> snapshot;
+  size_t                    high, low;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    snapshot = entries;
+    high     = (size_t)(maxBytes*BUDGET_HIGH);
+    low      = (size_t)(maxBytes*BUDGET_LOW);
+  }
+
+  size_t sum = 0;
+  for(auto & e: snapshot)
+    {
+      e.bytes   = e.usage ? e.usage() : 0;
+      e.allowed = e.reserved ? e.reserved : SIZE_MAX;
+      if(e.resident)
+        sum += e.bytes;
+    }
+
+  bool squeeze;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(sum > high)
+      squeezed = true;
+    else if(sum < low)
+      squeezed = false;
+    squeeze = squeezed;
+  }
+
+  if(squeeze && sum > low)
+    {
+      std::vector<int> order(snapshot.size());
+      for(size_t i = 0; i < order.size(); i++)
+        order[i] = (int)i;
+      std::stable_sort(order.begin(), order.end(),
+                       [&](int a, int b){ return snapshot[a].priority < snapshot[b].priority; });
+
+      size_t excess = sum - low;
+      for(int i: order)
+        {
+          BUDGET_ENTRY & e = snapshot[i];
+          if(!e.enforce || !e.resident || !excess)
+            continue;
+          size_t cut = std::min(excess, e.bytes);
+          e.allowed  = std::min(e.allowed, e.bytes - cut);
+          excess    -= cut;
+        }
+    }
+
+  for(auto & e: snapshot)
+    if(e.enforce)
+      e.enforce(e.allowed);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  for(size_t i = 0; i < snapshot.size() && i < entries.size(); i++)
+    {
+      entries[i].bytes   = snapshot[i].bytes;
+      entries[i].allowed = snapshot[i].allowed;
+    }
+  used = sum;
+  return sum;
+}
+
+
+// sum of the resident entries at the last update
+size_t MemoryGovernor::total()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return used;
+}
+
+
+bool MemoryGovernor::pressure()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return squeezed;
+}
+
+
+int MemoryGovernor::size()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return (int)entries.size();
+}
+
+
+BUDGET_ENTRY MemoryGovernor::entry(int id)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries[id];
+}
+
+
+// resident set size of the process, for comparison with the entries
+size_t MemoryGovernor::resident()
+{
+  FILE * file = fopen("/proc/self/statm", "r");
+  if(!file)
+    return 0;
+  unsigned long pages = 0, rss = 0;
+  if(fscanf(file, "%lu %lu", &pages, &rss) != 2)
+    rss = 0;
+  fclose(file);
+  return (size_t)rss*(size_t)sysconf(_SC_PAGESIZE);
+}
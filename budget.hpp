@@ -0,0 +1,69 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// share of the limit at which the governor starts taking memory back, and
+// the share it takes it back down to
+#define BUDGET_HIGH 0.90
+#define BUDGET_LOW  0.75
+
+
+
+// One subsystem that holds memory. usage() reports its current bytes;
+// enforce() is its policy, called on every update with the bytes it may
+// keep and expected to evict or downsample until it fits. Without a
+// policy the entry is only reported. An entry that is not resident, such
+// as files on disk, is shown and held to its reservation but not counted
+// against the limit.
+typedef struct
+{
+  std::string                       name;
+  int                               priority;   // lower gives memory back first
+  size_t                            reserved;   // 0 for no reservation
+  std::function<size_t()>           usage;
+  std::function<void(size_t)>       enforce;
+  bool                              resident;
+  size_t                            bytes;
+  size_t                            allowed;
+}BUDGET_ENTRY;
+
+
+
+// One memory limit for the whole process. Every entry may use up to its
+// reservation; when the total comes within BUDGET_HIGH of the limit the
+// entries with a policy are cut back to BUDGET_LOW in order of priority,
+// and get their reservation back once the total has dropped below it.
+class MemoryGovernor
+{
+public:
+                            MemoryGovernor();
+
+  int                       add(const std::string &, int, size_t, std::function<size_t()>,
+                                std::function<void(size_t)> = nullptr, bool = true);
+  void                      set_reserved(int, size_t);
+  void                      set_limit(size_t);
+  size_t                    limit();
+  size_t                    update();
+  size_t                    total();
+  bool                      pressure();
+  int                       size();
+  BUDGET_ENTRY              entry(int);
+
+  static size_t             resident();
+
+private:
+  std::mutex                mutex;
+  std::vector<BUDGET_ENTRY> entries;
+  size_t                    maxBytes;
+  size_t                    used;
+  bool                      squeezed;
+};
+
+
+#endif //BUDGET_H
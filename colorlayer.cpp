@@ -0,0 +1,134 @@
+#include "colorlayer.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "simd.hpp"
+
+
+ColorLayer::ColorLayer(int width, int height)
+  : lo(-1.0f)
+  , scale(0.5f*(COLORLAYER_LUT - 1))
+  , lut(COLORLAYER_LUT, 0xff000000)
+{
+  resize(width, height);
+}
+
+
+void ColorLayer::resize(int width, int height)
+{
+  w        = std::max(width, 1);
+  h        = std::max(height, 1);
+  tilesX   = (w + COLORLAYER_TILE - 1)/COLORLAYER_TILE;
+  tilesY   = (h + COLORLAYER_TILE - 1)/COLORLAYER_TILE;
+  values   = std::vector<float>((size_t)w*h, 0.0f);
+  argb     = std::vector<uint32_t>((size_t)w*h, lut[0]);
+  dirty    = std::vector<uint8_t>(tilesX*tilesY, 0);
+  allDirty = true;
+}
+
+
+int ColorLayer::width()
+{
+  return w;
+}
+
+
+int ColorLayer::height()
+{
+  return h;
+}
+
+
+size_t ColorLayer::bytes()
+{
+  return values.size()*sizeof(float) + argb.size()*sizeof(uint32_t);
+}
+
+
+const uint32_t * ColorLayer::pixels()
+{
+  return argb.data();
+}
+
+
+// any number of entries, resampled to COLORLAYER_LUT
+void ColorLayer::set_gradient(const std::vector<uint32_t> & colours)
+{
+  if(colours.empty())
+    return;
+  for(int i = 0; i < COLORLAYER_LUT; i++)
+    lut[i] = colours[(size_t)i*(colours.size() - 1)/(COLORLAYER_LUT - 1)];
+  allDirty = true;
+}
+
+
+void ColorLayer::set_range(double lower, double upper)
+{
+  if(upper <= lower)
+    upper = lower + 1e-9;
+  lo       = (float)lower;
+  scale    = (float)((COLORLAYER_LUT - 1)/(upper - lower));
+  allDirty = true;
+}
+
+
+// Takes a whole w x h image, row 0 at the lowest y, and only marks the
+// tiles that actually changed.
+void ColorLayer::set_all(const double * image)
+{
+  for(int y = 0; y < h; y++)
+    {
+      const double * in  = image + (size_t)y*w;
+      float *        out = &values[(size_t)y*w];
+      uint8_t *      row = &dirty[(y/COLORLAYER_TILE)*tilesX];
+      for(int x = 0; x < w; x++)
+        if(out[x] != (float)in[x])
+          {
+            out[x] = (float)in[x];
+            row[x/COLORLAYER_TILE] = 1;
+          }
+    }
+}
+
+
+void ColorLayer::fill(double v)
+{
+  std::fill(values.begin(), values.end(), (float)v);
+  allDirty = true;
+}
+
+
+void ColorLayer::map_tile(int tx, int ty)
+{
+  int x0 = tx*COLORLAYER_TILE, x1 = std::min(x0 + COLORLAYER_TILE, w);
+  int y0 = ty*COLORLAYER_TILE, y1 = std::min(y0 + COLORLAYER_TILE, h);
+  for(int y = y0; y < y1; y++)
+    simd_lut_map(&values[(size_t)y*w + x0], x1 - x0, lo, scale, COLORLAYER_LUT - 1,
+                 lut.data(), &argb[(size_t)(h - 1 - y)*w + x0]);
+}
+
+
+// Returns the number of pixels recoloured.
+int ColorLayer::update()
+{
+  if(allDirty)
+    {
+      for(int y = 0; y < h; y++)
+        simd_lut_map(&values[(size_t)y*w], w, lo, scale, COLORLAYER_LUT - 1,
+                     lut.data(), &argb[(size_t)(h - 1 - y)*w]);
+      std::fill(dirty.begin(), dirty.end(), 0);
+      allDirty = false;
+      return w*h;
+    }
+
+  int mapped = 0;
+  for(int ty = 0; ty < tilesY; ty++)
+    for(int tx = 0; tx < tilesX; tx++)
+      if(dirty[ty*tilesX + tx])
+        {
+          dirty[ty*tilesX + tx] = 0;
+          map_tile(tx, ty);
+          mapped += COLORLAYER_TILE*COLORLAYER_TILE;
+        }
+  return mapped;
+}
@@ -0,0 +1,51 @@
+#ifndef COLORLAYER_H
+#define COLORLAYER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+#define COLORLAYER_TILE  32
+#define COLORLAYER_LUT   1024
+
+
+
+// Cell values of the XY image and their colours in a persistent ARGB
+// buffer. Writes mark their tile dirty and update() maps only dirty tiles
+// through a gradient table; a new data range recolours everything in one
+// vectorised pass. Row 0 of the pixels is the top, i.e. the highest cell
+// row.
+class ColorLayer
+{
+public:
+                            ColorLayer(int, int);
+
+  void                      resize(int, int);
+  void                      set_gradient(const std::vector<uint32_t> &);
+  void                      set_range(double, double);
+  void                      set_all(const double *);
+  void                      fill(double);
+  int                       update();
+
+  const uint32_t *          pixels();
+  int                       width();
+  int                       height();
+  size_t                    bytes();
+
+private:
+  void                      map_tile(int, int);
+
+  int                       w, h;
+  int                       tilesX, tilesY;
+  float                     lo, scale;
+  bool                      allDirty;
+
+  std::vector<float>        values;
+  std::vector<uint32_t>     argb;
+  std::vector<uint8_t>      dirty;
+  std::vector<uint32_t>     lut;
+};
+
+
+#endif //COLORLAYER_H
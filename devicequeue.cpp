@@ -0,0 +1,96 @@
+#include "devicequeue.hpp"
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+DeviceQueue::DeviceQueue()
+  : busy(false)
+  , quit(false)
+{
+  thread = std::thread(&DeviceQueue::loop, this);
+}
+
+
+DeviceQueue::~DeviceQueue()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+
+void DeviceQueue::post(int key, std::function<void()> command)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool merged = false;
+    if(key >= 0)
+      for(auto & p: pending)
+        if(p.first == key)
+          {
+            p.second = std::move(command);
+            merged   = true;
+            break;
+          }
+    if(!merged)
+      pending.emplace_back(key, std::move(command));
+  }
+  wake.notify_one();
+}
+
+
+// Blocks until everything posted so far has run.
+void DeviceQueue::wait()
+{
+  if(on_queue_thread())
+    return;
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this]{ return pending.empty() && !busy; });
+}
+
+
+// Runs one command on the queue thread and returns when it is done.
+void DeviceQueue::run(std::function<void()> command)
+{
+  if(on_queue_thread())
+    {
+      command();
+      return;
+    }
+  post(-1, std::move(command));
+  wait();
+}
+
+
+bool DeviceQueue::on_queue_thread()
+{
+  return std::this_thread::get_id() == thread.get_id();
+}
+
+
+void DeviceQueue::loop()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true)
+    {
+      wake.wait(lock, [this]{ return quit || !pending.empty(); });
+      if(pending.empty() && quit)
+        break;
+
+      std::function<void()> command = std::move(pending.front().second);
+      pending.erase(pending.begin());
+      busy = true;
+      lock.unlock();
+      command();
+      lock.lock();
+      busy = false;
+      if(pending.empty())
+        idle.notify_all();
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef DEVICEQUEUE_H
+#define DEVICEQUEUE_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+
+// Serialises the driver calls of one unit on a thread of its own. A command
+// posted with a key replaces a still pending command with the same key, so
+// a burst of edits to one channel reaches the device once; key -1 never
+// merges.
+class DeviceQueue
+{
+public:
+                            DeviceQueue();
+                            ~DeviceQueue();
+
+  void                      post(int, std::function<void()>);
+  void                      wait();
+  void                      run(std::function<void()>);
+  bool                      on_queue_thread();
+
+private:
+  void                      loop();
+
+  std::mutex                mutex;
+  std::condition_variable   wake;
+  std::condition_variable   idle;
+  std::vector<std::pair<int, std::function<void()>>>   pending;
+  bool                      busy;
+  bool                      quit;
+  std::thread               thread;
+};
+
+
+#endif //DEVICEQUEUE_H
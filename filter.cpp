@@ -0,0 +1,220 @@
+#include "filter.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+
+Filter::Filter(FILTER_SETTINGS s, double fs)
+  : settings(s)
+  , sampleRate(fs)
+{
+  if(settings.decimation < 1)
+    settings.decimation = 1;
+  if(settings.order < 1)
+    settings.order = 1;
+
+  if(settings.type == FILTER_FIR)
+    design_fir();
+  if(settings.type == FILTER_BIQUAD)
+    design_biquad();
+  if(settings.type == FILTER_AVERAGE)
+    ring = std::vector<double>(settings.order);
+
+  reset();
+}
+
+
+void Filter::reset()
+{
+  phase   = 0;
+  last    = 0.0;
+  ringPos = 0;
+  sum     = 0.0;
+
+  std::fill(line.begin(), line.end(), 0.0);
+  std::fill(ring.begin(), ring.end(), 0.0);
+  for(auto & s: sections)
+    s.z1 = s.z2 = 0.0;
+}
+
+
+int Filter::decimation()
+{
+  return settings.decimation;
+}
+
+
+void Filter::design_fir()
+{
+  int     n  = settings.order | 1;
+  double  fc = settings.cutoff/sampleRate;
+
+  // keep the pass band below the decimated Nyquist frequency
+  if(fc <= 0.0 || fc > 0.45/settings.decimation)
+    fc = 0.45/settings.decimation;
+
+  taps = std::vector<double>(n);
+  double norm = 0.0;
+  for(int j = 0; j < n; j++)
+    {
+      double m      = j - (n-1)/2.0;
+      double sinc   = m == 0.0 ? 2.0*fc : std::sin(2.0*M_PI*fc*m)/(M_PI*m);
+      double window = 0.54 - 0.46*std::cos(2.0*M_PI*j/(n-1 > 0 ? n-1 : 1));
+      taps[j] = sinc*window;
+      norm   += taps[j];
+    }
+  // taps are symmetric, so no reversal is needed for the dot product
+  for(auto & t: taps)
+    t /= norm;
+
+  line = std::vector<double>(n-1);
+}
+
+
+void Filter::design_biquad()
+{
+  int     n  = settings.order;
+  double  fc = settings.cutoff;
+
+  if(fc <= 0.0 || fc > 0.45*sampleRate/settings.decimation)
+    fc = 0.45*sampleRate/settings.decimation;
+
+  // Butterworth of order 2n as a cascade of n RBJ low-pass sections
+  double w0 = 2.0*M_PI*fc/sampleRate;
+  for(int k = 0; k < n; k++)
+    {
+      double q     = 1.0/(2.0*std::cos(M_PI*(2*k+1)/(4.0*n)));
+      double alpha = std::sin(w0)/(2.0*q);
+      double a0    = 1.0 + alpha;
+      BIQUAD s;
+      s.b0 = (1.0 - std::cos(w0))/2.0/a0;
+      s.b1 = (1.0 - std::cos(w0))/a0;
+      s.b2 = s.b0;
+      s.a1 = -2.0*std::cos(w0)/a0;
+      s.a2 = (1.0 - alpha)/a0;
+      s.z1 = s.z2 = 0.0;
+      sections.push_back(s);
+    }
+}
+
+
+int Filter::process(const double * in, int n, double * out)
+{
+  switch(settings.type)
+    {
+    case FILTER_FIR:
+      return fir_block(in, n, out);
+    case FILTER_BIQUAD:
+      return biquad_block(in, n, out);
+    case FILTER_AVERAGE:
+      return average_block(in, n, out);
+    default:
+      std::memcpy(out, in, n*sizeof(double));
+      return n;
+    }
+}
+
+
+// Filters a block and writes one value per input sample, holding the last
+// decimated output until the next one is due.
+void Filter::process_held(const double * in, int n, double * out)
+{
+  int first = phase;
+  int D     = settings.decimation;
+
+  if((int)scratch.size() < n)
+    scratch.resize(n);
+
+  int m = process(in, n, scratch.data());
+
+  int k = 0;
+  for(int i = 0; i < n; i++)
+    {
+      if(k < m && i == first + k*D)
+        last = scratch[k++];
+      out[i] = last;
+    }
+}
+
+
+// Polyphase decimation: only the outputs that survive decimation are
+// computed, each one a SIMD dot product over the delay line.
+int Filter::fir_block(const double * in, int n, double * out)
+{
+  int ntaps = (int)taps.size();
+  int hist  = ntaps - 1;
+  int D     = settings.decimation;
+
+  line.resize(hist + n);
+  std::memcpy(line.data() + hist, in, n*sizeof(double));
+
+  int m = 0;
+  int i = phase;
+  for(; i < n; i += D)
+    out[m++] = simd_dot(taps.data(), line.data() + i, ntaps);
+  phase = i - n;
+
+  std::memmove(line.data(), line.data() + n, hist*sizeof(double));
+  line.resize(hist);
+  return m;
+}
+
+
+// The IIR recursion is serial in time, so sections run one after another
+// over the whole block to keep the state in registers.
+int Filter::biquad_block(const double * in, int n, double * out)
+{
+  if((int)scratch.size() < n)
+    scratch.resize(n);
+  double * buf = out == scratch.data() ? out : scratch.data();
+
+  std::memcpy(buf, in, n*sizeof(double));
+
+  for(auto & s: sections)
+    {
+      double z1 = s.z1, z2 = s.z2;
+      for(int i = 0; i < n; i++)
+        {
+          double x = buf[i];
+          double y = s.b0*x + z1;
+          z1 = s.b1*x - s.a1*y + z2;
+          z2 = s.b2*x - s.a2*y;
+          buf[i] = y;
+        }
+      s.z1 = z1;
+      s.z2 = z2;
+    }
+
+  int m = 0;
+  int D = settings.decimation;
+  int i = phase;
+  for(; i < n; i += D)
+    out[m++] = buf[i];
+  phase = i - n;
+  return m;
+}
+
+
+int Filter::average_block(const double * in, int n, double * out)
+{
+  int L = (int)ring.size();
+  int D = settings.decimation;
+  int m = 0;
+
+  for(int i = 0; i < n; i++)
+    {
+      sum += in[i] - ring[ringPos];
+      ring[ringPos] = in[i];
+      ringPos = ringPos + 1 == L ? 0 : ringPos + 1;
+
+      if(phase == 0)
+        {
+          out[m++] = sum/L;
+          phase = D;
+        }
+      phase--;
+    }
+  return m;
+}
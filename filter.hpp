@@ -0,0 +1,67 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <vector>
+
+
+
+typedef enum
+  {
+    FILTER_OFF, FILTER_FIR, FILTER_BIQUAD, FILTER_AVERAGE
+  }FILTER_TYPE;
+
+
+typedef struct
+{
+  FILTER_TYPE               type;
+  double                    cutoff;       // Hz, FIR and biquad
+  int                       order;        // FIR taps, biquad sections or average length
+  int                       decimation;
+}FILTER_SETTINGS;
+
+
+typedef struct
+{
+  double                    b0, b1, b2, a1, a2;
+  double                    z1, z2;
+}BIQUAD;
+
+
+
+// Streaming low-pass filter of one channel. State is kept between calls so
+// consecutive blocks of the stream filter as one continuous signal.
+class Filter
+{
+public:
+                            Filter(FILTER_SETTINGS, double);
+
+  int                       process(const double *, int, double *);
+  void                      process_held(const double *, int, double *);
+  void                      reset();
+  int                       decimation();
+
+private:
+  void                      design_fir();
+  void                      design_biquad();
+  int                       fir_block(const double *, int, double *);
+  int                       biquad_block(const double *, int, double *);
+  int                       average_block(const double *, int, double *);
+
+  FILTER_SETTINGS           settings;
+  double                    sampleRate;
+  int                       phase;
+  double                    last;
+
+  std::vector<double>       taps;
+  std::vector<double>       line;
+
+  std::vector<BIQUAD>       sections;
+  std::vector<double>       scratch;
+
+  std::vector<double>       ring;
+  int                       ringPos;
+  double                    sum;
+};
+
+
+#endif //FILTER_H
@@ -0,0 +1,173 @@
+#include "frames.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+// fraction of the swing an axis has to turn back by before a turn counts,
+// so noise on a slow ramp does not cut lines or frames
+#define FRAME_HYSTERESIS 0.25
+
+
+FrameBuilder::FrameBuilder(int size, int depth)
+  : frameMode(FRAME_OFF)
+  , level(0.0)
+{
+  resize(size, depth);
+}
+
+
+void FrameBuilder::resize(int size, int depth)
+{
+  cells     = size;
+  back      = std::vector<double>(size*size, 0.0);
+  ring      = std::vector<std::vector<double>>(std::max(depth, 1), back);
+  head      = 0;
+  stored    = 0;
+  completed = 0;
+  peakX     = peakY = -INFINITY;
+  fallingX  = fallingY = false;
+  prevSync  = 0.0;
+  minX      = minY = INFINITY;
+  maxX      = maxY = -INFINITY;
+  lineCount = 0;
+  lastLines = 0;
+  started   = false;
+}
+
+
+void FrameBuilder::set_mode(FRAME_MODE m, double l)
+{
+  frameMode = m;
+  level     = l;
+}
+
+
+FRAME_MODE FrameBuilder::mode()
+{
+  return frameMode;
+}
+
+
+int FrameBuilder::size()
+{
+  return cells;
+}
+
+
+int FrameBuilder::depth()
+{
+  return (int)ring.size();
+}
+
+
+size_t FrameBuilder::bytes()
+{
+  return (ring.size() + 1)*back.size()*sizeof(double);
+}
+
+
+int FrameBuilder::frames()
+{
+  return stored;
+}
+
+
+int FrameBuilder::lines()
+{
+  return lastLines;
+}
+
+
+long FrameBuilder::frame_count()
+{
+  return completed;
+}
+
+
+// True when an axis that was rising has come back from its peak by more
+// than the hysteresis, i.e. at the start of its flyback however many
+// samples that takes. The falling half is followed the same way, so the
+// next turn is only taken after the axis has risen again.
+static bool turned(double v, double & peak, bool & falling, double hysteresis)
+{
+  if(falling ? v < peak : v > peak)
+    peak = v;
+  else if(std::fabs(v - peak) > hysteresis)
+    {
+      falling = !falling;
+      peak    = v;
+      return falling;
+    }
+  return false;
+}
+
+
+// Bins one sample and reports whether it closed a frame. A line ends when
+// X turns back from its peak, a frame when Y does, or on a rising edge of
+// the sync channel.
+bool FrameBuilder::add(int xInd, int yInd, double x, double y, double sync, double z)
+{
+  bool line  = maxX > minX && turned(x, peakX, fallingX, (maxX - minX)*FRAME_HYSTERESIS);
+  bool frame = frameMode == FRAME_SYNC ? prevSync < level && sync >= level
+                                       : maxY > minY && turned(y, peakY, fallingY, (maxY - minY)*FRAME_HYSTERESIS);
+
+  prevSync = sync;
+  minX     = std::min(minX, x);
+  maxX     = std::max(maxX, x);
+  minY     = std::min(minY, y);
+  maxY     = std::max(maxY, y);
+  lineCount += line;
+
+  // everything before the first boundary is a partial frame
+  bool done = frame && lineCount > 1 && started;
+  if(done)
+    complete();
+  if(frame && !started)
+    {
+      started   = true;
+      lineCount = 0;
+      std::fill(back.begin(), back.end(), 0.0);
+    }
+
+  if(xInd >= 0 && xInd < cells && yInd >= 0 && yInd < cells)
+    back[yInd*cells + xInd] = z;
+
+  return done;
+}
+
+
+void FrameBuilder::complete()
+{
+  head = (head + 1) % ring.size();
+  ring[head] = back;
+  stored     = std::min(stored + 1, (int)ring.size());
+  std::fill(back.begin(), back.end(), 0.0);
+  completed++;
+
+  lastLines = lineCount;
+  lineCount = 0;
+}
+
+
+// age 0 is the newest complete frame
+const std::vector<double> & FrameBuilder::history(int age)
+{
+  age = std::clamp(age, 0, std::max(stored - 1, 0));
+  return ring[(head - age + ring.size()) % ring.size()];
+}
+
+
+void FrameBuilder::average(int count, std::vector<double> & out)
+{
+  count = std::clamp(count, 1, std::max(stored, 1));
+  out   = history(0);
+  for(int age = 1; age < count; age++)
+    {
+      const std::vector<double> & f = history(age);
+      for(size_t i = 0; i < out.size(); i++)
+        out[i] += f[i];
+    }
+  for(auto & v: out)
+    v /= count;
+}
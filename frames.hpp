@@ -0,0 +1,61 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <cstddef>
+#include <vector>
+
+
+
+typedef enum
+  {
+    FRAME_OFF, FRAME_FLYBACK, FRAME_SYNC
+  }FRAME_MODE;
+
+
+
+// Splits the XY sample stream into complete raster frames. Samples are
+// binned into a back buffer; when a frame boundary is detected the buffer
+// becomes the newest entry of a bounded history ring, so readers only ever
+// see finished frames.
+class FrameBuilder
+{
+public:
+                            FrameBuilder(int, int);
+
+  bool                      add(int, int, double, double, double, double);
+  void                      set_mode(FRAME_MODE, double);
+  void                      resize(int, int);
+  FRAME_MODE                mode();
+
+  int                       size();
+  int                       depth();
+  size_t                    bytes();
+  int                       frames();
+  int                       lines();
+  long                      frame_count();
+  const std::vector<double> & history(int);
+  void                      average(int, std::vector<double> &);
+
+private:
+  void                      complete();
+
+  FRAME_MODE                frameMode;
+  double                    level;
+  int                       cells;
+
+  std::vector<double>       back;
+  std::vector<std::vector<double>>  ring;
+  int                       head;
+  int                       stored;
+  long                      completed;
+
+  double                    peakX, peakY, prevSync;
+  bool                      fallingX, fallingY;
+  double                    minX, maxX, minY, maxY;
+  int                       lineCount;
+  int                       lastLines;
+  bool                      started;
+};
+
+
+#endif //FRAMES_H
@@ -0,0 +1,472 @@
+#include "history.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+
+
+static size_t record_size(int slots)
+{
+  return (sizeof(SPILL_RECORD) + 3*sizeof(float)*slots + 7) & ~(size_t)7;
+}
+
+
+static float * record_values(const SPILL_RECORD * record)
+{
+  return (float*)(record + 1);
+}
+
+
+static int open_scratch(const char * dir, const char * name)
+{
+  std::string path = std::string(dir) + "/live-plotter-" + name + "-XXXXXX";
+  std::vector<char> buffer(path.begin(), path.end());
+  buffer.push_back(0);
+
+  int fd = mkstemp(buffer.data());
+  if(fd < 0)
+    perror("History: mkstemp");
+  else
+    unlink(buffer.data());
+  return fd;
+}
+
+
+// Every spilled segment takes a fixed stride of the samples file, so a
+// position in the ring is found without a search.
+static size_t segment_stride(int slots)
+{
+  return (size_t)slots*HISTORY_SEGMENT*sizeof(int16_t);
+}
+
+
+History::History(int s, size_t capacity, const char * spillDir, size_t spillLimit)
+  : slots(s)
+  , committed(0)
+  , position(0)
+  , spilling(false)
+  , resident(false)
+  , spillSegments(0)
+  , spillBase(0)
+  , data({-1, nullptr, 0, 0})
+  , index({-1, nullptr, 0, 0})
+{
+  segments = (int)std::max<size_t>((capacity + HISTORY_SEGMENT - 1)/HISTORY_SEGMENT, 2);
+  raw        = std::vector<std::vector<int16_t>>(slots);
+  scale      = std::vector<std::vector<float>>(slots, std::vector<float>(segments, 0.0f));
+  staging    = std::vector<std::vector<double>>(slots, std::vector<double>(HISTORY_SEGMENT));
+  step       = std::vector<double>(slots, 0.0);
+  stagedStep = std::vector<double>(slots, 0.0);
+
+  if(spillDir)
+    {
+      data.fd  = open_scratch(spillDir, "samples");
+      index.fd = open_scratch(spillDir, "index");
+      spilling = data.fd >= 0 && index.fd >= 0;
+
+      struct statfs fs;
+      resident = statfs(spillDir, &fs) == 0 && (fs.f_type == TMPFS_MAGIC || fs.f_type == RAMFS_MAGIC);
+      if(resident)
+        printf("History: %s is held in memory, the spill counts against the memory budget\n", spillDir);
+      set_spill_limit(spillLimit);
+    }
+}
+
+
+History::~History()
+{
+  for(SPILL_FILE * f: {&data, &index})
+    {
+      if(f->base)
+        munmap(f->base, f->size);
+      if(f->fd >= 0)
+        close(f->fd);
+    }
+}
+
+
+long long History::count()
+{
+  return committed + position;
+}
+
+
+// the oldest sample index still held, in memory or spilled
+long long History::first()
+{
+  long long ring = std::max(0LL, committed - (long long)segments*HISTORY_SEGMENT);
+  if(spilling && spillSegments > 0)
+    return std::min(ring, oldest_spilled()*HISTORY_SEGMENT);
+  return ring;
+}
+
+
+// segment number of the oldest segment still in the spill ring
+long long History::oldest_spilled()
+{
+  return std::max(spillBase, committed/HISTORY_SEGMENT - spillSegments);
+}
+
+
+// resident memory, the spill files live in the page cache
+size_t History::bytes()
+{
+  size_t b = (size_t)slots*(segments*sizeof(float) + HISTORY_SEGMENT*sizeof(double));
+  for(auto & r: raw)
+    b += r.size()*sizeof(int16_t);
+  return b;
+}
+
+
+// what the spill files take on their file system
+size_t History::spilled()
+{
+  return data.size + index.size;
+}
+
+
+// true if the spill files are memory too
+bool History::spill_resident()
+{
+  return resident;
+}
+
+
+// Bytes the two files may take together. The ring keeps its segments
+// while it only grows and nothing has been overwritten yet; otherwise the
+// spilled past is dropped and the files start again from the next segment.
+void History::set_spill_limit(size_t bytes)
+{
+  if(!spilling)
+    return;
+
+  long long cap = (long long)(bytes/(segment_stride(slots) + record_size(slots)));
+  if(cap == spillSegments)
+    return;
+
+  long long stored = committed/HISTORY_SEGMENT - spillBase;
+  if(cap < spillSegments || stored > spillSegments)
+    {
+      spillBase = committed/HISTORY_SEGMENT;
+      release(data);
+      release(index);
+    }
+  spillSegments = cap;
+}
+
+
+// Step of one ADC count of the input feeding the slot, 0 for a derived
+// slot. A segment that was staged under two steps is scaled to its peak.
+void History::set_scale(int slot, double s)
+{
+  if(slot < 0 || slot >= slots || s == step[slot])
+    return;
+  step[slot] = s;
+  if(position > 0)
+    stagedStep[slot] = 0.0;
+  else
+    stagedStep[slot] = s;
+}
+
+
+// One sample for every slot. A sample that stands for several, because
+// the stream was thinned while the GUI was behind, is held for all of them
+// so the sample index stays the stream's; the held run is remembered for
+// thinned().
+void History::append(const double * values, int repeat)
+{
+  long long start = count();
+  for(int r = 0; r < repeat; r++)
+    {
+      for(int s = 0; s < slots; s++)
+        staging[s][position] = values[s];
+      if(++position == HISTORY_SEGMENT)
+        commit();
+    }
+
+  if(repeat <= 1)
+    return;
+  if(!gaps.empty() && gaps.back().second >= start)
+    gaps.back().second = start + repeat;
+  else
+    gaps.push_back({start + 1, start + repeat});
+  while(!gaps.empty() && gaps.front().second <= first())
+    gaps.pop_front();
+}
+
+
+// true if any sample of [from, to) was held rather than acquired
+bool History::thinned(long long from, long long to)
+{
+  for(auto & g: gaps)
+    if(g.first < to && from < g.second)
+      return true;
+  return false;
+}
+
+
+// Input slots are stored in counts of their range, which gives back the
+// ADC codes unchanged. Everything else, and a filtered input that rings
+// past the range, is quantised against the segment's own peak, so small
+// signals keep their resolution next to large ones.
+void History::commit()
+{
+  int seg = (int)((committed/HISTORY_SEGMENT) % segments);
+
+  for(int s = 0; s < slots; s++)
+    {
+      const double * v     = staging[s].data();
+      double         fixed = stagedStep[s];
+      double         peak  = 0.0;
+      for(int i = 0; i < HISTORY_SEGMENT; i++)
+        peak = std::max(peak, std::fabs(v[i]));
+      stagedStep[s] = step[s];
+
+      scale[s][seg] = 0.0f;
+      if(peak == 0.0)
+        continue;
+      if(raw[s].empty())
+        raw[s].resize((size_t)segments*HISTORY_SEGMENT);
+
+      double    unit = fixed > 0.0 && peak/fixed <= 32767.0 ? fixed : peak/32767.0;
+      double    inv  = 1.0/unit;
+      int16_t * out  = &raw[s][(size_t)seg*HISTORY_SEGMENT];
+      for(int i = 0; i < HISTORY_SEGMENT; i++)
+        out[i] = (int16_t)std::lrint(v[i]*inv);
+      scale[s][seg] = (float)unit;
+    }
+
+  if(spilling)
+    spill(seg);
+
+  committed += HISTORY_SEGMENT;
+  position   = 0;
+}
+
+
+// Files grow by doubling up to their share of the spill limit, and the
+// mapping is replaced each time. The blocks are allocated up front, so a
+// full disk stops the spill here instead of faulting a write later.
+bool History::grow(SPILL_FILE & f, size_t needed, size_t limit)
+{
+  if(needed <= f.size)
+    return true;
+
+  size_t size = std::min(std::max(needed, std::max(f.size*2, (size_t)64 << 20)), limit);
+  int    err  = posix_fallocate(f.fd, 0, size);
+  if(err != 0)
+    {
+      printf("History: posix_fallocate: %s\n", strerror(err));
+      return false;
+    }
+  if(f.base)
+    munmap(f.base, f.size);
+  f.base = (char*)mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, f.fd, 0);
+  if(f.base == MAP_FAILED)
+    {
+      perror("History: mmap");
+      f.base = nullptr;
+      f.size = 0;
+      return false;
+    }
+  f.size = size;
+  return true;
+}
+
+
+// unmaps the file and gives its blocks back
+void History::release(SPILL_FILE & f)
+{
+  if(f.base)
+    munmap(f.base, f.size);
+  if(ftruncate(f.fd, 0) != 0)
+    perror("History: ftruncate");
+  f.base = nullptr;
+  f.size = 0;
+  f.used = 0;
+}
+
+
+void History::spill(int seg)
+{
+  if(spillSegments <= 0)
+    return;
+
+  long long n      = committed/HISTORY_SEGMENT;
+  size_t    r      = (size_t)((n - spillBase) % spillSegments);
+  size_t    rs     = record_size(slots);
+  size_t    stride = segment_stride(slots);
+  if(!grow(index, (r + 1)*rs, spillSegments*rs) ||
+     !grow(data, (r + 1)*stride, spillSegments*stride))
+    {
+      printf("History: spilling stopped at sample %lld\n", committed);
+      spilling = false;
+      return;
+    }
+
+  SPILL_RECORD * record = (SPILL_RECORD*)(index.base + r*rs);
+  float *        values = record_values(record);
+  record->segment = n;
+
+  for(int s = 0; s < slots; s++)
+    {
+      int16_t lo = 0, hi = 0;
+      if(scale[s][seg] > 0.0f)
+        {
+          const int16_t * v  = &raw[s][(size_t)seg*HISTORY_SEGMENT];
+          auto            mm = std::minmax_element(v, v + HISTORY_SEGMENT);
+          lo = *mm.first;
+          hi = *mm.second;
+          memcpy(data.base + r*stride + (size_t)s*HISTORY_SEGMENT*sizeof(int16_t), v, HISTORY_SEGMENT*sizeof(int16_t));
+        }
+      values[3*s]     = scale[s][seg];
+      values[3*s + 1] = lo*scale[s][seg];
+      values[3*s + 2] = hi*scale[s][seg];
+    }
+  index.used = std::max(index.used, (r + 1)*rs);
+  data.used  = std::max(data.used, (r + 1)*stride);
+}
+
+
+// index record of a spilled segment, nullptr once it left the ring
+const SPILL_RECORD * History::record(long long segment)
+{
+  if(!spilling || spillSegments <= 0 || segment < oldest_spilled() || (segment + 1)*HISTORY_SEGMENT > committed)
+    return nullptr;
+  return (const SPILL_RECORD*)(index.base + (size_t)((segment - spillBase) % spillSegments)*record_size(slots));
+}
+
+
+// min and max of one sealed segment from the spill index
+bool History::summary(int slot, long long segment, float * lo, float * hi)
+{
+  const SPILL_RECORD * r = record(segment);
+  if(!r)
+    return false;
+
+  const float * values = record_values(r);
+  *lo = values[3*slot + 1];
+  *hi = values[3*slot + 2];
+  return true;
+}
+
+
+double History::value(int slot, long long i)
+{
+  if(i >= committed)
+    return staging[slot][i - committed];
+
+  // still in the in-memory ring
+  if(i >= committed - (long long)segments*HISTORY_SEGMENT)
+    {
+      int seg = (int)((i/HISTORY_SEGMENT) % segments);
+      if(scale[slot][seg] == 0.0f)
+        return 0.0;
+      return raw[slot][(size_t)seg*HISTORY_SEGMENT + i%HISTORY_SEGMENT]*(double)scale[slot][seg];
+    }
+
+  const SPILL_RECORD * r = i < 0 ? nullptr : record(i/HISTORY_SEGMENT);
+  if(!r)
+    return 0.0;
+
+  float step = record_values(r)[3*slot];
+  if(step == 0.0f)
+    return 0.0;
+
+  size_t offset = (size_t)((i/HISTORY_SEGMENT - spillBase) % spillSegments)*segment_stride(slots) +
+                  (size_t)slot*HISTORY_SEGMENT*sizeof(int16_t);
+  return ((const int16_t*)(data.base + offset))[i%HISTORY_SEGMENT]*(double)step;
+}
+
+
+// n samples from index on, which the caller keeps within [first(), count())
+void History::read(int slot, long long i, int n, double * out)
+{
+  for(int k = 0; k < n; k++)
+    out[k] = value(slot, i + k);
+}
+
+
+// Points for drawing [from, to) into the given number of columns: every
+// sample when they fit, otherwise the minimum and maximum of each column.
+// Whole sealed segments inside a column are taken from the summary index,
+// so a zoomed out view of hours of data only touches the index file.
+void History::envelope(int slot, long long from, long long to, int columns,
+                       std::vector<double> & keys, std::vector<double> & values)
+{
+  keys.clear();
+  values.clear();
+  from = std::max(from, first());
+  to   = std::min(to, count());
+  if(to <= from || columns < 1)
+    return;
+
+  long long n = to - from;
+  if(n <= 2*(long long)columns)
+    {
+      for(long long i = from; i < to; i++)
+        {
+          keys.push_back((double)i);
+          values.push_back(value(slot, i));
+        }
+      return;
+    }
+
+  for(int c = 0; c < columns; c++)
+    {
+      long long a = from + n*c/columns;
+      long long b = from + n*(c+1)/columns;
+      double    vMin = INFINITY, vMax = -INFINITY;
+      long long iMin = a, iMax = a;
+
+      long long i = a;
+      while(i < b)
+        {
+          float lo, hi;
+          if(i%HISTORY_SEGMENT == 0 && i + HISTORY_SEGMENT <= b &&
+             summary(slot, i/HISTORY_SEGMENT, &lo, &hi))
+            {
+              if(lo < vMin)
+                {
+                  vMin = lo;
+                  iMin = i;
+                }
+              if(hi > vMax)
+                {
+                  vMax = hi;
+                  iMax = i + HISTORY_SEGMENT - 1;
+                }
+              i += HISTORY_SEGMENT;
+              continue;
+            }
+
+          double v = value(slot, i);
+          if(v < vMin)
+            {
+              vMin = v;
+              iMin = i;
+            }
+          if(v > vMax)
+            {
+              vMax = v;
+              iMax = i;
+            }
+          i++;
+        }
+
+      keys.push_back((double)std::min(iMin, iMax));
+      values.push_back(iMin < iMax ? vMin : vMax);
+      keys.push_back((double)std::max(iMin, iMax));
+      values.push_back(iMin < iMax ? vMax : vMin);
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+#define HISTORY_SEGMENT 1024
+
+
+// Index record of one spilled segment, followed by scale, min and max per
+// slot. Slots that were all zero have scale 0.
+typedef struct
+{
+  int64_t                   segment;
+}SPILL_RECORD;
+
+
+
+// Shared mapping of a scratch file, grown in steps up to the spill limit;
+// the pages belong to the page cache, so the process footprint stays fixed
+// however large it gets.
+typedef struct
+{
+  int                       fd;
+  char *                    base;
+  size_t                    size;
+  size_t                    used;
+}SPILL_FILE;
+
+
+// Time plot history for a fixed set of slots. Samples are stored as int16
+// with one scale per slot and segment of HISTORY_SEGMENT samples, the
+// timebase is the implicit sample index, and values are only turned back
+// into voltages for the points that are read. A slot fed straight from an
+// input is given the step of its range, so the stored values are the ADC
+// codes; derived slots are scaled to the peak of each segment. A slot
+// takes no memory until its first segment that is not all zero.
+//
+// With a spill directory every sealed segment is also written to a memory
+// mapped file together with a min/max summary, so far more than the
+// in-memory ring stays reachable. The files are a ring of their own that
+// never grows past the spill limit; once it is full the oldest spilled
+// segments are overwritten.
+class History
+{
+public:
+                            History(int, size_t, const char * = nullptr, size_t = (size_t)4096 << 20);
+                            ~History();
+
+  void                      set_scale(int, double);
+  void                      append(const double *, int = 1);
+  bool                      thinned(long long, long long);
+  long long                 count();
+  long long                 first();
+  double                    value(int, long long);
+  void                      read(int, long long, int, double *);
+  void                      envelope(int, long long, long long, int, std::vector<double> &, std::vector<double> &);
+  size_t                    bytes();
+  size_t                    spilled();
+  bool                      spill_resident();
+  void                      set_spill_limit(size_t);
+
+private:
+  void                      commit();
+  void                      spill(int);
+  bool                      grow(SPILL_FILE &, size_t, size_t);
+  void                      release(SPILL_FILE &);
+  long long                 oldest_spilled();
+  const SPILL_RECORD *      record(long long);
+  bool                      summary(int, long long, float *, float *);
+
+  int                       slots;
+  int                       segments;
+  long long                 committed;
+  int                       position;
+
+  std::vector<std::vector<int16_t>>   raw;
+  std::vector<std::vector<float>>     scale;
+  std::vector<std::vector<double>>    staging;
+  std::vector<double>                 step;
+  std::vector<double>                 stagedStep;
+  std::deque<std::pair<long long, long long>>  gaps;
+
+  bool                      spilling;
+  bool                      resident;     // the spill directory is a tmpfs
+  long long                 spillSegments;
+  long long                 spillBase;    // first segment of the spill ring
+  SPILL_FILE                data;
+  SPILL_FILE                index;
+};
+
+
+#endif //HISTORY_H
@@ -2,7 +2,7 @@
 # Automatically generated by qmake (3.1) Sat May 21 22:47:35 2022
 ######################################################################
 
-QT += core gui widgets
+QT += core gui widgets concurrent
 TEMPLATE = app
 TARGET = live-plotter-4000
 INCLUDEPATH += ./ /opt/picoscope/include/
@@ -18,6 +18,7 @@ DEFINES += QCUSTOMPLOT_USE_LIBRARY
 
 LIBS += -L. -lqcustomplot
 LIBS += -L/opt/picoscope/lib -lps4000a
+LIBS += -lrt -ldl
 # Input
-HEADERS += window.hpp
-SOURCES += main.cpp window.cpp plot.cpp
+HEADERS += window.hpp filter.hpp lockin.hpp stats.hpp average.hpp phosphor.hpp frames.hpp simd.hpp accumulator.hpp devicequeue.hpp history.hpp shmring.hpp plugin_api.h plugins.hpp colorlayer.hpp recorder.hpp registry.hpp trace.hpp resample.hpp budget.hpp scanmap.hpp reprocess.hpp alarm.hpp spectrum.hpp
+SOURCES += main.cpp window.cpp plot.cpp filter.cpp lockin.cpp stats.cpp average.cpp phosphor.cpp frames.cpp accumulator.cpp devicequeue.cpp history.cpp shmring.cpp plugins.cpp colorlayer.cpp recorder.cpp registry.cpp trace.cpp resample.cpp budget.cpp scanmap.cpp reprocess.cpp alarm.cpp spectrum.cpp
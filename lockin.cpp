@@ -0,0 +1,160 @@
+#include "lockin.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+LockIn::LockIn(LOCKIN_SETTINGS s, double fs)
+  : settings(s)
+  , sampleRate(fs)
+  , phase(0)
+  , ncoPhase(0.0)
+  , pllError(0.0)
+  , pllAmplitude(1.0)
+{
+  settings.order      = std::clamp(settings.order, 1, 4);
+  settings.decimation = std::max(settings.decimation, 1);
+
+  alpha        = 1.0 - std::exp(-1.0/(std::max(settings.timeConstant, 1.0/fs)*fs));
+  ncoFrequency = 2.0*M_PI*settings.frequency/fs;
+
+  // second order loop, damping 0.707, phase detector gain 1/2
+  double wn = 2.0*M_PI*settings.bandwidth/fs;
+  kp = 2.0*0.707*wn/0.5;
+  ki = wn*wn/0.5;
+
+  state = std::vector<double>(LOCKIN_SIGNALS*4*2, 0.0);
+  last  = std::vector<double>(LOCKIN_SIGNALS*LI_OUTPUTS, 0.0);
+}
+
+
+bool LockIn::active()
+{
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    if(settings.signal[k])
+      return true;
+  return false;
+}
+
+
+// Builds the interleaved sin/cos reference for one block, either from the
+// free running oscillator or from the PLL following the reference channel.
+void LockIn::reference_block(const double * ref, int n)
+{
+  if((int)reference.size() < 2*n)
+    reference.resize(2*n);
+
+  double errAlpha = 1.0 - std::exp(-2.0*M_PI*10.0*settings.bandwidth/sampleRate);
+  double ampAlpha = 1.0 - std::exp(-2.0*M_PI*settings.frequency/(10.0*sampleRate));
+
+  for(int i = 0; i < n; i++)
+    {
+      reference[2*i]   = std::sin(ncoPhase);
+      reference[2*i+1] = std::cos(ncoPhase);
+
+      double step = ncoFrequency;
+      if(ref)
+        {
+          pllAmplitude += ampAlpha*(std::fabs(ref[i])*M_PI/2.0 - pllAmplitude);
+          double e = ref[i]/std::max(pllAmplitude, 1e-9)*reference[2*i+1];
+          pllError     += errAlpha*(e - pllError);
+          ncoFrequency += ki*pllError;
+          step          = ncoFrequency + kp*pllError;
+        }
+
+      // the PLL step can be negative while it acquires
+      ncoPhase += step;
+      if(std::fabs(ncoPhase) > 2.0*M_PI)
+        ncoPhase = std::remainder(ncoPhase, 2.0*M_PI);
+    }
+}
+
+
+// sig[k] is null for unused signal slots. out[k*LI_OUTPUTS+o] receives n
+// samples, holding each decimated output until the next one.
+void LockIn::process(const double * ref, const double ** sig, int n, double ** out)
+{
+  reference_block(ref, n);
+
+  const double * r     = reference.data();
+  int            D     = settings.decimation;
+  int            first = phase;
+
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    {
+      if(!sig[k])
+        continue;
+
+      const double * s    = sig[k];
+      double *       z    = &state[k*4*2];
+      double *       held = &last[k*LI_OUTPUTS];
+      int            next = first;
+
+#if defined(__SSE2__)
+      // X and Y of one signal share a register, each RC stage is one
+      // multiply-add over both lanes
+      __m128d a = _mm_set1_pd(alpha);
+      __m128d zs[4];
+      for(int st = 0; st < settings.order; st++)
+        zs[st] = _mm_loadu_pd(z + 2*st);
+
+      for(int i = 0; i < n; i++)
+        {
+          __m128d v = _mm_mul_pd(_mm_set1_pd(2.0*s[i]), _mm_loadu_pd(r + 2*i));
+          for(int st = 0; st < settings.order; st++)
+            {
+              zs[st] = _mm_add_pd(zs[st], _mm_mul_pd(a, _mm_sub_pd(v, zs[st])));
+              v      = zs[st];
+            }
+
+          if(i == next)
+            {
+              double xy[2];
+              _mm_storeu_pd(xy, v);
+              held[LI_X]     = xy[0];
+              held[LI_Y]     = xy[1];
+              held[LI_R]     = std::sqrt(xy[0]*xy[0] + xy[1]*xy[1]);
+              held[LI_THETA] = std::atan2(xy[1], xy[0]);
+              next += D;
+            }
+
+          for(int o = 0; o < LI_OUTPUTS; o++)
+            out[k*LI_OUTPUTS+o][i] = held[o];
+        }
+
+      for(int st = 0; st < settings.order; st++)
+        _mm_storeu_pd(z + 2*st, zs[st]);
+#else
+      for(int i = 0; i < n; i++)
+        {
+          double x = 2.0*s[i]*r[2*i];
+          double y = 2.0*s[i]*r[2*i+1];
+          for(int st = 0; st < settings.order; st++)
+            {
+              z[2*st]   += alpha*(x - z[2*st]);
+              z[2*st+1] += alpha*(y - z[2*st+1]);
+              x = z[2*st];
+              y = z[2*st+1];
+            }
+
+          if(i == next)
+            {
+              held[LI_X]     = x;
+              held[LI_Y]     = y;
+              held[LI_R]     = std::sqrt(x*x + y*y);
+              held[LI_THETA] = std::atan2(y, x);
+              next += D;
+            }
+
+          for(int o = 0; o < LI_OUTPUTS; o++)
+            out[k*LI_OUTPUTS+o][i] = held[o];
+        }
+#endif
+    }
+
+  int i = first;
+  while(i < n)
+    i += D;
+  phase = i - n;
+}
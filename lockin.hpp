@@ -0,0 +1,59 @@
+#ifndef LOCKIN_H
+#define LOCKIN_H
+
+#include <vector>
+
+
+#define LOCKIN_SIGNALS 4
+
+
+typedef enum
+  {
+    LI_X, LI_Y, LI_R, LI_THETA, LI_OUTPUTS
+  }LOCKIN_OUTPUT;
+
+
+typedef struct
+{
+  int                       reference;                // MODE of the reference, OFF = internal oscillator
+  double                    frequency;                // Hz, oscillator or PLL start frequency
+  double                    bandwidth;                // Hz, PLL loop bandwidth
+  double                    timeConstant;             // s
+  int                       order;                    // cascaded RC stages, 1..4
+  int                       decimation;
+  int                       signal[LOCKIN_SIGNALS];   // MODE of each demodulated channel, OFF = unused
+}LOCKIN_SETTINGS;
+
+
+
+// Dual-phase lock-in amplifier. One reference (internal oscillator or a PLL
+// tracking a reference channel) demodulates up to LOCKIN_SIGNALS channels.
+class LockIn
+{
+public:
+                            LockIn(LOCKIN_SETTINGS, double);
+
+  void                      process(const double *, const double **, int, double **);
+  bool                      active();
+
+private:
+  void                      reference_block(const double *, int);
+
+  LOCKIN_SETTINGS           settings;
+  double                    sampleRate;
+  double                    alpha;
+  int                       phase;
+
+  double                    ncoPhase;
+  double                    ncoFrequency;
+  double                    pllError;
+  double                    pllAmplitude;
+  double                    kp, ki;
+
+  std::vector<double>       reference;                // interleaved sin, cos
+  std::vector<double>       state;                    // [signal][stage][X,Y]
+  std::vector<double>       last;                     // [signal][output]
+};
+
+
+#endif //LOCKIN_H
@@ -3,6 +3,7 @@
 #include <QStringList>
 #include <QThread>
 #include "window.hpp"
+#include "reprocess.hpp"
 
 #include <libps4000a-1.0/ps4000aApi.h>
 #ifndef PICO_STATUS
@@ -13,6 +14,23 @@
 
 int main(int argc, char **argv) {
 
+  // batch mode: live-plotter-4000 --reprocess <recording> [options]
+  if(argc > 1 && std::string(argv[1]) == "--reprocess")
+    {
+      REPROCESS_SETTINGS settings;
+      if(!reprocess_arguments(argc - 2, argv + 2, &settings))
+        return 1;
+      SCAN_CALIBRATION saved  = Window::saved_calibration(-1.0, 1.0, -1.0, 1.0);
+      bool             fitted = saved.volts[0].size() >= 2 || saved.volts[1].size() >= 2;
+      int              delay  = settings.calibration.delay;
+      if(settings.calibrated && fitted)
+        settings.calibration = saved;
+      else
+        settings.calibrated = false;
+      settings.calibration.delay = delay >= 0 ? delay : saved.delay;
+      return reprocess(settings) ? 0 : 1;
+    }
+
   QApplication app(argc, argv);
   Window window;
   window.start();
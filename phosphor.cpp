@@ -0,0 +1,99 @@
+#include "phosphor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+Phosphor::Phosphor(PHOSPHOR_SETTINGS s)
+  : settings(s)
+  , position(0)
+  , lastColumn(-1)
+  , lastRow(0)
+  , previous(0.0)
+{
+  settings.width  = std::max(settings.width, 2);
+  settings.height = std::max(settings.height, 2);
+  settings.span   = std::max(settings.span, 2);
+  if(settings.max <= settings.min)
+    settings.max = settings.min + 1.0;
+
+  hits = std::vector<float>(settings.width*settings.height, 0.0f);
+}
+
+
+int Phosphor::width()
+{
+  return settings.width;
+}
+
+
+int Phosphor::height()
+{
+  return settings.height;
+}
+
+
+int Phosphor::row(double v)
+{
+  int r = (int)((v - settings.min)/(settings.max - settings.min)*settings.height);
+  return std::clamp(r, 0, settings.height - 1);
+}
+
+
+// Consecutive samples are joined by a vertical run in the column of the
+// newer one, so steep edges stay continuous at any zoom.
+void Phosphor::process(const double * x, int n)
+{
+  for(int i = 0; i < n; i++)
+    {
+      if(position < 0)
+        {
+          bool edge = previous < settings.level && x[i] >= settings.level;
+          previous  = x[i];
+          if(!edge)
+            continue;
+          position   = 0;
+          lastColumn = -1;
+        }
+
+      int col = (int)((long)position*settings.width/settings.span);
+      int r   = row(x[i]);
+
+      int lo = r, hi = r;
+      if(lastColumn >= 0 && col - lastColumn <= 1)
+        {
+          lo = std::min(r, lastRow + (r > lastRow ? 1 : 0));
+          hi = std::max(r, lastRow - (r < lastRow ? 1 : 0));
+        }
+      float * column = &hits[col];
+      for(int y = lo; y <= hi; y++)
+        column[y*settings.width] += 1.0f;
+
+      lastColumn = col;
+      lastRow    = r;
+      previous   = x[i];
+
+      if(++position == settings.span)
+        {
+          position   = settings.trigger ? -1 : 0;
+          lastColumn = -1;
+        }
+    }
+}
+
+
+// Writes log-scaled intensities in [0,1], row 0 at the lowest voltage, and
+// then lets the histogram decay by dt seconds.
+void Phosphor::frame(double dt, double * out)
+{
+  int   n   = (int)hits.size();
+  float max = *std::max_element(hits.begin(), hits.end());
+  float norm = max > 0.0f ? 1.0f/std::log1p(max) : 0.0f;
+
+  for(int i = 0; i < n; i++)
+    out[i] = std::log1p(hits[i])*norm;
+
+  float decay = settings.persistence > 0.0 ? (float)std::exp(-dt/settings.persistence) : 0.0f;
+  for(int i = 0; i < n; i++)
+    hits[i] *= decay;
+}
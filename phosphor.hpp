@@ -0,0 +1,48 @@
+#ifndef PHOSPHOR_H
+#define PHOSPHOR_H
+
+#include <vector>
+
+
+
+typedef struct
+{
+  int                       source;       // data slot, -1 = off
+  int                       width;        // time bins
+  int                       height;       // voltage bins
+  int                       span;         // samples across the width
+  double                    min;          // voltage range
+  double                    max;
+  double                    persistence;  // s until a hit fades to 1/e, 0 = none
+  bool                      trigger;      // start sweeps on a rising crossing of level
+  double                    level;
+}PHOSPHOR_SETTINGS;
+
+
+
+// Digital phosphor: samples are rasterised into a hit-count histogram of
+// time within the sweep against voltage. The histogram fades once per
+// frame, so the display cost only depends on the image size.
+class Phosphor
+{
+public:
+                            Phosphor(PHOSPHOR_SETTINGS);
+
+  void                      process(const double *, int);
+  void                      frame(double, double *);
+  int                       width();
+  int                       height();
+
+private:
+  int                       row(double);
+
+  PHOSPHOR_SETTINGS         settings;
+  std::vector<float>        hits;
+  int                       position;     // sample index within the sweep, -1 while armed
+  int                       lastColumn;
+  int                       lastRow;
+  double                    previous;
+};
+
+
+#endif //PHOSPHOR_H
@@ -1,14 +1,72 @@
 #include <QApplication>
+#include <QDateTime>
 #include <QThread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <window.hpp>
+#include <string>
+#include <thread>
 #include <vector>
+#include "simd.hpp"
 
 
 Worker::Worker()
 {
   voltages = {10.0, 20.0, 50.0, 100.0, 200.0, 500.0, 1000.0, 2000.0, 5000.0, 10000.0, 20000.0, 50000.0};
+
+  lockin_settings.reference    = OFF;
+  lockin_settings.frequency    = 1000.0;
+  lockin_settings.bandwidth    = 10.0;
+  lockin_settings.timeConstant = 0.01;
+  lockin_settings.order        = 2;
+  lockin_settings.decimation   = 10;
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    lockin_settings.signal[k] = OFF;
+
+  average_settings.source  = -1;
+  average_settings.trigger = 0;
+  average_settings.level   = 0.0;
+  average_settings.rising  = true;
+  average_settings.length  = 1000;
+  average_settings.mode    = AVG_COUNT;
+  average_settings.sweeps  = 100;
+
+  phosphor_settings.source      = -1;
+  phosphor_settings.width       = 400;
+  phosphor_settings.height      = 256;
+  phosphor_settings.span        = 800;
+  phosphor_settings.min         = -10000.0;
+  phosphor_settings.max         = 10000.0;
+  phosphor_settings.persistence = 0.5;
+  phosphor_settings.trigger     = false;
+  phosphor_settings.level       = 0.0;
+
+  reconfigPending = false;
+  shmBlocks       = nullptr;
+
+  const char * pluginDir = getenv("LIVE_PLOTTER_PLUGINS");
+  plugins.load_directory(pluginDir ? pluginDir : "plugins", PLUGIN_SLOT, PLUGIN_OUTPUTS);
+}
+
+
+void Worker::set_lockin(LOCKIN_SETTINGS settings)
+{
+  lockin_settings = settings;
+}
+
+
+void Worker::set_average(AVERAGE_SETTINGS settings)
+{
+  average_settings = settings;
+}
+
+
+void Worker::set_phosphor(PHOSPHOR_SETTINGS settings)
+{
+  phosphor_settings = settings;
 }
 
 
@@ -18,50 +76,103 @@ double Worker::adc_to_voltage(int range, int16_t maxBits, int16_t bits)
 }
 
 
+void Worker::convert_block(UNIT * unit, int ch, uint32_t startIndex, int32_t sampleCount)
+{
+  CHANNEL_SETTINGS * settings = &unit->channelSettings[ch];
+
+  simd_scale_int16(&settings->app_buffer[startIndex],
+                   sampleCount,
+                   adc_to_voltage(settings->range, unit->maxSampleValue, 1),
+                   settings->voltage_buffer);
+
+  if(settings->filterStage)
+    settings->filterStage->process_held(settings->voltage_buffer, sampleCount, settings->voltage_buffer);
+}
+
+
 
 void Worker::stream_data(UNIT * unit)
 {
   BUFFER_INFO buffer_info;
   buffer_info.unit = new UNIT[_UNITCOUNT_];
   uint32_t    sampleCount = 10000;
-  uint32_t    sampleInterval = 10;
 
+  // the fastest unit sets the timebase of the stream
+  g_sampleInterval = 0;
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
-    buffer_info.unit[u] = unit[u];
+    if(!g_sampleInterval || unit[u].sampleInterval < g_sampleInterval)
+      g_sampleInterval = unit[u].sampleInterval;
+  if(!g_sampleInterval)
+    g_sampleInterval = 10;
 
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
     {
-      for (int ch = 0; ch < buffer_info.unit[u].channelCount; ch++)
+      buffer_info.unit[u] = unit[u];
+      buffer_info.unit[u].readyCount = 0;
+      for(int ch = 0; ch < buffer_info.unit[u].channelCount; ch++)
         {
-          if(buffer_info.unit[u].channelSettings[ch].enabled)
-            {
-              buffer_info.unit[u].channelSettings[ch].driver_buffer = (int16_t*) calloc(sampleCount, sizeof(int16_t));
-
-              ps4000aSetDataBuffer(buffer_info.unit[u].handle,
-                                   (PS4000A_CHANNEL)ch,
-                                   buffer_info.unit[u].channelSettings[ch].driver_buffer,
-                                   sampleCount,
-                                   0,
-                                   PS4000A_RATIO_MODE_NONE);
-
-              buffer_info.unit[u].channelSettings[ch].app_buffer = (int16_t*) calloc(sampleCount, sizeof(int16_t));
-              buffer_info.unit[u].channelSettings[ch].bufferEnabled = true;
-            }
+          CHANNEL_SETTINGS * settings = &buffer_info.unit[u].channelSettings[ch];
+          settings->driver_buffer  = nullptr;
+          settings->app_buffer     = nullptr;
+          settings->voltage_buffer = nullptr;
+          settings->filterStage    = nullptr;
+          settings->resampler      = nullptr;
+          settings->bufferEnabled  = false;
+          if(settings->enabled)
+            prepare_channel(&buffer_info.unit[u], ch, sampleCount);
         }
     }
 
+  {
+    std::lock_guard<std::mutex> lock(reconfigMutex);
+    pendingReconfig.clear();
+    reconfigPending = false;
+  }
+  restartTime    = std::vector<std::chrono::steady_clock::time_point>(_UNITCOUNT_);
+  restartPending = std::vector<bool>(_UNITCOUNT_, false);
+
+  LockIn                            lockIn(lockin_settings, 1.0e6/(double)g_sampleInterval);
+  std::vector<std::vector<double>>  lockin_out(LOCKIN_SIGNALS*LI_OUTPUTS, std::vector<double>(sampleCount));
+  double *                          lockin_ptr[LOCKIN_SIGNALS*LI_OUTPUTS];
+  for(int o = 0; o < LOCKIN_SIGNALS*LI_OUTPUTS; o++)
+    lockin_ptr[o] = lockin_out[o].data();
+
+  std::vector<Measurement>          measurement(data_slots(), Measurement(1.0e6/(double)g_sampleInterval, g_measureWindow));
+  std::vector<double>               measure_vec(data_slots()*2*M_VALUES);
+  double                            measureWindow = g_measureWindow;
+  int64_t                           measureCount  = 0;
+  Averager                          averager(average_settings);
+  std::vector<double>               average_mean, average_sigma;
+  Phosphor                          phosphor_stage(phosphor_settings);
+  std::vector<double>               phosphor_frame(phosphor_stage.width()*phosphor_stage.height());
+  QCPColorGradient                  phosphor_gradient(QCPColorGradient::gpHot);
+  int64_t                           phosphorCount = 0;
+
+  uint64_t                          published = 0;
+  int64_t                           stage_ns[ST_STAGES] = {0};
+  std::vector<double>               stage_vec;
+  int64_t                           blockCount = 0;
+  std::vector<const double *>       slot_block(data_slots(), nullptr);
+  uint64_t                          traceBlock = 0;
+  std::vector<ALARM_EVENT>          alarm_vec;
+  std::vector<std::string>          variables;
+  for(int slot = 0; slot < data_slots(); slot++)
+    variables.push_back(slot_variable(slot));
+  g_tracer.name_thread("Acquisition");
+  g_tracer.reset();
+  plugins.start(1.0e6/(double)g_sampleInterval, slot_labels(), sampleCount);
+  alarms.start(1.0e6/(double)g_sampleInterval, variables);
+  if(!shmBlocks)
+    shmBlocks = new ShmWriter(SHM_BLOCKS_NAME, (size_t)64 << 20, 1.0e6/(double)g_sampleInterval, 1.0e-3, slot_labels());
+  shmBlocks->start_stream(1.0e6/(double)g_sampleInterval);
+
   g_streamIsRunning = true;
 
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
-  ps4000aRunStreaming(buffer_info.unit[u].handle,
-                      &sampleInterval,
-                      PS4000A_US,
-                      0,//preTrigger
-                      0,//postTrigger
-                      0,//autostop
-                      1,//downsampleRatio
-                      PS4000A_RATIO_MODE_NONE,
-                      sampleCount);
+    start_unit(&buffer_info.unit[u], sampleCount);
+  emit(history_scales(slot_steps(&buffer_info)));
+  int announced = 1;
+  emit(sample_stride(announced));
 
 
   // FILE * file_ptr = fopen("data/stream.txt", "w");
@@ -74,57 +185,604 @@ void Worker::stream_data(UNIT * unit)
 
   do
     {
+      if(reconfigPending)
+        {
+          apply_reconfig(&buffer_info, sampleCount);
+          emit(history_scales(slot_steps(&buffer_info)));
+        }
+
       g_ready = 0;
 
       for(int16_t u = 0; u < _UNITCOUNT_; u++)
-        ps4000aGetStreamingLatestValues(buffer_info.unit[u].handle,
-                                        callback,
-                                        &buffer_info);
+        {
+          buffer_info.unit[u].readyCount = 0;
+          ps4000aGetStreamingLatestValues(buffer_info.unit[u].handle,
+                                          callback,
+                                          &buffer_info);
+        }
+
+      // the gap of a restarted unit ends with its own first block
+      for(int16_t u = 0; u < _UNITCOUNT_; u++)
+        if(restartPending[u] && buffer_info.unit[u].readyCount > 0)
+          {
+            restartPending[u] = false;
+            emit(reconfigured(u, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - restartTime[u]).count()));
+          }
+
+      // slower units are converted at their own rate as their blocks come
+      // in and wait in the resamplers until the next block of the stream
+      for(int16_t u = 0; u < _UNITCOUNT_; u++)
+        {
+          UNIT * slow = &buffer_info.unit[u];
+          if(slow->readyCount <= 0 || slow->sampleInterval <= g_sampleInterval)
+            continue;
+          for(int ch = 0; ch < slow->channelCount; ch++)
+            if(slow->channelSettings[ch].enabled && slow->channelSettings[ch].resampler)
+              {
+                convert_block(slow, ch, slow->readyStart, slow->readyCount);
+                slow->channelSettings[ch].resampler->push(slow->channelSettings[ch].voltage_buffer, slow->readyCount);
+              }
+        }
 
       if(g_ready && g_sampleCount > 0)
         {
-          std::vector<double> data_vec(12);
+          std::vector<double> data_vec(data_slots());
+          const double *      mode_block[Z9+1] = {nullptr};
+
+          uint64_t block        = traceBlock++;
+          int64_t  convertStart = g_tracer.now();
+          g_tracer.begin_block(block, g_callbackTime);
+          g_tracer.stage(TR_CALLBACK, block, g_callbackTime, convertStart);
+
+          auto tick = std::chrono::steady_clock::now();
+          auto lap  = [&](PIPELINE_STAGE stage)
+          {
+            auto now = std::chrono::steady_clock::now();
+            stage_ns[stage] += std::chrono::duration_cast<std::chrono::nanoseconds>(now - tick).count();
+            tick = now;
+          };
+
+          for(int16_t u = 0; u < _UNITCOUNT_; u++)
+            for(int ch = 0; ch < buffer_info.unit[u].channelCount; ch++)
+              if(buffer_info.unit[u].channelSettings[ch].enabled)
+                {
+                  if(buffer_info.unit[u].channelSettings[ch].resampler)
+                    buffer_info.unit[u].channelSettings[ch].resampler->pull(buffer_info.unit[u].channelSettings[ch].voltage_buffer, g_sampleCount);
+                  else
+                    convert_block(&buffer_info.unit[u], ch, g_startIndex, g_sampleCount);
+                  mode_block[buffer_info.unit[u].channelSettings[ch].mode] = buffer_info.unit[u].channelSettings[ch].voltage_buffer;
+                }
+          lap(ST_CONVERT);
+          g_tracer.stage(TR_CONVERT, block, convertStart, g_tracer.now());
+
+          record_block(&buffer_info);
+          lap(ST_RECORD);
+
+          if(lockIn.active())
+            {
+              const double * signal_block[LOCKIN_SIGNALS];
+              for(int k = 0; k < LOCKIN_SIGNALS; k++)
+                signal_block[k] = lockin_settings.signal[k] ? mode_block[lockin_settings.signal[k]] : nullptr;
+
+              lockIn.process(lockin_settings.reference ? mode_block[lockin_settings.reference] : nullptr,
+                             signal_block, g_sampleCount, lockin_ptr);
+            }
+          lap(ST_LOCKIN);
+
+          if(measureWindow != g_measureWindow)
+            {
+              measureWindow = g_measureWindow;
+              for(auto & m: measurement)
+                m.set_window(measureWindow);
+            }
+          if(g_measureReset)
+            {
+              g_measureReset = false;
+              for(auto & m: measurement)
+                m.reset();
+            }
 
-          for(int i = g_startIndex; i < (int32_t)(g_startIndex + g_sampleCount); i++)
+          for(int slot = 0; slot < data_slots(); slot++)
             {
+              const CHANNEL_ENTRY & e = g_channels.entry(slot);
+              slot_block[slot] = slot < LOCKIN_SLOT ? mode_block[slot+1] : nullptr;
+              if(e.kind == CH_LOCKIN && lockin_settings.signal[(slot-LOCKIN_SLOT)/LI_OUTPUTS])
+                slot_block[slot] = lockin_ptr[slot-LOCKIN_SLOT];
+              if(e.kind == CH_INPUT && buffer_info.unit[e.unit].channelSettings[e.input].enabled)
+                slot_block[slot] = buffer_info.unit[e.unit].channelSettings[e.input].voltage_buffer;
+            }
+
+          plugins.process(slot_block.data(), data_slots(), g_sampleCount);
+          lap(ST_PLUGINS);
+
+          // right behind the stages that produce slots, ahead of everything
+          // that only reports; the latency of an event runs from the arrival
+          // of its sample, the last of the block arriving with the callback
+          int64_t alarmStart = g_tracer.now();
+          alarms.process(slot_block.data(), data_slots(), g_sampleCount, published, alarm_vec);
+          int64_t alarmEnd = g_tracer.now();
+          g_tracer.stage(TR_ALARM, block, alarmStart, alarmEnd);
+          if(!alarm_vec.empty())
+            {
+              for(auto & e: alarm_vec)
+                e.latency = alarmEnd - g_callbackTime +
+                            (int64_t)(published + g_sampleCount - 1 - e.detected)*g_sampleInterval*1000;
+              emit(alarm_events(alarm_vec));
+              alarm_vec.clear();
+            }
+          lap(ST_ALARM);
+
+          for(int slot = 0; slot < data_slots(); slot++)
+            if(slot_block[slot])
+              measurement[slot].process(slot_block[slot], g_sampleCount);
+          lap(ST_MEASURE);
+
+          if(g_publish)
+            shmBlocks->publish_block(published, slot_block.data(), data_slots(), g_sampleCount);
+          published += g_sampleCount;
+          lap(ST_PUBLISH);
+
+          if(g_averageReset)
+            {
+              g_averageReset = false;
+              averager.reset();
+            }
+          if(average_settings.source >= 0 &&
+             slot_block[average_settings.source] && slot_block[average_settings.trigger])
+            averager.process(slot_block[average_settings.trigger], slot_block[average_settings.source], g_sampleCount);
+          lap(ST_AVERAGE);
+
+          if(phosphor_settings.source >= 0 && slot_block[phosphor_settings.source])
+            {
+              phosphor_stage.process(slot_block[phosphor_settings.source], g_sampleCount);
+
+              // frames at 25 Hz of acquisition time, coloured on this thread
+              phosphorCount += g_sampleCount;
+              if(phosphorCount*g_sampleInterval >= 40000)
+                {
+                  phosphor_stage.frame(phosphorCount*g_sampleInterval*1.0e-6, phosphor_frame.data());
+                  phosphorCount = 0;
+
+                  int   w = phosphor_stage.width(), h = phosphor_stage.height();
+                  QImage image(w, h, QImage::Format_ARGB32_Premultiplied);
+                  for(int row = 0; row < h; row++)
+                    phosphor_gradient.colorize(&phosphor_frame[row*w], QCPRange(0.0, 1.0),
+                                               (QRgb*)image.scanLine(h-1-row), w);
+                  emit(phosphor(image));
+                }
+            }
+          lap(ST_PHOSPHOR);
+
+          // results go out at about 10 Hz, independent of the block size
+          measureCount += g_sampleCount;
+          blockCount++;
+          if(measureCount*g_sampleInterval >= 100000)
+            {
+              // ns per stage, then per plug-in, then the acquisition time
+              // they cover in ns and the number of blocks
+              stage_vec.assign(stage_ns, stage_ns + ST_STAGES);
+              plugins.take_times(stage_vec);
+              stage_vec.push_back((double)measureCount*g_sampleInterval*1000.0);
+              stage_vec.push_back((double)blockCount);
+              emit(stage_times(stage_vec));
+              std::fill(stage_ns, stage_ns + ST_STAGES, 0);
+              blockCount = 0;
+
+              measureCount = 0;
+              for(int slot = 0; slot < data_slots(); slot++)
+                measurement[slot].results(&measure_vec[slot*2*M_VALUES], &measure_vec[slot*2*M_VALUES + M_VALUES]);
+              emit(measurements(measure_vec));
+
+              if(averager.updated())
+                {
+                  averager.results(average_mean, average_sigma);
+                  emit(averaged(average_mean, average_sigma));
+                }
+            }
+
+          // the samples that follow on the same connection belong to this block;
+          // while the GUI is behind by more than the governor allows only
+          // every QUEUE_THIN-th sample is sent, and the GUI counts each of
+          // them that many times so sample indices stay the stream's
+          emit(block_stamp((qint64)block, (qint64)g_tracer.now()));
+          int stride = g_queuedSamples > g_queueLimit ? QUEUE_THIN : 1;
+          for(int i = 0; i < g_sampleCount; i += stride)
+            {
+              // the last sample of a block stands for what is left of it
+              int repeat = std::min(stride, g_sampleCount - i);
+              if(repeat != announced)
+                {
+                  announced = repeat;
+                  emit(sample_stride(announced));
+                }
               for(int16_t u = 0; u < _UNITCOUNT_; u++)
                 {
                   for(int ch = 0; ch < buffer_info.unit[u].channelCount; ch++)
                     {
-                      if(buffer_info.unit[u].channelSettings[ch].enabled)
+                      if(buffer_info.unit[u].channelSettings[ch].enabled &&
+                         buffer_info.unit[u].channelSettings[ch].mode != OFF)
                         {
-                          double  value = adc_to_voltage(buffer_info.unit[u].channelSettings[ch].range,
-                                                         buffer_info.unit[u].maxSampleValue,
-                                                         buffer_info.unit[u].channelSettings[ch].app_buffer[i]);
+                          double  value = buffer_info.unit[u].channelSettings[ch].voltage_buffer[i];
                           data_vec[(int)buffer_info.unit[u].channelSettings[ch].mode-1] = value;
                           //fprintf(file_ptr, "%f\t", value);
                         }
                     }
                 }
+              for(int o = 0; o < LOCKIN_SIGNALS*LI_OUTPUTS; o++)
+                data_vec[LOCKIN_SLOT+o] = lockin_out[o][i];
+              for(int o = 0; o < PLUGIN_OUTPUTS; o++)
+                data_vec[PLUGIN_SLOT+o] = slot_block[PLUGIN_SLOT+o] ? slot_block[PLUGIN_SLOT+o][i] : 0.0;
+              for(int slot = INPUT_SLOT; slot < data_slots(); slot++)
+                if(slot_block[slot])
+                  data_vec[slot] = slot_block[slot][i];
+              g_queuedSamples++;
               emit(data(data_vec));
               //fprintf(file_ptr,"\n");
             }
+          lap(ST_EMIT);
         }
     }
   while (g_streamIsRunning);
 
+  plugins.stop();
+  close_recording();
+
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
-    ps4000aStop(buffer_info.unit[u].handle);
+    {
+      int16_t handle = buffer_info.unit[u].handle;
+      buffer_info.unit[u].queue->run([handle]{ ps4000aStop(handle); });
+    }
   emit(unit_stopped_signal());
 
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
     {
       for (int ch = 0; ch < buffer_info.unit[u].channelCount; ch++)
         {
-          if(buffer_info.unit[u].channelSettings[ch].bufferEnabled)
+          if(buffer_info.unit[u].channelSettings[ch].driver_buffer)
             {
               free(buffer_info.unit[u].channelSettings[ch].driver_buffer);
               free(buffer_info.unit[u].channelSettings[ch].app_buffer);
+              free(buffer_info.unit[u].channelSettings[ch].voltage_buffer);
               buffer_info.unit[u].channelSettings[ch].bufferEnabled = false;
             }
+          delete buffer_info.unit[u].channelSettings[ch].filterStage;
+          delete buffer_info.unit[u].channelSettings[ch].resampler;
         }
     }
   //fclose(file_ptr);
+  delete[] buffer_info.unit;
+}
+
+
+// Raw counts of every enabled channel go to the recorder. A file covers
+// one channel set with fixed scales and roles; enabling or disabling a
+// channel, or changing its range or mode, starts a new one. Units slower
+// than the stream are left out, a file has a single sample rate.
+void Worker::record_block(BUFFER_INFO * buffer_info)
+{
+  std::vector<int> enabled, settings;
+  if(g_record)
+    for(int16_t u = 0; u < _UNITCOUNT_; u++)
+      for(int ch = 0; ch < buffer_info->unit[u].channelCount; ch++)
+        if(buffer_info->unit[u].channelSettings[ch].enabled &&
+           buffer_info->unit[u].sampleInterval <= g_sampleInterval)
+          {
+            enabled.push_back(u*PS4000A_MAX_CHANNELS + ch);
+            settings.push_back(buffer_info->unit[u].channelSettings[ch].range);
+            settings.push_back(buffer_info->unit[u].channelSettings[ch].mode);
+          }
+
+  if(recorder.is_open() && (enabled != recordChannels || settings != recordSettings))
+    close_recording();
+  if(enabled.empty())
+    return;
+
+  if(!recorder.is_open())
+    {
+      std::vector<REC_CHANNEL> channels(enabled.size());
+      for(size_t i = 0; i < enabled.size(); i++)
+        {
+          UNIT *             unit     = &buffer_info->unit[enabled[i]/PS4000A_MAX_CHANNELS];
+          CHANNEL_SETTINGS * settings = &unit->channelSettings[enabled[i]%PS4000A_MAX_CHANNELS];
+          memset(&channels[i], 0, sizeof(REC_CHANNEL));
+          snprintf(channels[i].name, sizeof(channels[i].name), "U%d.%c", enabled[i]/PS4000A_MAX_CHANNELS,
+                   'A' + enabled[i]%PS4000A_MAX_CHANNELS);
+          channels[i].slot  = settings->mode - 1;
+          channels[i].scale = adc_to_voltage(settings->range, unit->maxSampleValue, 1);
+        }
+      std::string path = "recordings/" + std::to_string(QDateTime::currentMSecsSinceEpoch()) + ".lpr";
+      if(!recorder.open(path, 1.0e6/(double)g_sampleInterval, channels))
+        {
+          g_record = false;
+          return;
+        }
+      printf("Recording %zu channels to %s\n", channels.size(), path.c_str());
+      recordChannels = enabled;
+      recordSettings = settings;
+    }
+
+  recordBlock.clear();
+  for(int c: recordChannels)
+    recordBlock.push_back(&buffer_info->unit[c/PS4000A_MAX_CHANNELS].channelSettings[c%PS4000A_MAX_CHANNELS].app_buffer[g_startIndex]);
+  recorder.append(recordBlock.data(), g_sampleCount);
+}
+
+
+void Worker::close_recording()
+{
+  if(!recorder.is_open())
+    return;
+  recorder.close();
+  printf("Recording closed: %llu samples x %zu channels, ratio %.2f, encoder %.0f MB/s, %llu samples dropped\n",
+         (unsigned long long)recorder.samples(), recordChannels.size(), recorder.ratio(), recorder.throughput(),
+         (unsigned long long)recorder.dropped());
+  recordChannels.clear();
+  recordSettings.clear();
+}
+
+
+// Feeds a recording back through the data signal at its original rate, with
+// each channel in its input slot and the role it was recorded from. Stops
+// at the end or when the stream button is pressed.
+void Worker::replay_data(QString path)
+{
+  Playback playback;
+  if(!playback.open(path.toStdString()))
+    {
+      g_streamIsRunning = false;
+      emit(unit_stopped_signal());
+      return;
+    }
+
+  double   rate  = playback.sample_rate();
+  int      chunk = std::max(1, (int)(rate/50.0));
+  int      count = playback.channels();
+  g_sampleInterval = (uint32_t)std::max(1.0, 1.0e6/rate);
+  printf("Replaying %s: %llu samples x %d channels at %.0f S/s\n", path.toLocal8Bit().constData(),
+         (unsigned long long)playback.samples(), count, rate);
+
+  std::vector<std::vector<int16_t>> counts(count, std::vector<int16_t>(chunk));
+  std::vector<int16_t *>            out(count);
+  for(int c = 0; c < count; c++)
+    out[c] = counts[c].data();
+
+  std::vector<int> inputs(count);
+  for(int c = 0; c < count; c++)
+    inputs[c] = g_channels.find(playback.channel(c).name);
+
+  std::vector<double> steps(data_slots(), 0.0);
+  for(int c = 0; c < count; c++)
+    {
+      if(playback.channel(c).slot >= 0 && playback.channel(c).slot < LOCKIN_SLOT)
+        steps[playback.channel(c).slot] = playback.channel(c).scale;
+      if(inputs[c] >= 0)
+        steps[inputs[c]] = playback.channel(c).scale;
+    }
+  emit(history_scales(steps));
+  emit(sample_stride(1));
+
+  std::vector<double> data_vec(data_slots(), 0.0);
+  uint64_t            position = 0;
+  auto                start    = std::chrono::steady_clock::now();
+  while(g_streamIsRunning && position < playback.samples())
+    {
+      int n = playback.read(position, chunk, out.data());
+      if(n <= 0)
+        break;
+
+      for(int i = 0; i < n; i++)
+        {
+          for(int c = 0; c < count; c++)
+            {
+              const REC_CHANNEL & channel = playback.channel(c);
+              double              value   = counts[c][i]*channel.scale;
+              if(channel.slot >= 0 && channel.slot < LOCKIN_SLOT)
+                data_vec[channel.slot] = value;
+              if(inputs[c] >= 0)
+                data_vec[inputs[c]] = value;
+            }
+          g_queuedSamples++;
+          emit(data(data_vec));
+        }
+      position += n;
+      std::this_thread::sleep_until(start + std::chrono::duration<double>(position/rate));
+    }
+
+  g_streamIsRunning = false;
+  emit(unit_stopped_signal());
+}
+
+
+// mV per ADC count of every slot fed straight from an input, in the
+// same order the samples are sent. Filtered and resampled inputs are no
+// longer whole counts and are left at 0 like the derived slots.
+std::vector<double> Worker::slot_steps(BUFFER_INFO * buffer_info)
+{
+  std::vector<double> steps(data_slots(), 0.0);
+  for(int16_t u = 0; u < _UNITCOUNT_; u++)
+    for(int ch = 0; ch < buffer_info->unit[u].channelCount; ch++)
+      {
+        CHANNEL_SETTINGS & c = buffer_info->unit[u].channelSettings[ch];
+        if(!c.enabled)
+          continue;
+        double step = c.filterStage || c.resampler ? 0.0 : adc_to_voltage(c.range, buffer_info->unit[u].maxSampleValue, 1);
+        if(c.mode != OFF)
+          steps[(int)c.mode-1] = step;
+        int slot = g_channels.input(u, ch);
+        if(slot >= 0)
+          steps[slot] = step;
+      }
+  return steps;
+}
+
+
+// Buffers are allocated the first time a channel is enabled and kept until
+// the stream ends, so toggling a channel never reallocates. The driver
+// buffers of a slower unit hold the same time span at its own rate, only
+// the voltages it is resampled into are as long as a block of the stream.
+void Worker::prepare_channel(UNIT * unit, int ch, uint32_t sampleCount)
+{
+  CHANNEL_SETTINGS * settings = &unit->channelSettings[ch];
+  uint32_t           count    = unit_samples(unit, sampleCount);
+
+  if(!settings->driver_buffer)
+    {
+      settings->driver_buffer  = (int16_t*) calloc(count, sizeof(int16_t));
+      settings->app_buffer     = (int16_t*) calloc(count, sizeof(int16_t));
+      settings->voltage_buffer = (double*) calloc(std::max(count, sampleCount), sizeof(double));
+    }
+
+  int16_t   handle = unit->handle;
+  int16_t * buffer = settings->driver_buffer;
+  unit->queue->run([handle, ch, buffer, count]()
+                   {
+                     ps4000aSetDataBuffer(handle,
+                                          (PS4000A_CHANNEL)ch,
+                                          buffer,
+                                          count,
+                                          0,
+                                          PS4000A_RATIO_MODE_NONE);
+                   });
+  settings->bufferEnabled = true;
+
+  delete settings->filterStage;
+  settings->filterStage = nullptr;
+  if(settings->filter.type != FILTER_OFF)
+    settings->filterStage = new Filter(settings->filter, 1.0e6/(double)unit->sampleInterval);
+
+  if(!settings->resampler && unit->sampleInterval > g_sampleInterval)
+    settings->resampler = new Resampler(1.0e6/(double)unit->sampleInterval, 1.0e6/(double)g_sampleInterval);
+}
+
+
+// driver buffer length of a unit for stream blocks of sampleCount samples
+uint32_t Worker::unit_samples(UNIT * unit, uint32_t sampleCount)
+{
+  if(unit->sampleInterval <= g_sampleInterval)
+    return sampleCount;
+  return std::max<uint32_t>(64, (uint32_t)((uint64_t)sampleCount*g_sampleInterval/unit->sampleInterval));
+}
+
+
+void Worker::start_unit(UNIT * unit, uint32_t sampleCount)
+{
+  int16_t  handle   = unit->handle;
+  uint32_t count    = unit_samples(unit, sampleCount);
+  uint32_t interval = std::max(unit->sampleInterval, g_sampleInterval);
+
+  unit->queue->run([handle, count, interval]()
+                   {
+                     uint32_t sampleInterval = interval;
+
+                     ps4000aRunStreaming(handle,
+                                         &sampleInterval,
+                                         PS4000A_US,
+                                         0,//preTrigger
+                                         0,//postTrigger
+                                         0,//autostop
+                                         1,//downsampleRatio
+                                         PS4000A_RATIO_MODE_NONE,
+                                         count);
+                   });
+}
+
+
+// Called from the GUI thread; the stream picks the new settings up between
+// two blocks.
+void Worker::request_reconfig(UNIT * unit)
+{
+  std::lock_guard<std::mutex> lock(reconfigMutex);
+  pendingReconfig.assign(unit, unit + _UNITCOUNT_);
+  reconfigPending = true;
+}
+
+
+// Applies only what differs from the running configuration. Mode and
+// filter changes are swapped in between blocks without touching the
+// device; range, offset, coupling and enable changes stop and restart the
+// units. All of them restart together, even if only one changed, because
+// the units of the stream share one sample index. ps4000aStop drops what
+// is still in the driver, which makes the gap reported by reconfigured;
+// every block after it is converted with the new scale.
+void Worker::apply_reconfig(BUFFER_INFO * buffer_info, uint32_t sampleCount)
+{
+  std::vector<UNIT> target;
+  {
+    std::lock_guard<std::mutex> lock(reconfigMutex);
+    target.swap(pendingReconfig);
+    reconfigPending = false;
+  }
+
+  bool restart = false;
+  for(int16_t u = 0; u < (int16_t)target.size() && u < _UNITCOUNT_; u++)
+    for(int ch = 0; ch < buffer_info->unit[u].channelCount; ch++)
+      {
+        CHANNEL_SETTINGS & now  = buffer_info->unit[u].channelSettings[ch];
+        CHANNEL_SETTINGS & next = target[u].channelSettings[ch];
+        restart |= now.enabled != next.enabled || now.range != next.range ||
+                   now.offset != next.offset || now.coupling != next.coupling;
+      }
+
+  if(restart)
+    for(int16_t u = 0; u < _UNITCOUNT_; u++)
+      {
+        int16_t handle = buffer_info->unit[u].handle;
+        restartTime[u] = std::chrono::steady_clock::now();
+        buffer_info->unit[u].queue->run([handle]{ ps4000aStop(handle); });
+      }
+
+  for(int16_t u = 0; u < (int16_t)target.size() && u < _UNITCOUNT_; u++)
+    {
+      UNIT *  unit   = &buffer_info->unit[u];
+      int16_t handle = unit->handle;
+
+      for(int ch = 0; ch < unit->channelCount; ch++)
+        {
+          CHANNEL_SETTINGS & now  = unit->channelSettings[ch];
+          CHANNEL_SETTINGS & next = target[u].channelSettings[ch];
+          bool hardware = now.enabled != next.enabled || now.range != next.range ||
+                          now.offset != next.offset || now.coupling != next.coupling;
+          bool filter   = now.filter.type != next.filter.type || now.filter.cutoff != next.filter.cutoff ||
+                          now.filter.order != next.filter.order || now.filter.decimation != next.filter.decimation;
+
+          if(hardware)
+            unit->queue->post(ch, [handle, ch, next]()
+                              {
+                                PICO_STATUS status = ps4000aSetChannel(handle,
+                                                                       (PS4000A_CHANNEL)(PS4000A_CHANNEL_A + ch),
+                                                                       next.enabled,
+                                                                       next.coupling,
+                                                                       next.range,
+                                                                       next.offset);
+                                printf(status?"Reconfigure:ps4000aSetChannel------ 0x%08lx \n":"", (long unsigned int)status);
+                              });
+
+          now.mode     = next.mode;
+          now.range    = next.range;
+          now.offset   = next.offset;
+          now.coupling = next.coupling;
+          now.filter   = next.filter;
+
+          if(next.enabled && !now.enabled)
+            prepare_channel(unit, ch, sampleCount);
+          else if(next.enabled && filter)
+            {
+              delete now.filterStage;
+              now.filterStage = next.filter.type != FILTER_OFF ? new Filter(next.filter, 1.0e6/(double)unit->sampleInterval) : nullptr;
+            }
+          now.enabled       = next.enabled;
+          now.bufferEnabled = next.enabled;
+          if(restart && now.resampler)
+            now.resampler->reset();
+        }
+    }
+
+  if(restart)
+    for(int16_t u = 0; u < _UNITCOUNT_; u++)
+      {
+        start_unit(&buffer_info->unit[u], sampleCount);
+        restartPending[u] = true;
+      }
 }
 
 
@@ -142,24 +800,179 @@ void Worker::callback(
 {
   BUFFER_INFO * buffer_info = (BUFFER_INFO *)pParameter;
 
-  g_sampleCount = noOfSamples;
-  g_startIndex  = startIndex;
+  UNIT * unit = nullptr;
+  for(int16_t u = 0; u < _UNITCOUNT_; u++)
+    if(buffer_info->unit[u].handle == handle)
+      unit = &buffer_info->unit[u];
+  if(!unit)
+    return;
+
+  // only units at the stream rate make a block, slower ones just report
+  // theirs for the resamplers
+  unit->readyCount = noOfSamples;
+  unit->readyStart = startIndex;
+  bool stream      = unit->sampleInterval <= g_sampleInterval;
+  if(stream)
+    {
+      g_sampleCount = noOfSamples;
+      g_startIndex  = startIndex;
+    }
 
   if (noOfSamples)
     {
-      for(int16_t u = 0; u < _UNITCOUNT_; u++)
+      for (int ch = 0; ch < unit->channelCount; ch++)
         {
-          for (int ch = 0; ch < buffer_info->unit[u].channelCount; ch++)
+          if (unit->channelSettings[ch].bufferEnabled)
             {
-              if (buffer_info->unit[u].channelSettings[ch].bufferEnabled)
-                {
-                  memcpy(&buffer_info->unit[u].channelSettings[ch].app_buffer[startIndex],
-                         &buffer_info->unit[u].channelSettings[ch].driver_buffer[startIndex],
-                         noOfSamples * sizeof(int16_t));
-                }
+              memcpy(&unit->channelSettings[ch].app_buffer[startIndex],
+                     &unit->channelSettings[ch].driver_buffer[startIndex],
+                     noOfSamples * sizeof(int16_t));
             }
         }
-      g_ready = true;
+      if(stream)
+        {
+          g_callbackTime = g_tracer.now();
+          g_ready        = true;
+        }
     }
 }
 
+
+
+
+Renderer::Renderer()
+  : footprint(0)
+  , accumulator(new ImageAccumulator((size_t)128 << 20))
+  , colorLayer()
+  , greyLower(-1.0)
+  , greyUpper(1.0)
+  , scanMap(new ScanMap)
+{
+  // the gradient is sampled once into the palette of every layer
+  QCPColorGradient    gradient(QCPColorGradient::gpGrayscale);
+  std::vector<double> ramp(COLORLAYER_LUT);
+  std::vector<QRgb>   lut(COLORLAYER_LUT);
+  for(int i = 0; i < COLORLAYER_LUT; i++)
+    ramp[i] = (double)i/(COLORLAYER_LUT - 1);
+  gradient.colorize(ramp.data(), QCPRange(0.0, 1.0), lut.data(), COLORLAYER_LUT);
+  palette.assign(lut.begin(), lut.end());
+  for(auto & p: pendingViews)
+    p = 0;
+  account();
+}
+
+
+// x, y, z triples, the newest of them from block. The whole batch goes
+// through the scan calibration before it is binned.
+void Renderer::bin_points(std::vector<double> points, qint64 block)
+{
+  g_tracer.name_thread("Render");
+  int64_t start = g_tracer.now();
+  scanMap->map(points.data(), (int)(points.size()/3), mappedX, mappedY, mappedZ);
+  accumulator->bin_block(mappedX.data(), mappedY.data(), mappedZ.data(), (int)mappedZ.size());
+  g_tracer.stage(TR_BINNING, block, start, g_tracer.now());
+}
+
+
+// the accumulator covers the calibrated scan
+void Renderer::set_calibration(SCAN_CALIBRATION calibration)
+{
+  scanMap->set_calibration(calibration);
+  const SCAN_CALIBRATION & c = scanMap->calibration();
+  accumulator->set_range(c.lo[0], c.hi[0], c.lo[1], c.hi[1]);
+}
+
+
+void Renderer::set_budget(int megabytes)
+{
+  accumulator->set_budget((size_t)megabytes << 20);
+  account();
+}
+
+
+// read by the memory governor on the GUI thread
+void Renderer::account()
+{
+  size_t bytes = accumulator->bytes();
+  for(ColorLayer * l: colorLayer)
+    bytes += l ? l->bytes() : 0;
+  footprint = bytes;
+}
+
+
+// The layer of a view at the given size. Every view keeps its own, so
+// consecutive images of one view differ only where the data changed and
+// only those tiles are mapped again.
+ColorLayer * Renderer::layer(int view, int size)
+{
+  ColorLayer *& l = colorLayer[view];
+  if(!l)
+    {
+      l = new ColorLayer(size, size);
+      l->set_gradient(palette);
+      l->set_range(greyLower, greyUpper);
+      l->fill((greyLower + greyUpper)/2.0);
+      account();
+    }
+  else if(l->width() != size || l->height() != size)
+    {
+      l->resize(size, size);
+      account();
+    }
+  return l;
+}
+
+
+void Renderer::set_grey(double lower, double upper)
+{
+  greyLower = lower;
+  greyUpper = upper;
+  for(ColorLayer * l: colorLayer)
+    if(l)
+      {
+        l->set_range(lower, upper);
+        l->fill((lower + upper)/2.0);
+      }
+  accumulator->clear((lower + upper)/2.0);
+}
+
+
+// Only the newest of several queued requests of a view is rendered. The
+// main XY plot and the XY views share the accumulator.
+void Renderer::render_view(double xl, double xu, double yl, double yu, int size, int view)
+{
+  if(--pendingViews[view] > 0)
+    return;
+
+  std::vector<double> image((size_t)size*size);
+  accumulator->render(xl, xu, yl, yu, size, size, image.data());
+  layer(view, size)->set_all(image.data());
+  finish(xl, xu, yl, yu, false, view);
+}
+
+
+// frames are shown in the main XY plot, view 0
+void Renderer::render_frame(std::vector<double> frame, int size, double xl, double xu, double yl, double yu)
+{
+  layer(0, size)->set_all(frame.data());
+  finish(xl, xu, yl, yu, true, 0);
+}
+
+
+// The layer's buffer is reused for the next image, so the QImage gets its
+// own copy before it crosses to the GUI thread.
+void Renderer::finish(double x0, double x1, double y0, double y1, bool frame, int view)
+{
+  ColorLayer * l = colorLayer[view];
+  l->update();
+  XY_IMAGE xy;
+  xy.image = QImage((const uchar*)l->pixels(), l->width(), l->height(),
+                    QImage::Format_ARGB32_Premultiplied).copy();
+  xy.x0    = x0;
+  xy.x1    = x1;
+  xy.y0    = y0;
+  xy.y1    = y1;
+  xy.frame = frame;
+  xy.view  = view;
+  emit rendered(xy);
+}
@@ -0,0 +1,47 @@
+#ifndef PLUGIN_API_H
+#define PLUGIN_API_H
+
+/*
+ * C ABI for block processing stages loaded from shared libraries in the
+ * plug-in directory (./plugins, or $LIVE_PLOTTER_PLUGINS). A library
+ * exports lp_stage_entry(), returning a static description of its stage.
+ *
+ * Every block the stage gets one pointer per data slot, NULL for slots
+ * without data, each holding n samples in mV; structure of arrays, read
+ * only. It writes n samples into each of its output buffers, which appear
+ * as data slots P0... in load order and are visible to later stages.
+ * process() runs on the acquisition thread and must not block.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define LP_STAGE_ABI    1
+#define LP_STAGE_ENTRY  "lp_stage_entry"
+
+
+typedef struct
+{
+  uint32_t        abi;            /* LP_STAGE_ABI */
+  const char *    name;
+  uint32_t        outputs;
+
+  /* once per stream; the returned state is handed to the calls below */
+  void *        (*init)(double sample_rate, uint32_t slots, const char * const * slot_names);
+  void          (*process)(void * state, const double * const * in, uint32_t n, double * const * out);
+  void          (*teardown)(void * state);
+}LP_STAGE_INFO;
+
+
+typedef const LP_STAGE_INFO * (*LP_STAGE_ENTRY_FN)(void);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PLUGIN_API_H */
@@ -0,0 +1,145 @@
+#include "plugins.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <dlfcn.h>
+
+
+PluginHost::PluginHost()
+{
+}
+
+
+PluginHost::~PluginHost()
+{
+  stop();
+  for(auto & p: list)
+    dlclose(p.library);
+}
+
+
+int PluginHost::stages()
+{
+  return (int)list.size();
+}
+
+
+const PLUGIN_STAGE & PluginHost::stage(int i)
+{
+  return list[i];
+}
+
+
+// Loads every *.so in dir, sorted by name, as long as their outputs fit
+// into the count slots starting at slot. Returns the slots used.
+int PluginHost::load_directory(const std::string & dir, int slot, int count)
+{
+  std::vector<std::string> files;
+  if(DIR * d = opendir(dir.c_str()))
+    {
+      while(dirent * e = readdir(d))
+        {
+          std::string name = e->d_name;
+          if(name.size() > 3 && name.compare(name.size() - 3, 3, ".so") == 0)
+            files.push_back(dir + "/" + name);
+        }
+      closedir(d);
+    }
+  std::sort(files.begin(), files.end());
+
+  int used = 0;
+  for(auto & path: files)
+    {
+      void * library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+      if(!library)
+        {
+          printf("Plug-in %s: %s\n", path.c_str(), dlerror());
+          continue;
+        }
+
+      LP_STAGE_ENTRY_FN entry = (LP_STAGE_ENTRY_FN)dlsym(library, LP_STAGE_ENTRY);
+      const LP_STAGE_INFO * info = entry ? entry() : nullptr;
+      if(!info || info->abi != LP_STAGE_ABI || !info->init || !info->process || !info->teardown)
+        {
+          printf("Plug-in %s: no compatible %s\n", path.c_str(), LP_STAGE_ENTRY);
+          dlclose(library);
+          continue;
+        }
+      if(used + (int)info->outputs > count)
+        {
+          printf("Plug-in %s: no free output slots\n", path.c_str());
+          dlclose(library);
+          continue;
+        }
+
+      list.push_back({path, library, info, slot + used, nullptr, 0});
+      used += info->outputs;
+      printf("Plug-in %s loaded from %s, %u output(s)\n", info->name, path.c_str(), info->outputs);
+    }
+  return used;
+}
+
+
+void PluginHost::start(double sampleRate, const std::vector<std::string> & names, int blockSize)
+{
+  std::vector<const char *> slotNames;
+  for(auto & n: names)
+    slotNames.push_back(n.c_str());
+
+  int total = 0;
+  for(auto & p: list)
+    {
+      p.state       = p.info->init(sampleRate, (uint32_t)slotNames.size(), slotNames.data());
+      p.nanoseconds = 0;
+      total        += p.info->outputs;
+    }
+
+  buffers = std::vector<std::vector<double>>(total, std::vector<double>(blockSize));
+  outputs.clear();
+  for(auto & b: buffers)
+    outputs.push_back(b.data());
+}
+
+
+// slot_block holds one pointer per data slot; the outputs of every stage
+// are linked in before the next one runs.
+void PluginHost::process(const double ** slot_block, int slots, int n)
+{
+  int o = 0;
+  for(auto & p: list)
+    {
+      auto start = std::chrono::steady_clock::now();
+      p.info->process(p.state, slot_block, n, &outputs[o]);
+      p.nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+      for(uint32_t k = 0; k < p.info->outputs; k++)
+        if(p.slot + (int)k < slots)
+          slot_block[p.slot + k] = outputs[o + k];
+      o += p.info->outputs;
+    }
+}
+
+
+void PluginHost::stop()
+{
+  for(auto & p: list)
+    if(p.state)
+      {
+        p.info->teardown(p.state);
+        p.state = nullptr;
+      }
+}
+
+
+// nanoseconds per stage since the last call
+void PluginHost::take_times(std::vector<double> & out)
+{
+  for(auto & p: list)
+    {
+      out.push_back((double)p.nanoseconds);
+      p.nanoseconds = 0;
+    }
+}
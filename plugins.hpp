@@ -0,0 +1,47 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "plugin_api.h"
+
+
+
+typedef struct
+{
+  std::string               path;
+  void *                    library;
+  const LP_STAGE_INFO *     info;
+  int                       slot;         // first data slot of its outputs
+  void *                    state;
+  int64_t                   nanoseconds;  // spent in process() since the last take_times()
+}PLUGIN_STAGE;
+
+
+
+// Loads plug-in stages and runs them in load order on the acquisition
+// thread, writing their outputs into the data slots they were given.
+class PluginHost
+{
+public:
+                            PluginHost();
+                            ~PluginHost();
+
+  int                       load_directory(const std::string &, int, int);
+  void                      start(double, const std::vector<std::string> &, int);
+  void                      process(const double **, int, int);
+  void                      stop();
+  void                      take_times(std::vector<double> &);
+
+  int                       stages();
+  const PLUGIN_STAGE &      stage(int);
+
+private:
+  std::vector<PLUGIN_STAGE> list;
+  std::vector<std::vector<double>>  buffers;
+  std::vector<double *>     outputs;
+};
+
+
+#endif //PLUGINS_H
@@ -0,0 +1,66 @@
+/*
+ * Example plug-in stage: RMS over a sliding 10 ms window of the Z0 slot.
+ *
+ *   gcc -O2 -shared -fPIC -I.. moving_rms.c -o moving_rms.so -lm
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "plugin_api.h"
+
+
+typedef struct
+{
+  int         source;
+  int         length;
+  int         position;
+  double      sum;
+  double *    squares;
+}STATE;
+
+
+static void * init(double sample_rate, uint32_t slots, const char * const * slot_names)
+{
+  STATE * s = calloc(1, sizeof(STATE));
+  s->source = -1;
+  for(uint32_t i = 0; i < slots; i++)
+    if(strcmp(slot_names[i], "Z0") == 0)
+      s->source = i;
+  s->length  = sample_rate*0.01 > 1.0 ? (int)(sample_rate*0.01) : 1;
+  s->squares = calloc(s->length, sizeof(double));
+  return s;
+}
+
+
+static void process(void * state, const double * const * in, uint32_t n, double * const * out)
+{
+  STATE *        s = state;
+  const double * x = s->source >= 0 ? in[s->source] : NULL;
+
+  for(uint32_t i = 0; i < n; i++)
+    {
+      double q = x ? x[i]*x[i] : 0.0;
+      s->sum += q - s->squares[s->position];
+      s->squares[s->position] = q;
+      s->position = (s->position + 1) % s->length;
+      out[0][i] = sqrt(fmax(s->sum, 0.0)/s->length);
+    }
+}
+
+
+static void teardown(void * state)
+{
+  STATE * s = state;
+  free(s->squares);
+  free(s);
+}
+
+
+static const LP_STAGE_INFO info = {LP_STAGE_ABI, "Moving RMS", 1, init, process, teardown};
+
+
+const LP_STAGE_INFO * lp_stage_entry(void)
+{
+  return &info;
+}
@@ -0,0 +1,510 @@
+#include "recorder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "simd.hpp"
+
+
+static const char     REC_MAGIC[8]    = {'L', 'P', 'R', 'E', 'C', 0, 0, 1};
+static const char     REC_END[8]      = {'L', 'P', 'R', 'E', 'N', 'D', 0, 1};
+static const uint32_t REC_BLOCK_MAGIC = 0x4b4c4250;
+
+
+void rec_encode(const int16_t * x, int n, std::vector<uint8_t> & out)
+{
+  // the predictor with the smallest residuals over this block
+  uint64_t cost[3] = {0, 0, 0};
+  for(int i = 0; i < n; i++)
+    {
+      cost[0] += std::abs((int32_t)x[i]);
+      if(i >= 1)
+        cost[1] += std::abs(x[i] - x[i-1]);
+      if(i >= 2)
+        cost[2] += std::abs(x[i] - 2*x[i-1] + x[i-2]);
+    }
+  int order = cost[1] < cost[0] ? 1 : 0;
+  if(cost[2] < cost[order])
+    order = 2;
+
+  thread_local std::vector<uint32_t> residual;
+  int groups = (n + REC_GROUP - 1)/REC_GROUP;
+  residual.assign((size_t)groups*REC_GROUP, 0);
+  simd_residual_zigzag(x, n, order, residual.data());
+
+  size_t widths = out.size() + 1;
+  out.push_back((uint8_t)order);
+  out.resize(widths + groups);
+  for(int g = 0; g < groups; g++)
+    {
+      uint32_t any = 0;
+      for(int i = 0; i < REC_GROUP; i++)
+        any |= residual[g*REC_GROUP + i];
+      out[widths + g] = any ? 32 - __builtin_clz(any) : 0;
+    }
+
+  // a group of 32 values at w bits is exactly 4*w bytes
+  for(int g = 0; g < groups; g++)
+    {
+      int w = out[widths + g];
+      if(!w)
+        continue;
+      uint64_t acc  = 0;
+      int      bits = 0;
+      for(int i = 0; i < REC_GROUP; i++)
+        {
+          acc  |= (uint64_t)residual[g*REC_GROUP + i] << bits;
+          bits += w;
+          while(bits >= 8)
+            {
+              out.push_back((uint8_t)acc);
+              acc  >>= 8;
+              bits  -= 8;
+            }
+        }
+    }
+}
+
+
+bool rec_decode(const uint8_t * in, size_t bytes, int n, int16_t * x)
+{
+  int groups = (n + REC_GROUP - 1)/REC_GROUP;
+  if(bytes < (size_t)groups + 1 || in[0] > 2)
+    return false;
+
+  int             order  = in[0];
+  const uint8_t * widths = in + 1;
+  const uint8_t * p      = widths + groups;
+  const uint8_t * end    = in + bytes;
+
+  int32_t prev1 = 0, prev2 = 0;
+  for(int g = 0; g < groups; g++)
+    {
+      int w = widths[g];
+      if(w > 32 || p + 4*w > end)
+        return false;
+      const uint8_t * q = p;
+      p += 4*w;
+
+      uint64_t acc  = 0;
+      int      bits = 0;
+      uint32_t mask = w == 32 ? 0xffffffffu : (1u << w) - 1;
+      for(int i = 0; i < REC_GROUP && g*REC_GROUP + i < n; i++)
+        {
+          while(bits < w)
+            {
+              acc  |= (uint64_t)*q++ << bits;
+              bits += 8;
+            }
+          uint32_t z = (uint32_t)acc & mask;
+          acc  >>= w;
+          bits  -= w;
+
+          int     k = g*REC_GROUP + i;
+          int32_t r = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+          int32_t v = order == 0 || k == 0 ? r
+                    : order == 1 || k == 1 ? prev1 + r
+                    : 2*prev1 - prev2 + r;
+          x[k]  = (int16_t)v;
+          prev2 = prev1;
+          prev1 = v;
+        }
+    }
+  return true;
+}
+
+
+
+Recorder::Recorder()
+  : file(nullptr)
+  , channels(0)
+  , fill(0)
+  , appended(0)
+  , lost(0)
+  , closing(false)
+  , rawBytes(0)
+  , fileBytes(0)
+  , encodeSeconds(0.0)
+{
+}
+
+
+Recorder::~Recorder()
+{
+  close();
+}
+
+
+bool Recorder::open(const std::string & path, double sampleRate, const std::vector<REC_CHANNEL> & chans)
+{
+  close();
+  if(chans.empty() || chans.size() > REC_CHANNELS)
+    return false;
+
+  file = fopen(path.c_str(), "wb");
+  if(!file)
+    {
+      perror(("Recorder: " + path).c_str());
+      return false;
+    }
+
+  REC_HEADER header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, REC_MAGIC, sizeof(REC_MAGIC));
+  header.version      = 1;
+  header.channels     = chans.size();
+  header.blockSamples = REC_BLOCK;
+  header.sampleRate   = sampleRate;
+  std::copy(chans.begin(), chans.end(), header.channel);
+  fwrite(&header, sizeof(header), 1, file);
+
+  channels      = chans.size();
+  block         = std::vector<std::vector<int16_t>>(channels, std::vector<int16_t>(REC_BLOCK));
+  fill          = 0;
+  appended      = 0;
+  lost          = 0;
+  closing       = false;
+  index.clear();
+  spare.clear();
+  rawBytes      = 0;
+  fileBytes     = sizeof(header);
+  encodeSeconds = 0.0;
+  writer        = std::thread(&Recorder::run, this);
+  return true;
+}
+
+
+bool Recorder::is_open()
+{
+  return file != nullptr;
+}
+
+
+void Recorder::append(const int16_t * const * data, int count)
+{
+  int done = 0;
+  while(done < count)
+    {
+      int take = std::min(count - done, REC_BLOCK - fill);
+      for(int c = 0; c < channels; c++)
+        memcpy(&block[c][fill], data[c] + done, take*sizeof(int16_t));
+      fill     += take;
+      done     += take;
+      appended += take;
+      if(fill == REC_BLOCK)
+        push(false);
+    }
+}
+
+
+// Hands the current block to the writer and takes a spare one in its place.
+void Recorder::push(bool force)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if(queue.size() >= REC_QUEUE && !force)
+    lost += fill;
+  else
+    {
+      REC_PENDING pending;
+      pending.first = appended - fill;
+      pending.count = fill;
+      pending.data  = std::move(block);
+      queue.push_back(std::move(pending));
+      if(spare.empty())
+        block = std::vector<std::vector<int16_t>>(channels, std::vector<int16_t>(REC_BLOCK));
+      else
+        {
+          block = std::move(spare.back());
+          spare.pop_back();
+        }
+      wake.notify_one();
+    }
+  fill = 0;
+}
+
+
+void Recorder::run()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true)
+    {
+      wake.wait(lock, [this]{ return closing || !queue.empty(); });
+      if(queue.empty())
+        break;
+
+      REC_PENDING pending = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      write_block(pending);
+      lock.lock();
+      spare.push_back(std::move(pending.data));
+    }
+}
+
+
+// Channels are encoded in parallel, then written in order.
+void Recorder::write_block(REC_PENDING & pending)
+{
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::vector<uint8_t>> coded(channels);
+  std::vector<std::thread>          encoders;
+  for(int c = 1; c < channels; c++)
+    encoders.emplace_back([&, c]{ rec_encode(pending.data[c].data(), pending.count, coded[c]); });
+  rec_encode(pending.data[0].data(), pending.count, coded[0]);
+  for(auto & t: encoders)
+    t.join();
+
+  encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  REC_BLOCK_HEADER header = {REC_BLOCK_MAGIC, (uint32_t)pending.count, pending.first};
+  std::vector<uint32_t> sizes(channels);
+  for(int c = 0; c < channels; c++)
+    sizes[c] = coded[c].size();
+
+  index.push_back({pending.first, fileBytes});
+  fwrite(&header, sizeof(header), 1, file);
+  fwrite(sizes.data(), sizeof(uint32_t), channels, file);
+  fileBytes += sizeof(header) + sizeof(uint32_t)*channels;
+  for(auto & c: coded)
+    {
+      fwrite(c.data(), 1, c.size(), file);
+      fileBytes += c.size();
+    }
+  rawBytes += (uint64_t)pending.count*channels*sizeof(int16_t);
+}
+
+
+// Flushes the partial block, waits for the writer and appends the index.
+void Recorder::close()
+{
+  if(!file)
+    return;
+
+  if(fill)
+    push(true);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    closing = true;
+  }
+  wake.notify_one();
+  writer.join();
+
+  REC_TRAILER trailer;
+  trailer.indexOffset = fileBytes;
+  trailer.blocks      = index.size();
+  memcpy(trailer.magic, REC_END, sizeof(REC_END));
+  fwrite(index.data(), sizeof(REC_INDEX), index.size(), file);
+  fwrite(&trailer, sizeof(trailer), 1, file);
+  fileBytes += sizeof(REC_INDEX)*index.size() + sizeof(trailer);
+  fclose(file);
+  file = nullptr;
+}
+
+
+uint64_t Recorder::samples()
+{
+  return appended;
+}
+
+
+uint64_t Recorder::dropped()
+{
+  return lost;
+}
+
+
+// raw int16 bytes per file byte
+double Recorder::ratio()
+{
+  return fileBytes ? (double)rawBytes/fileBytes : 0.0;
+}
+
+
+// raw MB/s through the encoder, counting all channels of a block
+double Recorder::throughput()
+{
+  return encodeSeconds > 0.0 ? rawBytes/encodeSeconds/1.0e6 : 0.0;
+}
+
+
+
+Playback::Playback()
+  : file(nullptr)
+  , total(0)
+  , holes(0)
+  , cached((size_t)-1)
+  , cachedCount(0)
+{
+}
+
+
+Playback::~Playback()
+{
+  if(file)
+    fclose(file);
+}
+
+
+bool Playback::open(const std::string & path)
+{
+  if(file)
+    fclose(file);
+  index.clear();
+  total  = 0;
+  holes  = 0;
+  cached = (size_t)-1;
+
+  file = fopen(path.c_str(), "rb");
+  if(!file)
+    {
+      perror(("Playback: " + path).c_str());
+      return false;
+    }
+  if(fread(&header, sizeof(header), 1, file) != 1 ||
+     memcmp(header.magic, REC_MAGIC, sizeof(REC_MAGIC)) ||
+     header.channels < 1 || header.channels > REC_CHANNELS || header.blockSamples != REC_BLOCK)
+    {
+      printf("Playback: %s is not a recording\n", path.c_str());
+      fclose(file);
+      file = nullptr;
+      return false;
+    }
+
+  REC_TRAILER trailer;
+  fseeko(file, -(off_t)sizeof(trailer), SEEK_END);
+  if(fread(&trailer, sizeof(trailer), 1, file) == 1 && !memcmp(trailer.magic, REC_END, sizeof(REC_END)))
+    {
+      index.resize(trailer.blocks);
+      fseeko(file, trailer.indexOffset, SEEK_SET);
+      if(fread(index.data(), sizeof(REC_INDEX), index.size(), file) != index.size())
+        index.clear();
+    }
+  else
+    {
+      // not closed: walk the blocks up to the first incomplete one
+      uint64_t              offset = sizeof(header);
+      REC_BLOCK_HEADER      block;
+      std::vector<uint32_t> sizes(header.channels);
+      while(fseeko(file, offset, SEEK_SET) == 0 &&
+            fread(&block, sizeof(block), 1, file) == 1 && block.magic == REC_BLOCK_MAGIC &&
+            fread(sizes.data(), sizeof(uint32_t), sizes.size(), file) == sizes.size())
+        {
+          uint64_t next = offset + sizeof(block) + sizeof(uint32_t)*sizes.size();
+          for(auto s: sizes)
+            next += s;
+          if(fseeko(file, next - 1, SEEK_SET) || fgetc(file) == EOF)
+            break;
+          index.push_back({block.first, offset});
+          offset = next;
+        }
+      printf("Playback: %s was not closed, recovered %zu blocks\n", path.c_str(), index.size());
+    }
+
+  decoded = std::vector<std::vector<int16_t>>(header.channels, std::vector<int16_t>(REC_BLOCK));
+  if(!index.empty() && load_block(index.size() - 1))
+    total = index.back().first + cachedCount;
+
+  // every block but the last is full, so what lies between two is dropped
+  for(size_t b = 0; b < index.size(); b++)
+    holes += index[b].first - (b ? index[b-1].first + REC_BLOCK : 0);
+  if(holes)
+    printf("Playback: %s misses %llu samples the recorder dropped, they read as 0\n",
+           path.c_str(), (unsigned long long)holes);
+  return true;
+}
+
+
+int Playback::channels()
+{
+  return header.channels;
+}
+
+
+double Playback::sample_rate()
+{
+  return header.sampleRate;
+}
+
+
+uint64_t Playback::samples()
+{
+  return total;
+}
+
+
+uint64_t Playback::dropped()
+{
+  return holes;
+}
+
+
+const REC_CHANNEL & Playback::channel(int c)
+{
+  return header.channel[c];
+}
+
+
+bool Playback::load_block(size_t b)
+{
+  if(b == cached)
+    return true;
+  cached = (size_t)-1;
+
+  REC_BLOCK_HEADER      block;
+  std::vector<uint32_t> sizes(header.channels);
+  if(fseeko(file, index[b].offset, SEEK_SET) ||
+     fread(&block, sizeof(block), 1, file) != 1 || block.magic != REC_BLOCK_MAGIC || block.count > REC_BLOCK ||
+     fread(sizes.data(), sizeof(uint32_t), sizes.size(), file) != sizes.size())
+    return false;
+
+  for(uint32_t c = 0; c < header.channels; c++)
+    {
+      buffer.resize(sizes[c]);
+      if(fread(buffer.data(), 1, sizes[c], file) != sizes[c] ||
+         !rec_decode(buffer.data(), sizes[c], block.count, decoded[c].data()))
+        return false;
+    }
+  cached      = b;
+  cachedCount = block.count;
+  return true;
+}
+
+
+// Decodes count samples of every channel starting at sample first into
+// out[channel], and returns how many there were. Dropped samples are
+// zero-filled; only an unreadable block ends the read early.
+int Playback::read(uint64_t first, int count, int16_t ** out)
+{
+  int done = 0;
+  while(done < count && first + done < total)
+    {
+      uint64_t at   = first + done;
+      size_t   next = std::upper_bound(index.begin(), index.end(), at,
+                                       [](uint64_t s, const REC_INDEX & i){ return s < i.first; }) - index.begin();
+      if(next > 0 && !load_block(next - 1))
+        break;
+      size_t b = next - 1;
+      if(next == 0 || at >= index[b].first + cachedCount)
+        {
+          uint64_t end  = next < index.size() ? index[next].first : total;
+          int      take = (int)std::min<uint64_t>(count - done, end - at);
+          for(uint32_t c = 0; c < header.channels; c++)
+            memset(out[c] + done, 0, take*sizeof(int16_t));
+          done += take;
+          continue;
+        }
+
+      int offset = at - index[b].first;
+      int take   = std::min(count - done, cachedCount - offset);
+      for(uint32_t c = 0; c < header.channels; c++)
+        memcpy(out[c] + done, &decoded[c][offset], take*sizeof(int16_t));
+      done += take;
+    }
+  return done;
+}
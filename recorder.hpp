@@ -0,0 +1,168 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+#define REC_CHANNELS      32
+#define REC_BLOCK         65536
+#define REC_GROUP         32
+#define REC_QUEUE         16
+
+
+
+// One recorded ADC channel: its name, the data slot it fed (-1 if none)
+// and the value of one count.
+typedef struct
+{
+  char                      name[16];
+  int32_t                   slot;
+  double                    scale;
+}REC_CHANNEL;
+
+
+// Start of a recording file. Blocks of REC_BLOCK samples per channel
+// follow, then the block index and a trailer pointing at it.
+typedef struct
+{
+  char                      magic[8];
+  uint32_t                  version;
+  uint32_t                  channels;
+  uint32_t                  blockSamples;
+  uint32_t                  reserved;
+  double                    sampleRate;
+  REC_CHANNEL               channel[REC_CHANNELS];
+}REC_HEADER;
+
+
+// Each block starts with this and the compressed size of every channel.
+typedef struct
+{
+  uint32_t                  magic;
+  uint32_t                  count;
+  uint64_t                  first;
+}REC_BLOCK_HEADER;
+
+
+typedef struct
+{
+  uint64_t                  first;
+  uint64_t                  offset;
+}REC_INDEX;
+
+
+// A full block waiting for the writer thread.
+typedef struct
+{
+  uint64_t                  first;
+  int                       count;
+  std::vector<std::vector<int16_t>>   data;
+}REC_PENDING;
+
+
+typedef struct
+{
+  uint64_t                  indexOffset;
+  uint64_t                  blocks;
+  char                      magic[8];
+}REC_TRAILER;
+
+
+
+// Lossless coding of one channel block: a fixed predictor of order 0..2,
+// chosen per block, and the zigzag residuals bit-packed in groups of
+// REC_GROUP with one width byte per group.
+void                        rec_encode(const int16_t *, int, std::vector<uint8_t> &);
+bool                        rec_decode(const uint8_t *, size_t, int, int16_t *);
+
+
+
+// Records raw ADC counts. append() only copies into the current block and
+// never blocks; full blocks go to a writer thread, which compresses the
+// channels in parallel and appends them to the file. Blocks that arrive
+// while REC_QUEUE blocks are still waiting are dropped and counted.
+class Recorder
+{
+public:
+                            Recorder();
+                            ~Recorder();
+
+  bool                      open(const std::string &, double, const std::vector<REC_CHANNEL> &);
+  void                      append(const int16_t * const *, int);
+  void                      close();
+  bool                      is_open();
+
+  uint64_t                  samples();
+  uint64_t                  dropped();
+  double                    ratio();
+  double                    throughput();
+
+private:
+  void                      run();
+  void                      push(bool);
+  void                      write_block(REC_PENDING &);
+
+  FILE *                    file;
+  int                       channels;
+  std::vector<std::vector<int16_t>>   block;
+  int                       fill;
+  uint64_t                  appended;
+  uint64_t                  lost;
+
+  std::thread               writer;
+  std::mutex                mutex;
+  std::condition_variable   wake;
+  bool                      closing;
+  std::deque<REC_PENDING>   queue;
+  std::vector<std::vector<std::vector<int16_t>>>  spare;
+
+  std::vector<REC_INDEX>    index;
+  uint64_t                  rawBytes;
+  uint64_t                  fileBytes;
+  double                    encodeSeconds;
+};
+
+
+
+// Random access to a recording. The index comes from the trailer, or from
+// a scan over the blocks if the writer never closed the file. Blocks the
+// recorder dropped leave gaps in the index; they read as zero counts.
+class Playback
+{
+public:
+                            Playback();
+                            ~Playback();
+
+  bool                      open(const std::string &);
+  int                       channels();
+  double                    sample_rate();
+  uint64_t                  samples();
+  uint64_t                  dropped();
+  const REC_CHANNEL &       channel(int);
+  int                       read(uint64_t, int, int16_t **);
+
+private:
+  bool                      load_block(size_t);
+
+  FILE *                    file;
+  REC_HEADER                header;
+  std::vector<REC_INDEX>    index;
+  uint64_t                  total;
+  uint64_t                  holes;
+
+  size_t                    cached;
+  int                       cachedCount;
+  std::vector<std::vector<int16_t>>   decoded;
+  std::vector<uint8_t>      buffer;
+};
+
+
+#endif //RECORDER_H
@@ -0,0 +1,73 @@
+#include "registry.hpp"
+#include <cctype>
+#include <string>
+#include <vector>
+
+
+// Returns the new id. The math variable is the lower case label with '.'
+// as '_'; single letter roles get a 0, as in x0 and y0.
+int ChannelRegistry::add(CHANNEL_KIND kind, const std::string & label, int unit, int input)
+{
+  CHANNEL_ENTRY e;
+  e.id       = entries.size();
+  e.kind     = kind;
+  e.label    = label;
+  e.variable = label;
+  e.unit     = unit;
+  e.input    = input;
+  for(auto & c: e.variable)
+    c = c == '.' ? '_' : std::tolower(c);
+  if(kind == CH_ROLE && label.size() == 1)
+    e.variable += "0";
+
+  if(kind == CH_INPUT)
+    inputs[{unit, input}] = e.id;
+  entries.push_back(e);
+  return e.id;
+}
+
+
+void ChannelRegistry::clear()
+{
+  entries.clear();
+  inputs.clear();
+}
+
+
+int ChannelRegistry::size() const
+{
+  return entries.size();
+}
+
+
+const CHANNEL_ENTRY & ChannelRegistry::entry(int id) const
+{
+  return entries[id];
+}
+
+
+// -1 if there is no such label
+int ChannelRegistry::find(const std::string & label) const
+{
+  for(auto & e: entries)
+    if(e.label == label)
+      return e.id;
+  return -1;
+}
+
+
+// id of a physical input, -1 if it was not registered
+int ChannelRegistry::input(int unit, int ch) const
+{
+  auto i = inputs.find({unit, ch});
+  return i == inputs.end() ? -1 : i->second;
+}
+
+
+std::vector<std::string> ChannelRegistry::labels() const
+{
+  std::vector<std::string> l;
+  for(auto & e: entries)
+    l.push_back(e.label);
+  return l;
+}
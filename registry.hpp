@@ -0,0 +1,52 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+
+typedef enum
+  {
+    CH_ROLE, CH_LOCKIN, CH_PLUGIN, CH_INPUT
+  }CHANNEL_KIND;
+
+
+// One data slot. The id is its index in data_vec and in every per-slot
+// table, and stays the same for the whole session.
+typedef struct
+{
+  int                       id;
+  CHANNEL_KIND              kind;
+  std::string               label;
+  std::string               variable;
+  int                       unit;
+  int                       input;
+}CHANNEL_ENTRY;
+
+
+
+// Every physical and derived channel of the session. It is filled once,
+// when the units are known, and everything sized per slot (data_vec, the
+// history, graphs, measurements, the choosers and math variables) is
+// generated from it.
+class ChannelRegistry
+{
+public:
+  int                       add(CHANNEL_KIND, const std::string &, int = -1, int = -1);
+  void                      clear();
+  int                       size() const;
+  const CHANNEL_ENTRY &     entry(int) const;
+  int                       find(const std::string &) const;
+  int                       input(int, int) const;
+  std::vector<std::string>  labels() const;
+
+private:
+  std::vector<CHANNEL_ENTRY>          entries;
+  std::map<std::pair<int, int>, int>  inputs;
+};
+
+
+#endif //REGISTRY_H
@@ -0,0 +1,614 @@
+#include "reprocess.hpp"
+#include "registry.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <regex>
+#include <set>
+#include <thread>
+#include <sys/stat.h>
+
+
+#define ROLES 12                          // X, Y, Z0..Z9, the slots a recorded channel may have fed
+
+
+
+static void usage()
+{
+  printf("Usage: live-plotter-4000 --reprocess <recording.lpr> [options]\n"
+         "  --out <dir>                  results, default <recording>_batch\n"
+         "  --threads <n>                0 for every core (default)\n"
+         "  --chunk <samples>            per task, default 1048576\n"
+         "  --warmup <samples>           run ahead of every chunk, default 65536\n"
+         "  --filter fir|biquad|average  low-pass on every recorded channel\n"
+         "  --cutoff <Hz> --order <n>\n"
+         "  --math <expression>          exported and summarised, repeatable\n"
+         "  --z <expression>             colour of the XY image, default z0\n"
+         "  --image last|mean|max        how samples in one cell combine\n"
+         "  --size <cells>               of the XY image, default 1000\n"
+         "  --delay <samples>            scan delay\n"
+         "  --linear                     ignore the saved scan calibration\n"
+         "  --decimate <n>               export every n-th sample, 0 for none, default 100\n");
+}
+
+
+static void empty_summary(SUMMARY * s)
+{
+  s->count         = 0;
+  s->sum           = 0.0;
+  s->sumsq         = 0.0;
+  s->min           = INFINITY;
+  s->max           = -INFINITY;
+  s->high          = 0;
+  s->periods       = 0;
+  s->periodSamples = 0;
+}
+
+
+static void add_summary(SUMMARY * to, const SUMMARY & s)
+{
+  to->count         += s.count;
+  to->sum           += s.sum;
+  to->sumsq         += s.sumsq;
+  to->min            = std::min(to->min, s.min);
+  to->max            = std::max(to->max, s.max);
+  to->high          += s.high;
+  to->periods       += s.periods;
+  to->periodSamples += s.periodSamples;
+}
+
+
+static void add_moments(SUMMARY * to, const double * x, int n)
+{
+  if(n <= 0)
+    return;
+  SUMMARY s;
+  empty_summary(&s);
+  simd_moments(x, n, &s.sum, &s.sumsq, &s.min, &s.max);
+  s.count = n;
+  add_summary(to, s);
+}
+
+
+// Returns false and prints the usage on a bad command line. --linear is
+// reported through calibrated, which the caller fills from the saved
+// calibration otherwise.
+bool reprocess_arguments(int argc, char ** argv, REPROCESS_SETTINGS * s)
+{
+  s->threads           = 0;
+  s->chunk             = 1 << 20;
+  s->warmup            = REC_BLOCK;
+  s->filter.type       = FILTER_OFF;
+  s->filter.cutoff     = 1000.0;
+  s->filter.order      = 31;
+  s->filter.decimation = 1;
+  s->z                 = "z0";
+  s->imageMode         = IMAGE_LAST;
+  s->imageSize         = 1000;
+  s->calibrated        = true;
+  s->calibration       = ScanMap::linear(-1.0, 1.0, -1.0, 1.0);
+  s->calibration.delay = -1;
+  s->decimation        = 100;
+
+  for(int i = 0; i < argc; i++)
+    {
+      std::string a     = argv[i];
+      const char * next = i + 1 < argc ? argv[i+1] : nullptr;
+      bool         value = a != "--linear" && a.compare(0, 2, "--") == 0;
+      if(value && !next)
+        {
+          printf("Error: %s needs a value\n", a.c_str());
+          usage();
+          return false;
+        }
+
+      if(a == "--out")
+        s->output = next;
+      else if(a == "--threads")
+        s->threads = std::max(0, atoi(next));
+      else if(a == "--chunk")
+        s->chunk = std::max(REC_BLOCK, atoi(next));
+      else if(a == "--warmup")
+        s->warmup = std::max(0, atoi(next));
+      else if(a == "--filter")
+        {
+          std::string f = next;
+          s->filter.type = f == "fir" ? FILTER_FIR : f == "biquad" ? FILTER_BIQUAD :
+                           f == "average" ? FILTER_AVERAGE : FILTER_OFF;
+        }
+      else if(a == "--cutoff")
+        s->filter.cutoff = atof(next);
+      else if(a == "--order")
+        s->filter.order = std::max(1, atoi(next));
+      else if(a == "--math")
+        s->math.push_back(next);
+      else if(a == "--z")
+        s->z = next;
+      else if(a == "--image")
+        {
+          std::string m = next;
+          s->imageMode = m == "mean" ? IMAGE_MEAN : m == "max" ? IMAGE_MAX : IMAGE_LAST;
+        }
+      else if(a == "--size")
+        s->imageSize = std::min(std::max(1, atoi(next)), 8192);
+      else if(a == "--delay")
+        s->calibration.delay = std::min(std::max(0, atoi(next)), SCANMAP_MAXDELAY);
+      else if(a == "--decimate")
+        s->decimation = std::max(0, atoi(next));
+      else if(a == "--linear")
+        s->calibrated = false;
+      else if(!value && s->input.empty())
+        {
+          s->input = a;
+          continue;
+        }
+      else
+        {
+          printf("Error: unknown argument %s\n", a.c_str());
+          usage();
+          return false;
+        }
+      if(value)
+        i++;
+    }
+
+  if(s->input.empty())
+    {
+      usage();
+      return false;
+    }
+  if(s->output.empty())
+    {
+      size_t dot = s->input.rfind('.');
+      s->output  = s->input.substr(0, dot == std::string::npos ? s->input.size() : dot) + "_batch";
+    }
+  return true;
+}
+
+
+
+ChunkProcessor::ChunkProcessor(const REPROCESS_SETTINGS & settings,
+                               const std::vector<std::pair<std::string, int>> & bound)
+  : settings(settings)
+  , opened(false)
+  , channels(0)
+  , xChannel(-1)
+  , yChannel(-1)
+  , result(nullptr)
+{
+  if(!playback.open(settings.input))
+    return;
+  channels = playback.channels();
+  for(int c = 0; c < channels; c++)
+    {
+      scale.push_back(playback.channel(c).scale);
+      if(playback.channel(c).slot == 0)
+        xChannel = c;
+      if(playback.channel(c).slot == 1)
+        yChannel = c;
+      if(settings.filter.type != FILTER_OFF)
+        filters.push_back(Filter(settings.filter, playback.sample_rate()));
+    }
+  scanMap.set_calibration(settings.calibration);
+
+  counts.assign(channels, std::vector<int16_t>(REC_BLOCK));
+  volts.assign(channels, std::vector<double>(REC_BLOCK));
+  for(auto & c: counts)
+    out.push_back(c.data());
+
+  variables.assign(bound.size(), 0.0);
+  for(size_t v = 0; v < bound.size(); v++)
+    {
+      binding.push_back(bound[v].second);
+      symbols.add_variable(bound[v].first, variables[v]);
+    }
+  symbols.add_constants();
+
+  exprtk::parser<double> parser;
+  std::vector<std::string> sources = settings.math;
+  sources.push_back(settings.z);
+  expressions.resize(sources.size());
+  values.assign(sources.size(), std::vector<double>(REC_BLOCK));
+  for(size_t e = 0; e < sources.size(); e++)
+    {
+      expressions[e].register_symbol_table(symbols);
+      if(!parser.compile(sources[e], expressions[e]))
+        {
+          printf("Error: %s: %s\n", sources[e].c_str(), parser.error().c_str());
+          return;
+        }
+    }
+  points.resize(3*REC_BLOCK);
+  opened = true;
+}
+
+
+bool ChunkProcessor::ok()
+{
+  return opened;
+}
+
+
+void ChunkProcessor::bin(double z, int c)
+{
+  switch(settings.imageMode)
+    {
+    case IMAGE_LAST:
+      result->image[c] = z;
+      result->hits[c]  = 1;
+      break;
+    case IMAGE_MEAN:
+      result->image[c] += z;
+      result->hits[c]++;
+      break;
+    case IMAGE_MAX:
+      if(!result->hits[c] || z > result->image[c])
+        result->image[c] = z;
+      result->hits[c] = 1;
+      break;
+    }
+}
+
+
+// Filters and the scan delay start from rest at begin - warmup; the
+// samples before begin only settle them and are not counted, so a chunk
+// gives the same result whichever thread runs it.
+void ChunkProcessor::process(int index, CHUNK_RESULT * r)
+{
+  uint64_t total = playback.samples();
+  uint64_t begin = (uint64_t)index*settings.chunk;
+  uint64_t end   = std::min(begin + settings.chunk, total);
+  uint64_t start = begin > (uint64_t)settings.warmup ? begin - settings.warmup : 0;
+  int      size  = settings.imageSize;
+  int      math  = settings.math.size();
+
+  result        = r;
+  r->index      = index;
+  r->exported.clear();
+  r->stats.resize(channels + math);
+  for(auto & s: r->stats)
+    empty_summary(&s);
+  r->image.assign((size_t)size*size, 0.0);
+  r->hits.assign((size_t)size*size, 0);
+
+  for(auto & f: filters)
+    f.reset();
+  scanMap.reset();
+
+  char line[64];
+  for(uint64_t pos = start; pos < end; )
+    {
+      int n = playback.read(pos, (int)std::min<uint64_t>(REC_BLOCK, end - pos), out.data());
+      if(n <= 0)
+        break;
+      int skip = pos < begin ? (int)std::min<uint64_t>(n, begin - pos) : 0;
+
+      for(int c = 0; c < channels; c++)
+        {
+          simd_scale_int16(counts[c].data(), n, scale[c], volts[c].data());
+          if(!filters.empty())
+            filters[c].process_held(volts[c].data(), n, volts[c].data());
+          add_moments(&r->stats[c], volts[c].data() + skip, n - skip);
+        }
+
+      for(int i = 0; i < n; i++)
+        {
+          for(size_t v = 0; v < variables.size(); v++)
+            variables[v] = volts[binding[v]][i];
+          for(size_t e = 0; e < expressions.size(); e++)
+            values[e][i] = expressions[e].value();
+          points[3*i]   = xChannel >= 0 ? volts[xChannel][i] : 0.0;
+          points[3*i+1] = yChannel >= 0 ? volts[yChannel][i] : 0.0;
+          points[3*i+2] = values[math][i];
+        }
+      for(int e = 0; e < math; e++)
+        add_moments(&r->stats[channels + e], values[e].data() + skip, n - skip);
+
+      scanMap.map(points.data(), n, mx, my, mz);
+      for(int i = skip; i < n; i++)
+        {
+          int cx = scanMap.cell(0, mx[i], size);
+          int cy = scanMap.cell(1, my[i], size);
+          if(cx >= 0 && cy >= 0 && !std::isnan(mz[i]))
+            bin(mz[i], cy*size + cx);
+        }
+
+      if(settings.decimation > 0)
+        {
+          uint64_t first = pos + skip;
+          first += (settings.decimation - first%settings.decimation)%settings.decimation;
+          for(uint64_t g = first; g < pos + n; g += settings.decimation)
+            {
+              snprintf(line, sizeof(line), "%llu", (unsigned long long)g);
+              r->exported += line;
+              for(int c = 0; c < channels; c++)
+                {
+                  snprintf(line, sizeof(line), ",%.9g", volts[c][g - pos]);
+                  r->exported += line;
+                }
+              for(int e = 0; e < math; e++)
+                {
+                  snprintf(line, sizeof(line), ",%.9g", values[e][g - pos]);
+                  r->exported += line;
+                }
+              r->exported += "\n";
+            }
+        }
+      pos += n;
+    }
+  result = nullptr;
+}
+
+
+
+// Folds chunk r into the running totals. r comes after everything
+// already in them, which is what IMAGE_LAST relies on.
+static void merge(IMAGE_MODE mode, CHUNK_RESULT * totals, const CHUNK_RESULT & r)
+{
+  for(size_t s = 0; s < totals->stats.size(); s++)
+    add_summary(&totals->stats[s], r.stats[s]);
+
+  for(size_t c = 0; c < totals->image.size(); c++)
+    {
+      if(!r.hits[c])
+        continue;
+      switch(mode)
+        {
+        case IMAGE_LAST:
+          totals->image[c] = r.image[c];
+          break;
+        case IMAGE_MEAN:
+          totals->image[c] += r.image[c];
+          break;
+        case IMAGE_MAX:
+          if(!totals->hits[c] || r.image[c] > totals->image[c])
+            totals->image[c] = r.image[c];
+          break;
+        }
+      totals->hits[c] += r.hits[c];
+    }
+}
+
+
+static std::string quoted(const std::string & s)
+{
+  std::string q = "\"";
+  for(char c: s)
+    q += c == '"' ? std::string("\"\"") : std::string(1, c);
+  return q + "\"";
+}
+
+
+// The live equations also know slider parameters a..m and the
+// measurements; a recording has neither. A variable two recorded channels
+// are bound to would take the value of either.
+static bool check_sources(const REPROCESS_SETTINGS & settings,
+                          const std::vector<std::pair<std::string, int>> & bound)
+{
+  std::vector<std::string> sources = settings.math;
+  sources.push_back(settings.z);
+
+  std::set<std::string> names, twice;
+  for(auto & b: bound)
+    if(!names.insert(b.first).second)
+      twice.insert(b.first);
+
+  std::regex parameter("\\b[a-m]\\b");
+  std::regex measurement("\\b(mean|rms|min|max|pp|freq|duty)_[a-z][a-z0-9_]*");
+  bool       ok = true;
+  for(auto & s: sources)
+    {
+      std::smatch m;
+      if(std::regex_search(s, m, parameter))
+        {
+          printf("Error: %s: parameter %s is only available in the live session\n", s.c_str(), m.str().c_str());
+          ok = false;
+        }
+      if(std::regex_search(s, m, measurement))
+        {
+          printf("Error: %s: measurement %s is only available in the live session\n", s.c_str(), m.str().c_str());
+          ok = false;
+        }
+      for(auto & t: twice)
+        if(std::regex_search(s, std::regex("\\b" + t + "\\b")))
+          {
+            printf("Error: %s: %s is bound to more than one recorded channel\n", s.c_str(), t.c_str());
+            ok = false;
+          }
+    }
+  return ok;
+}
+
+
+bool reprocess(const REPROCESS_SETTINGS & settings)
+{
+  auto started = std::chrono::steady_clock::now();
+
+  Playback probe;
+  if(!probe.open(settings.input))
+    {
+      printf("Error: cannot open recording %s\n", settings.input.c_str());
+      return false;
+    }
+  int      channels = probe.channels();
+  uint64_t total    = probe.samples();
+
+  // math variables as in the live session: the role a channel fed and its input
+  ChannelRegistry registry;
+  for(auto r: {"X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"})
+    registry.add(CH_ROLE, r);
+  std::vector<std::pair<std::string, int>> bound;
+  for(int c = 0; c < channels; c++)
+    {
+      const REC_CHANNEL & rc = probe.channel(c);
+      int  u  = 0;
+      char in = 'A';
+      sscanf(rc.name, "U%d.%c", &u, &in);
+      int id = registry.add(CH_INPUT, rc.name, u, in - 'A');
+      bound.push_back({registry.entry(id).variable, c});
+      if(rc.slot >= 0 && rc.slot < ROLES)
+        bound.push_back({registry.entry(rc.slot).variable, c});
+    }
+  if(!check_sources(settings, bound))
+    return false;
+
+  // without a calibration the image spans the full scale of X and Y
+  REPROCESS_SETTINGS run = settings;
+  if(!run.calibrated)
+    {
+      double range[2] = {1.0, 1.0};
+      for(int c = 0; c < channels; c++)
+        if(probe.channel(c).slot == 0 || probe.channel(c).slot == 1)
+          range[probe.channel(c).slot] = std::fabs(probe.channel(c).scale)*32767.0;
+      int delay = run.calibration.delay;
+      run.calibration       = ScanMap::linear(-range[0], range[0], -range[1], range[1]);
+      run.calibration.delay = delay;
+    }
+  run.calibration.delay = std::max(run.calibration.delay, 0);
+
+  int threads = run.threads > 0 ? run.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+  int chunks  = (int)((total + run.chunk - 1)/run.chunk);
+  threads     = std::max(1, std::min(threads, chunks));
+
+  if(mkdir(run.output.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+      printf("Error: cannot create %s\n", run.output.c_str());
+      return false;
+    }
+  FILE * exported = nullptr;
+  if(run.decimation > 0)
+    {
+      exported = fopen((run.output + "/channels.csv").c_str(), "w");
+      if(!exported)
+        {
+          printf("Error: cannot write %s/channels.csv\n", run.output.c_str());
+          return false;
+        }
+      fprintf(exported, "sample");
+      for(int c = 0; c < channels; c++)
+        fprintf(exported, ",%s", quoted(probe.channel(c).name).c_str());
+      for(auto & m: run.math)
+        fprintf(exported, ",%s", quoted(m).c_str());
+      fprintf(exported, "\n");
+    }
+
+  printf("Reprocessing %s: %llu samples x %d channels, %d chunks on %d threads\n",
+         run.input.c_str(), (unsigned long long)total, channels, chunks, threads);
+
+  std::mutex                    mutex;
+  std::condition_variable       changed;
+  std::map<int, CHUNK_RESULT>   done;
+  std::atomic<int>              next{0};
+  int                           merged = 0;
+  bool                          failed = false;
+
+  std::vector<std::thread> pool;
+  for(int t = 0; t < threads; t++)
+    pool.emplace_back([&]()
+                      {
+                        ChunkProcessor processor(run, bound);
+                        if(!processor.ok())
+                          {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            failed = true;
+                            changed.notify_all();
+                            return;
+                          }
+                        for(int k = next++; k < chunks; k = next++)
+                          {
+                            {
+                              std::unique_lock<std::mutex> lock(mutex);
+                              changed.wait(lock, [&](){ return failed || k < merged + 2*threads; });
+                              if(failed)
+                                return;
+                            }
+                            CHUNK_RESULT r;
+                            processor.process(k, &r);
+                            std::lock_guard<std::mutex> lock(mutex);
+                            done[k] = std::move(r);
+                            changed.notify_all();
+                          }
+                      });
+
+  CHUNK_RESULT totals;
+  totals.index = 0;
+  totals.stats.resize(channels + run.math.size());
+  for(auto & s: totals.stats)
+    empty_summary(&s);
+  totals.image.assign((size_t)run.imageSize*run.imageSize, 0.0);
+  totals.hits.assign((size_t)run.imageSize*run.imageSize, 0);
+
+  for(int k = 0; k < chunks; k++)
+    {
+      CHUNK_RESULT r;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&](){ return failed || done.count(k); });
+        if(failed)
+          break;
+        r = std::move(done[k]);
+        done.erase(k);
+      }
+      merge(run.imageMode, &totals, r);
+      if(exported)
+        fwrite(r.exported.data(), 1, r.exported.size(), exported);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      merged = k + 1;
+      changed.notify_all();
+    }
+  for(auto & t: pool)
+    t.join();
+  if(exported)
+    fclose(exported);
+  if(failed)
+    {
+      printf("Error: reprocessing stopped\n");
+      return false;
+    }
+
+  FILE * file = fopen((run.output + "/stats.csv").c_str(), "w");
+  if(file)
+    {
+      fprintf(file, "channel,count,mean,rms,min,max\n");
+      for(size_t s = 0; s < totals.stats.size(); s++)
+        {
+          const SUMMARY & m = totals.stats[s];
+          std::string name  = (int)s < channels ? std::string(probe.channel(s).name) : run.math[s - channels];
+          double n          = m.count ? (double)m.count : 1.0;
+          fprintf(file, "%s,%lld,%.9g,%.9g,%.9g,%.9g\n", quoted(name).c_str(), (long long)m.count,
+                  m.sum/n, std::sqrt(m.sumsq/n), m.count ? m.min : NAN, m.count ? m.max : NAN);
+        }
+      fclose(file);
+    }
+
+  // one row per y cell from lo to hi, empty cells as nan
+  file = fopen((run.output + "/image.csv").c_str(), "w");
+  if(file)
+    {
+      int size = run.imageSize;
+      for(int y = 0; y < size; y++)
+        for(int x = 0; x < size; x++)
+          {
+            size_t c = (size_t)y*size + x;
+            double v = !totals.hits[c] ? NAN :
+                       run.imageMode == IMAGE_MEAN ? totals.image[c]/totals.hits[c] : totals.image[c];
+            fprintf(file, x + 1 < size ? "%.9g," : "%.9g\n", v);
+          }
+      fclose(file);
+    }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+  printf("Reprocessed in %.2f s, %.1f MS/s per channel, results in %s\n",
+         seconds, total/std::max(seconds, 1e-9)/1e6, run.output.c_str());
+  return true;
+}
@@ -0,0 +1,101 @@
+#ifndef REPROCESS_H
+#define REPROCESS_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "exprtk.hpp"
+#include "filter.hpp"
+#include "recorder.hpp"
+#include "scanmap.hpp"
+#include "stats.hpp"
+
+
+typedef enum
+  {
+    IMAGE_LAST, IMAGE_MEAN, IMAGE_MAX
+  }IMAGE_MODE;
+
+
+typedef struct
+{
+  std::string               input;
+  std::string               output;       // directory for the results
+  int                       threads;      // 0 for every core
+  int                       chunk;        // samples per chunk
+  int                       warmup;       // samples run ahead of each chunk and discarded
+  FILTER_SETTINGS           filter;       // applied to every recorded channel
+  std::vector<std::string>  math;
+  std::string               z;            // colour of the XY image, an expression
+  IMAGE_MODE                imageMode;
+  int                       imageSize;
+  bool                      calibrated;   // false: linear over the full scale of X and Y
+  SCAN_CALIBRATION          calibration;
+  int                       decimation;   // every n-th sample of the math channels is exported, 0 for none
+}REPROCESS_SETTINGS;
+
+
+// What one chunk contributes. Merged in chunk order, so the results do not
+// depend on the number of threads or on which chunk finished first.
+typedef struct
+{
+  int                       index;
+  std::vector<SUMMARY>      stats;        // per recorded channel, then per math channel
+  std::vector<double>       image;        // IMAGE_MEAN: sums, otherwise values
+  std::vector<uint32_t>     hits;
+  std::string               exported;
+}CHUNK_RESULT;
+
+// Runs chunks of a recording through the stages, on one thread. Every
+// thread of the pool has its own, with its own file handle, filters, scan
+// map and compiled expressions; the variables of the expressions are
+// bound to the current sample of the recorded channels.
+class ChunkProcessor
+{
+public:
+                            ChunkProcessor(const REPROCESS_SETTINGS &,
+                                           const std::vector<std::pair<std::string, int>> &);
+
+  bool                      ok();
+  void                      process(int, CHUNK_RESULT *);
+
+private:
+  void                      bin(double, int);
+
+  const REPROCESS_SETTINGS &              settings;
+  Playback                                playback;
+  bool                                    opened;
+  int                                     channels;
+  int                                     xChannel, yChannel;
+  std::vector<double>                     scale;
+  std::vector<Filter>                     filters;
+  ScanMap                                 scanMap;
+
+  std::vector<int>                        binding;    // recorded channel of every variable
+  std::vector<double>                     variables;  // bound by the expressions, never resized
+  exprtk::symbol_table<double>            symbols;
+  std::vector<exprtk::expression<double>> expressions;  // the math channels, then z
+
+  std::vector<std::vector<int16_t>>       counts;
+  std::vector<int16_t *>                  out;
+  std::vector<std::vector<double>>        volts;
+  std::vector<std::vector<double>>        values;
+  std::vector<double>                     points;
+  std::vector<double>                     mx, my, mz;
+  CHUNK_RESULT *                          result;
+};
+
+
+
+// Offline reprocessing of a recording. The recording is split into chunks
+// that a pool of threads runs through conversion, the channel filter, the
+// math channels and XY binning, each chunk starting warmup samples early
+// so filters and the scan delay have settled when its own samples begin.
+// The driver thread merges the chunks in order while the pool works on the
+// next ones; no more than two chunks per thread are held at any time.
+bool                        reprocess_arguments(int, char **, REPROCESS_SETTINGS *);
+bool                        reprocess(const REPROCESS_SETTINGS &);
+
+
+#endif //REPROCESS_H
@@ -0,0 +1,76 @@
+#include "resample.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+// inRate and outRate in S/s; up to 0.2 s of input is kept waiting
+Resampler::Resampler(double inRate, double outRate)
+  : step(inRate/outRate)
+  , produced(0)
+  , origin(0.0)
+  , base(0)
+  , limit(std::max(16, (int)(0.2*inRate)))
+  , last(0.0)
+{
+}
+
+
+void Resampler::push(const double * in, int count)
+{
+  buffer.insert(buffer.end(), in, in + count);
+
+  int excess = (int)buffer.size() - limit;
+  if(excess > 0)
+    {
+      buffer.erase(buffer.begin(), buffer.begin() + excess);
+      base  += excess;
+      origin = std::max(origin, base - produced*step);
+    }
+}
+
+
+void Resampler::pull(double * out, int count)
+{
+  int64_t size = (int64_t)buffer.size();
+  for(int k = 0; k < count; k++, produced++)
+    {
+      double  t = std::max(0.0, origin + produced*step - base);
+      int64_t i = (int64_t)std::floor(t);
+      if(i + 1 < size)
+        last = buffer[i] + (t - i)*(buffer[i+1] - buffer[i]);
+      else if(i + 1 == size)
+        last = buffer[i];
+      out[k] = last;
+    }
+
+  // drop what no later output sample can reach
+  int64_t used = std::min((int64_t)std::floor(origin + produced*step) - base, size > 0 ? size - 1 : 0);
+  if(used > 0)
+    {
+      buffer.erase(buffer.begin(), buffer.begin() + used);
+      base += used;
+    }
+}
+
+
+void Resampler::reset()
+{
+  buffer.clear();
+  produced = 0;
+  origin   = 0.0;
+  base     = 0;
+  last     = 0.0;
+}
+
+
+// input samples that are buffered ahead of the read position
+int Resampler::pending()
+{
+  return (int)std::max<int64_t>(0, base + (int64_t)buffer.size() - (int64_t)std::ceil(origin + produced*step));
+}
+
+
+double Resampler::ratio()
+{
+  return step;
+}
@@ -0,0 +1,39 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#include <cstdint>
+#include <vector>
+
+
+
+// Streaming linear resampler that maps one channel onto the timebase of
+// the stream. Blocks of any size go in with push() as they arrive and
+// pull() takes exactly as many output samples as the consumer block has.
+// Output sample k is the input at sample index k*step since the last
+// reset plus a fixed origin, so the offset between the units does not
+// depend on the timing of their callbacks. Only an output sample beyond
+// the newest input holds the last value. A backlog beyond the limit is
+// skipped by moving the origin, which bounds the latency.
+class Resampler
+{
+public:
+                            Resampler(double, double);
+
+  void                      push(const double *, int);
+  void                      pull(double *, int);
+  void                      reset();
+  int                       pending();
+  double                    ratio();
+
+private:
+  double                    step;       // input samples per output sample
+  int64_t                   produced;   // output samples since the reset
+  double                    origin;     // input sample index of output sample 0
+  int64_t                   base;       // input sample index of buffer[0]
+  int                       limit;      // input samples kept at most
+  double                    last;
+  std::vector<double>       buffer;
+};
+
+
+#endif //RESAMPLE_H
@@ -0,0 +1,260 @@
+#include "scanmap.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+ScanMap::ScanMap()
+{
+  set_calibration(linear(-1.0, 1.0, -1.0, 1.0));
+}
+
+
+void ScanMap::set_calibration(const SCAN_CALIBRATION & c)
+{
+  cal       = c;
+  cal.delay = std::min(std::max(cal.delay, 0), SCANMAP_MAXDELAY);
+  for(int axis = 0; axis < 2; axis++)
+    {
+      if(!(cal.hi[axis] > cal.lo[axis]))
+        cal.hi[axis] = cal.lo[axis] + 1.0;
+      build(axis);
+    }
+  reset();
+}
+
+
+const SCAN_CALIBRATION & ScanMap::calibration()
+{
+  return cal;
+}
+
+
+// Forgets the scanner positions that are still waiting for their detector
+// samples, e.g. when the stream restarts.
+void ScanMap::reset()
+{
+  lagX    = std::vector<double>(cal.delay, NAN);
+  lagY    = std::vector<double>(cal.delay, NAN);
+  lagHead = 0;
+}
+
+
+// Samples the monotone cubic through the knots (Fritsch-Carlson tangents)
+// into the table. Beyond the outer knots the end segments are extended
+// linearly.
+void ScanMap::build(int axis)
+{
+  const std::vector<double> & v = cal.volts[axis];
+  const std::vector<double> & f = cal.field[axis];
+  double lo   = cal.lo[axis];
+  double hi   = cal.hi[axis];
+  int    last = SCANMAP_LUT - 1;
+
+  scale[axis]   = last/(hi - lo);
+  inverse[axis] = 1.0/(hi - lo);
+  lut[axis].resize(SCANMAP_LUT + 1);
+
+  int k = std::min(v.size(), f.size());
+  if(k < 2)
+    {
+      for(int i = 0; i <= last; i++)
+        lut[axis][i] = lo + (hi - lo)*i/last;
+      lut[axis][last+1] = lut[axis][last];
+      return;
+    }
+
+  std::vector<double> slope(k - 1), tangent(k);
+  for(int j = 0; j + 1 < k; j++)
+    slope[j] = (f[j+1] - f[j])/(v[j+1] - v[j]);
+  tangent[0]   = slope[0];
+  tangent[k-1] = slope[k-2];
+  for(int j = 1; j + 1 < k; j++)
+    tangent[j] = slope[j-1]*slope[j] <= 0.0 ? 0.0 : (slope[j-1] + slope[j])/2.0;
+  for(int j = 0; j + 1 < k; j++)
+    {
+      if(slope[j] == 0.0)
+        {
+          tangent[j] = tangent[j+1] = 0.0;
+          continue;
+        }
+      double a = tangent[j]/slope[j], b = tangent[j+1]/slope[j];
+      double r = a*a + b*b;
+      if(r > 9.0)
+        {
+          tangent[j]   = 3.0/std::sqrt(r)*a*slope[j];
+          tangent[j+1] = 3.0/std::sqrt(r)*b*slope[j];
+        }
+    }
+
+  int j = 0;
+  for(int i = 0; i <= last; i++)
+    {
+      double x = lo + (hi - lo)*i/last;
+      double y;
+      if(x <= v[0])
+        y = f[0] + slope[0]*(x - v[0]);
+      else if(x >= v[k-1])
+        y = f[k-1] + slope[k-2]*(x - v[k-1]);
+      else
+        {
+          while(j + 2 < k && x > v[j+1])
+            j++;
+          double h  = v[j+1] - v[j];
+          double t  = (x - v[j])/h;
+          double t2 = t*t, t3 = t2*t;
+          y = (2*t3 - 3*t2 + 1)*f[j] + (t3 - 2*t2 + t)*h*tangent[j] +
+              (-2*t3 + 3*t2)*f[j+1] + (t3 - t2)*h*tangent[j+1];
+        }
+      lut[axis][i] = lo + (hi - lo)*y;
+    }
+  lut[axis][last+1] = lut[axis][last];
+}
+
+
+// points are x, y, z triples; x and y come out mapped and delayed against
+// z, with NaN where the position falls outside the scan or is not yet known.
+void ScanMap::map(const double * points, int count, std::vector<double> & x, std::vector<double> & y, std::vector<double> & z)
+{
+  int d = cal.delay;
+  rawX.resize(d + count);
+  rawY.resize(d + count);
+  z.resize(count);
+  std::copy(lagX.begin(), lagX.end(), rawX.begin());
+  std::copy(lagY.begin(), lagY.end(), rawY.begin());
+  for(int i = 0; i < count; i++)
+    {
+      rawX[d+i] = points[3*i];
+      rawY[d+i] = points[3*i+1];
+      z[i]      = points[3*i+2];
+    }
+  std::copy(rawX.begin() + count, rawX.end(), lagX.begin());
+  std::copy(rawY.begin() + count, rawY.end(), lagY.begin());
+
+  x.resize(count);
+  y.resize(count);
+  simd_lut_lerp(rawX.data(), count, cal.lo[0], scale[0], SCANMAP_LUT - 1, lut[0].data(), x.data());
+  simd_lut_lerp(rawY.data(), count, cal.lo[1], scale[1], SCANMAP_LUT - 1, lut[1].data(), y.data());
+}
+
+
+// One sample at a time, for the frame builder. Returns false while the
+// delayed position is not known or outside the scan.
+bool ScanMap::map_point(double x, double y, double * mx, double * my)
+{
+  if(cal.delay > 0)
+    {
+      std::swap(x, lagX[lagHead]);
+      std::swap(y, lagY[lagHead]);
+      lagHead = (lagHead + 1)%cal.delay;
+    }
+  simd_lut_lerp(&x, 1, cal.lo[0], scale[0], SCANMAP_LUT - 1, lut[0].data(), mx);
+  simd_lut_lerp(&y, 1, cal.lo[1], scale[1], SCANMAP_LUT - 1, lut[1].data(), my);
+  return !std::isnan(*mx) && !std::isnan(*my);
+}
+
+
+// cell of a mapped position on a grid of cells across the scan, -1 outside
+int ScanMap::cell(int axis, double v, int cells)
+{
+  int c = (int)std::floor((v - cal.lo[axis])*inverse[axis]*cells);
+  return c >= 0 && c < cells ? c : -1;
+}
+
+
+SCAN_CALIBRATION ScanMap::linear(double x0, double x1, double y0, double y1)
+{
+  SCAN_CALIBRATION c;
+  c.lo[0] = x0;
+  c.hi[0] = x1;
+  c.lo[1] = y0;
+  c.hi[1] = y1;
+  c.delay = 0;
+  return c;
+}
+
+
+// Fits a calibration to a recorded scan of x, y and detector samples. The
+// extent is the 0.5 to 99.5 % range of each scanner signal. The scan is
+// taken to dwell equally on every part of the field, as a raster at
+// constant speed does, so the field position of a voltage is its quantile
+// and the knots sit at equally spaced quantiles; this straightens a
+// sinusoidal or otherwise nonlinear sweep. The delay is the one for which
+// the detector profiles along x of the forward and the backward sweeps
+// agree best; it stays 0 if too few positions are swept both ways.
+SCAN_CALIBRATION ScanMap::fit(const double * x, const double * y, const double * z, int n)
+{
+  SCAN_CALIBRATION c = linear(-1.0, 1.0, -1.0, 1.0);
+  if(n < 16)
+    return c;
+
+  const double * signal[2] = {x, y};
+  for(int axis = 0; axis < 2; axis++)
+    {
+      std::vector<double> sorted(signal[axis], signal[axis] + n);
+      std::sort(sorted.begin(), sorted.end());
+      auto quantile = [&](double p){ return sorted[(size_t)(p*(n - 1))]; };
+
+      c.lo[axis] = quantile(0.005);
+      c.hi[axis] = quantile(0.995);
+      if(!(c.hi[axis] > c.lo[axis]))
+        {
+          c.hi[axis] = c.lo[axis] + 1.0;
+          continue;
+        }
+      for(int k = 0; k <= SCANMAP_KNOTS; k++)
+        {
+          double level = (double)k/SCANMAP_KNOTS;
+          double v     = quantile(0.005 + 0.99*level);
+          if(!c.volts[axis].empty() && v <= c.volts[axis].back())
+            continue;
+          c.volts[axis].push_back(v);
+          c.field[axis].push_back(level);
+        }
+    }
+
+  const int bins = 256;
+  int       used = std::min(n, 1 << 20);
+  double    lo   = c.lo[0];
+  double    k    = bins/(c.hi[0] - c.lo[0]);
+  double    best = INFINITY;
+  std::vector<double> sum[2], count[2];
+  for(int d = 0; d <= SCANMAP_MAXDELAY && d + 4 < used/4; d++)
+    {
+      for(int s = 0; s < 2; s++)
+        {
+          sum[s].assign(bins, 0.0);
+          count[s].assign(bins, 0.0);
+        }
+      for(int i = d + 2; i < used; i++)
+        {
+          int    j   = i - d;
+          double dir = x[j+1 < used ? j+1 : j] - x[j-1 > 0 ? j-1 : 0];
+          int    b   = (int)((x[j] - lo)*k);
+          if(b < 0 || b >= bins || dir == 0.0)
+            continue;
+          int s = dir > 0.0 ? 0 : 1;
+          sum[s][b]   += z[i];
+          count[s][b] += 1.0;
+        }
+
+      double cost   = 0.0;
+      int    shared = 0;
+      for(int b = 0; b < bins; b++)
+        if(count[0][b] > 0.0 && count[1][b] > 0.0)
+          {
+            double e = sum[0][b]/count[0][b] - sum[1][b]/count[1][b];
+            cost += e*e;
+            shared++;
+          }
+      if(shared < bins/4)
+        break;
+      cost /= shared;
+      if(cost < best)
+        {
+          best    = cost;
+          c.delay = d;
+        }
+    }
+  return c;
+}
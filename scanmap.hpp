@@ -0,0 +1,63 @@
+#ifndef SCANMAP_H
+#define SCANMAP_H
+
+#include <vector>
+
+
+#define SCANMAP_LUT      4096
+#define SCANMAP_KNOTS    32
+#define SCANMAP_MAXDELAY 256
+
+
+
+// Calibration of the XY scan. Per axis the input range in mV and, once
+// fitted, knots that give the position in the scan field (0..1 across
+// lo..hi) of a scanner voltage; without knots the axis is linear. delay
+// is the number of samples the detector lags the scanner signals.
+typedef struct
+{
+  double                    lo[2];
+  double                    hi[2];
+  std::vector<double>       volts[2];
+  std::vector<double>       field[2];
+  int                       delay;
+}SCAN_CALIBRATION;
+
+
+
+// Maps scanner voltages to positions in the scan field. Each axis is a
+// table of SCANMAP_LUT entries sampled from a monotone cubic through the
+// knots, so a sample costs a multiply and a linear interpolation. Mapped
+// positions are in mV again, lo..hi, and NaN outside the scan. Every
+// detector value is paired with the scanner position delay samples
+// earlier, also across blocks.
+class ScanMap
+{
+public:
+                            ScanMap();
+
+  void                      set_calibration(const SCAN_CALIBRATION &);
+  const SCAN_CALIBRATION &  calibration();
+  void                      reset();
+  void                      map(const double *, int, std::vector<double> &, std::vector<double> &, std::vector<double> &);
+  bool                      map_point(double, double, double *, double *);
+  int                       cell(int, double, int);
+
+  static SCAN_CALIBRATION   linear(double, double, double, double);
+  static SCAN_CALIBRATION   fit(const double *, const double *, const double *, int);
+
+private:
+  void                      build(int);
+
+  SCAN_CALIBRATION          cal;
+  std::vector<double>       lut[2];
+  double                    scale[2];
+  double                    inverse[2];
+
+  std::vector<double>       lagX, lagY;
+  std::vector<double>       rawX, rawY;
+  int                       lagHead;
+};
+
+
+#endif //SCANMAP_H
@@ -0,0 +1,343 @@
+#include "shmring.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+static size_t align8(size_t n)
+{
+  return (n + 7) & ~(size_t)7;
+}
+
+
+// A ring left behind by a producer that died. One that is still being
+// set up has no magic yet and counts as in use.
+static bool abandoned(const char * name)
+{
+  int fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0)
+    return errno == ENOENT;
+
+  struct stat st;
+  bool        gone = false;
+  if(fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SHM_HEADER))
+    {
+      void * base = mmap(nullptr, sizeof(SHM_HEADER), PROT_READ, MAP_SHARED, fd, 0);
+      if(base != MAP_FAILED)
+        {
+          const SHM_HEADER * h = (const SHM_HEADER*)base;
+          gone = h->magic == SHM_MAGIC && h->version == SHM_VERSION &&
+                 kill(h->writer, 0) != 0 && errno == ESRCH;
+          munmap(base, sizeof(SHM_HEADER));
+        }
+    }
+  close(fd);
+  return gone;
+}
+
+
+ShmWriter::ShmWriter(const char * n, size_t capacity, double sampleRate, double unitScale,
+                     const std::vector<std::string> & names)
+  : name(n)
+  , created(false)
+  , header(nullptr)
+  , data(nullptr)
+  , mapped(0)
+  , position(0)
+{
+  capacity = align8(capacity);
+  mapped   = sizeof(SHM_HEADER) + capacity;
+
+  int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if(fd < 0 && errno == EEXIST && abandoned(name.c_str()))
+    {
+      shm_unlink(name.c_str());
+      fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+  if(fd < 0)
+    {
+      if(errno == EEXIST)
+        printf("ShmWriter: %s is in use by another producer\n", name.c_str());
+      else
+        perror("ShmWriter: shm_open");
+      return;
+    }
+  created = true;
+  if(ftruncate(fd, mapped) != 0)
+    {
+      perror("ShmWriter: ftruncate");
+      close(fd);
+      return;
+    }
+  void * base = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(base == MAP_FAILED)
+    {
+      perror("ShmWriter: mmap");
+      return;
+    }
+
+  header = (SHM_HEADER*)base;
+  data   = (char*)base + sizeof(SHM_HEADER);
+
+  header->version    = SHM_VERSION;
+  header->capacity   = capacity;
+  header->sampleRate = sampleRate;
+  header->unitScale  = unitScale;
+  header->slots      = std::min<size_t>(names.size(), SHM_SLOTS);
+  header->writer     = getpid();
+  for(uint32_t s = 0; s < header->slots; s++)
+    strncpy(header->names[s], names[s].c_str(), SHM_NAME_LTH - 1);
+  header->head.store(0);
+  header->reserved.store(0);
+  header->sequence.store(0);
+  header->generation.store(0);
+  std::atomic_thread_fence(std::memory_order_release);
+  header->magic = SHM_MAGIC;
+}
+
+
+ShmWriter::~ShmWriter()
+{
+  if(header)
+    munmap(header, mapped);
+  if(created)
+    shm_unlink(name.c_str());
+}
+
+
+bool ShmWriter::ok()
+{
+  return header != nullptr;
+}
+
+
+// Records never wrap: when one does not fit before the end of the ring a
+// pad record fills the rest, or nothing if not even a record header fits,
+// and the record starts at offset 0. The region
+// is reserved before it is overwritten, so readers still holding a record
+// there can tell.
+char * ShmWriter::reserve(SHM_RECORD & record)
+{
+  size_t size     = sizeof(SHM_RECORD) + align8(record.bytes);
+  size_t capacity = header->capacity;
+  if(size > capacity/2)
+    return nullptr;
+
+  size_t offset = position % capacity;
+  if(offset + size > capacity)
+    {
+      header->reserved.store(position + capacity - offset, std::memory_order_release);
+      if(capacity - offset >= sizeof(SHM_RECORD))
+        {
+          SHM_RECORD pad = {};
+          pad.type  = SHM_PAD;
+          pad.bytes = capacity - offset - sizeof(SHM_RECORD);
+          memcpy(data + offset, &pad, sizeof(SHM_RECORD));
+        }
+      position += capacity - offset;
+      header->head.store(position, std::memory_order_release);
+      offset = 0;
+    }
+
+  header->reserved.store(position + size, std::memory_order_release);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  record.sequence = header->sequence.fetch_add(1) + 1;
+  return data + offset;
+}
+
+
+void ShmWriter::commit(const SHM_RECORD & record)
+{
+  position += sizeof(SHM_RECORD) + align8(record.bytes);
+  header->head.store(position, std::memory_order_release);
+}
+
+
+// Every stream start; the block sample indices restart at 0.
+void ShmWriter::start_stream(double sampleRate)
+{
+  if(!header)
+    return;
+  header->sampleRate = sampleRate;
+  header->generation.fetch_add(1, std::memory_order_release);
+}
+
+
+// count samples of every non-null slot block
+void ShmWriter::publish_block(uint64_t first, const double * const * slot, int slots, int count)
+{
+  if(!header)
+    return;
+
+  SHM_RECORD record = {};
+  record.type  = SHM_BLOCK;
+  record.first = first;
+  record.count = count;
+  record.rows  = 1;
+  int present  = 0;
+  for(int s = 0; s < std::min(slots, SHM_SLOTS); s++)
+    if(slot[s])
+      {
+        record.mask |= 1ull << s;
+        present++;
+      }
+  record.bytes = present*count*sizeof(float);
+
+  char * out = reserve(record);
+  if(!out)
+    return;
+
+  float * values = (float*)(out + sizeof(SHM_RECORD));
+  for(int s = 0; s < std::min(slots, SHM_SLOTS); s++)
+    if(slot[s])
+      for(int i = 0; i < count; i++)
+        *values++ = (float)slot[s][i];
+  memcpy(out, &record, sizeof(SHM_RECORD));
+  commit(record);
+}
+
+
+void ShmWriter::publish_frame(uint64_t number, const double * frame, int width, int height)
+{
+  if(!header)
+    return;
+
+  SHM_RECORD record = {};
+  record.type  = SHM_FRAME;
+  record.first = number;
+  record.count = width;
+  record.rows  = height;
+  record.bytes = width*height*sizeof(float);
+
+  char * out = reserve(record);
+  if(!out)
+    return;
+
+  float * values = (float*)(out + sizeof(SHM_RECORD));
+  for(int i = 0; i < width*height; i++)
+    values[i] = (float)frame[i];
+  memcpy(out, &record, sizeof(SHM_RECORD));
+  commit(record);
+}
+
+
+
+ShmReader::ShmReader(const char * name)
+  : fd(-1)
+  , header(nullptr)
+  , data(nullptr)
+  , mapped(0)
+  , position(0)
+  , current(0)
+  , skipped(0)
+{
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0)
+    return;
+
+  struct stat st;
+  if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SHM_HEADER))
+    return;
+  void * base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if(base == MAP_FAILED)
+    return;
+
+  header = (const SHM_HEADER*)base;
+  data   = (const char*)base + sizeof(SHM_HEADER);
+  mapped = st.st_size;
+  if(header->magic != SHM_MAGIC || header->version != SHM_VERSION)
+    {
+      munmap(base, mapped);
+      header = nullptr;
+      return;
+    }
+
+  // start with the newest data
+  position = header->head.load(std::memory_order_acquire);
+  current  = position;
+}
+
+
+ShmReader::~ShmReader()
+{
+  if(header)
+    munmap((void*)header, mapped);
+  if(fd >= 0)
+    close(fd);
+}
+
+
+bool ShmReader::ok()
+{
+  return header != nullptr;
+}
+
+
+const SHM_HEADER * ShmReader::info()
+{
+  return header;
+}
+
+
+uint64_t ShmReader::lost()
+{
+  return skipped;
+}
+
+
+// True while the record handed out last has not been overwritten.
+bool ShmReader::still_valid()
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return header->reserved.load(std::memory_order_acquire) - current <= header->capacity;
+}
+
+
+// Returns false when nothing new is there. A reader that was lapped jumps
+// to the newest head and counts the skipped bytes.
+bool ShmReader::next(const SHM_RECORD ** record, const float ** payload)
+{
+  while(true)
+    {
+      uint64_t head     = header->head.load(std::memory_order_acquire);
+      uint64_t capacity = header->capacity;
+
+      if(header->reserved.load(std::memory_order_acquire) - position > capacity)
+        {
+          skipped += head - position;
+          position = head;
+        }
+      if(position >= head)
+        return false;
+      if(capacity - position % capacity < sizeof(SHM_RECORD))
+        {
+          position += capacity - position % capacity;
+          continue;
+        }
+
+      current = position;
+      const SHM_RECORD * r = (const SHM_RECORD*)(data + current % capacity);
+      uint32_t type  = r->type;
+      uint32_t bytes = r->bytes;
+      if(!still_valid())
+        continue;
+
+      position += sizeof(SHM_RECORD) + align8(bytes);
+      if(type == SHM_PAD)
+        continue;
+
+      *record  = r;
+      *payload = (const float*)(r + 1);
+      return true;
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+#define SHM_MAGIC     0x4c503430u      // "LP40"
+#define SHM_VERSION   3
+#define SHM_SLOTS     64
+#define SHM_NAME_LTH  16
+
+
+
+typedef enum
+  {
+    SHM_PAD, SHM_BLOCK, SHM_FRAME
+  }SHM_RECORD_TYPE;
+
+
+// Start of the shared object, followed by the data ring. head is the total
+// number of bytes ever committed and reserved the end of the region being
+// written; a record at stream offset p lives at data[p % capacity] and is
+// intact as long as reserved - p <= capacity. generation counts the
+// streams; sampleRate is rewritten before it changes, and sample indices
+// restart with it.
+typedef struct
+{
+  uint32_t                  magic;
+  uint32_t                  version;
+  uint64_t                  capacity;
+  double                    sampleRate;       // samples per second of SHM_BLOCK data
+  double                    unitScale;        // volts per stored unit
+  uint32_t                  slots;
+  int32_t                   writer;           // pid of the producer
+  char                      names[SHM_SLOTS][SHM_NAME_LTH];
+  std::atomic<uint64_t>     head;
+  std::atomic<uint64_t>     reserved;
+  std::atomic<uint64_t>     sequence;
+  std::atomic<uint64_t>     generation;
+}SHM_HEADER;
+
+
+// Every record starts on an 8 byte boundary; a tail of the ring too short
+// for a record header holds nothing and the next record starts at offset
+// 0. SHM_BLOCK payloads are
+// count floats per slot in mask order, SHM_FRAME payloads are width x
+// height floats, row 0 first.
+typedef struct
+{
+  uint64_t                  sequence;
+  uint64_t                  first;            // sample index of a block, frame number of a frame
+  uint64_t                  mask;             // slots present in a block
+  uint32_t                  type;
+  uint32_t                  bytes;            // payload size
+  uint32_t                  count;            // samples per slot, or frame width
+  uint32_t                  rows;             // 1, or frame height
+}SHM_RECORD;
+
+
+
+// Single producer side of a shared memory ring. Writes never wait for
+// readers; a reader that falls more than a ring behind notices it from
+// head and resynchronises. The writer only ever removes a ring it created
+// itself, or one whose producer is gone.
+class ShmWriter
+{
+public:
+                            ShmWriter(const char *, size_t, double, double, const std::vector<std::string> &);
+                            ~ShmWriter();
+
+  bool                      ok();
+  void                      start_stream(double);
+  void                      publish_block(uint64_t, const double * const *, int, int);
+  void                      publish_frame(uint64_t, const double *, int, int);
+
+private:
+  char *                    reserve(SHM_RECORD &);
+  void                      commit(const SHM_RECORD &);
+
+  std::string               name;
+  bool                      created;
+  SHM_HEADER *              header;
+  char *                    data;
+  size_t                    mapped;
+  uint64_t                  position;
+};
+
+
+
+// Attaches read-only to a ring. next() hands out records in place; the
+// payload pointer stays valid until still_valid() says otherwise.
+class ShmReader
+{
+public:
+                            ShmReader(const char *);
+                            ~ShmReader();
+
+  bool                      ok();
+  const SHM_HEADER *        info();
+  bool                      next(const SHM_RECORD **, const float **);
+  bool                      still_valid();
+  uint64_t                  lost();
+
+private:
+  int                       fd;
+  const SHM_HEADER *        header;
+  const char *              data;
+  size_t                    mapped;
+  uint64_t                  position;
+  uint64_t                  current;
+  uint64_t                  skipped;
+};
+
+
+#endif //SHMRING_H
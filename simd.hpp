@@ -0,0 +1,256 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+
+
+// Block kernels shared by the processing stages. AVX is used when the
+// compiler targets it, SSE2 otherwise (always present on x86_64), with a
+// plain loop as fallback.
+
+
+inline double simd_dot(const double * a, const double * b, int n)
+{
+  int     i   = 0;
+  double  sum = 0.0;
+
+#if defined(__AVX__)
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  for(; i + 8 <= n; i += 8)
+    {
+      acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a+i),   _mm256_loadu_pd(b+i)));
+      acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a+i+4), _mm256_loadu_pd(b+i+4)));
+    }
+  acc0 = _mm256_add_pd(acc0, acc1);
+  __m128d acc = _mm_add_pd(_mm256_castpd256_pd128(acc0), _mm256_extractf128_pd(acc0, 1));
+  sum = _mm_cvtsd_f64(_mm_add_sd(acc, _mm_unpackhi_pd(acc, acc)));
+#elif defined(__SSE2__)
+  __m128d acc0 = _mm_setzero_pd();
+  __m128d acc1 = _mm_setzero_pd();
+  for(; i + 4 <= n; i += 4)
+    {
+      acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a+i),   _mm_loadu_pd(b+i)));
+      acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a+i+2), _mm_loadu_pd(b+i+2)));
+    }
+  acc0 = _mm_add_pd(acc0, acc1);
+  sum = _mm_cvtsd_f64(_mm_add_sd(acc0, _mm_unpackhi_pd(acc0, acc0)));
+#endif
+
+  for(; i < n; i++)
+    sum += a[i]*b[i];
+  return sum;
+}
+
+
+// out[i] = in[i] * scale, converting raw ADC counts to volts.
+inline void simd_scale_int16(const int16_t * in, int n, double scale, double * out)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128d s = _mm_set1_pd(scale);
+  for(; i + 4 <= n; i += 4)
+    {
+      __m128i raw = _mm_loadl_epi64((const __m128i *)(in+i));
+      __m128i ext = _mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16);
+      _mm_storeu_pd(out+i,   _mm_mul_pd(_mm_cvtepi32_pd(ext), s));
+      _mm_storeu_pd(out+i+2, _mm_mul_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(ext, ext)), s));
+    }
+#endif
+
+  for(; i < n; i++)
+    out[i] = (double)in[i]*scale;
+}
+
+
+// Sum, sum of squares, minimum and maximum of a block in one pass.
+inline void simd_moments(const double * x, int n, double * sum, double * sumsq, double * min, double * max)
+{
+  int     i  = 0;
+  double  s  = 0.0, q = 0.0;
+  double  lo = n ? x[0] : 0.0, hi = lo;
+
+#if defined(__SSE2__)
+  if(n >= 2)
+    {
+      __m128d vs = _mm_setzero_pd(), vq = _mm_setzero_pd();
+      __m128d vlo = _mm_loadu_pd(x), vhi = vlo;
+      for(; i + 2 <= n; i += 2)
+        {
+          __m128d v = _mm_loadu_pd(x+i);
+          vs  = _mm_add_pd(vs, v);
+          vq  = _mm_add_pd(vq, _mm_mul_pd(v, v));
+          vlo = _mm_min_pd(vlo, v);
+          vhi = _mm_max_pd(vhi, v);
+        }
+      double t[2];
+      _mm_storeu_pd(t, vs);  s  = t[0] + t[1];
+      _mm_storeu_pd(t, vq);  q  = t[0] + t[1];
+      _mm_storeu_pd(t, vlo); lo = t[0] < t[1] ? t[0] : t[1];
+      _mm_storeu_pd(t, vhi); hi = t[0] > t[1] ? t[0] : t[1];
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      s += x[i];
+      q += x[i]*x[i];
+      lo = x[i] < lo ? x[i] : lo;
+      hi = x[i] > hi ? x[i] : hi;
+    }
+
+  *sum   = s;
+  *sumsq = q;
+  *min   = lo;
+  *max   = hi;
+}
+
+
+// Exponentially weighted mean/variance update with weight a; a = 1/k gives
+// the plain mean and population variance of k records.
+inline void simd_ensemble_update(const double * x, int n, double a, double * mean, double * var)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128d va = _mm_set1_pd(a);
+  __m128d vb = _mm_set1_pd(1.0 - a);
+  for(; i + 2 <= n; i += 2)
+    {
+      __m128d m = _mm_loadu_pd(mean+i);
+      __m128d d = _mm_sub_pd(_mm_loadu_pd(x+i), m);
+      __m128d v = _mm_add_pd(_mm_loadu_pd(var+i), _mm_mul_pd(va, _mm_mul_pd(d, d)));
+      _mm_storeu_pd(mean+i, _mm_add_pd(m, _mm_mul_pd(va, d)));
+      _mm_storeu_pd(var+i, _mm_mul_pd(vb, v));
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      double d = x[i] - mean[i];
+      mean[i] += a*d;
+      var[i]   = (1.0 - a)*(var[i] + a*d*d);
+    }
+}
+
+
+// out[i] = lut[clamp((v[i] - lo)*scale, 0, last)], colour mapping through a
+// gradient table. NaN maps to entry 0.
+inline void simd_lut_map(const float * v, int n, float lo, float scale, int last, const uint32_t * lut, uint32_t * out)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128  l  = _mm_set1_ps(lo);
+  __m128  k  = _mm_set1_ps(scale);
+  __m128  z  = _mm_setzero_ps();
+  __m128  hi = _mm_set1_ps((float)last);
+  alignas(16) int32_t index[4];
+  for(; i + 4 <= n; i += 4)
+    {
+      __m128 f = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v+i), l), k);
+      f = _mm_min_ps(_mm_max_ps(f, z), hi);
+      _mm_store_si128((__m128i *)index, _mm_cvttps_epi32(f));
+      out[i]   = lut[index[0]];
+      out[i+1] = lut[index[1]];
+      out[i+2] = lut[index[2]];
+      out[i+3] = lut[index[3]];
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      float f = (v[i] - lo)*scale;
+      out[i] = lut[f > 0.0f ? (f < (float)last ? (int)f : last) : 0];
+    }
+}
+
+
+// out[i] = lut at (v[i] - lo)*scale, linearly interpolated between the
+// entries; v[i] outside [lo, lo + last/scale] and NaN give NaN. The table
+// has last + 2 entries, the final one a guard equal to lut[last].
+inline void simd_lut_lerp(const double * v, int n, double lo, double scale, int last, const double * lut, double * out)
+{
+  int i = 0;
+
+#if defined(__SSE2__)
+  __m128d l   = _mm_set1_pd(lo);
+  __m128d k   = _mm_set1_pd(scale);
+  __m128d z   = _mm_setzero_pd();
+  __m128d hi  = _mm_set1_pd((double)last);
+  __m128d nan = _mm_set1_pd(NAN);
+  alignas(16) int32_t index[4];
+  for(; i + 2 <= n; i += 2)
+    {
+      __m128d t      = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(v+i), l), k);
+      __m128d inside = _mm_and_pd(_mm_cmpge_pd(t, z), _mm_cmple_pd(t, hi));
+      t = _mm_min_pd(_mm_max_pd(t, z), hi);
+      __m128i j = _mm_cvttpd_epi32(t);
+      __m128d f = _mm_sub_pd(t, _mm_cvtepi32_pd(j));
+      _mm_store_si128((__m128i *)index, j);
+      __m128d a = _mm_set_pd(lut[index[1]],     lut[index[0]]);
+      __m128d b = _mm_set_pd(lut[index[1] + 1], lut[index[0] + 1]);
+      __m128d r = _mm_add_pd(a, _mm_mul_pd(f, _mm_sub_pd(b, a)));
+      _mm_storeu_pd(out+i, _mm_or_pd(_mm_and_pd(inside, r), _mm_andnot_pd(inside, nan)));
+    }
+#endif
+
+  for(; i < n; i++)
+    {
+      double t = (v[i] - lo)*scale;
+      if(!(t >= 0.0 && t <= (double)last))
+        {
+          out[i] = NAN;
+          continue;
+        }
+      int    j = (int)t;
+      out[i] = lut[j] + (t - j)*(lut[j+1] - lut[j]);
+    }
+}
+
+
+// Zigzag coded prediction residuals of a block of ADC counts, with a fixed
+// polynomial predictor of the given order (0, 1 or 2). The first samples
+// fall back to the lower orders, so a block decodes on its own.
+inline void simd_residual_zigzag(const int16_t * x, int n, int order, uint32_t * out)
+{
+  auto zigzag = [](int32_t r) { return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31); };
+
+  int i = 0;
+  for(; i < order && i < n; i++)
+    out[i] = zigzag(i == 0 ? x[0] : x[1] - x[0]);
+
+#if defined(__SSE2__)
+  auto widen = [](const int16_t * p)
+  {
+    __m128i v = _mm_loadl_epi64((const __m128i *)p);
+    return _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+  };
+  for(; i + 4 <= n; i += 4)
+    {
+      __m128i r = widen(x+i);
+      if(order == 1)
+        r = _mm_sub_epi32(r, widen(x+i-1));
+      else if(order == 2)
+        {
+          __m128i p = widen(x+i-1);
+          r = _mm_add_epi32(_mm_sub_epi32(r, _mm_add_epi32(p, p)), widen(x+i-2));
+        }
+      r = _mm_xor_si128(_mm_slli_epi32(r, 1), _mm_srai_epi32(r, 31));
+      _mm_storeu_si128((__m128i *)(out+i), r);
+    }
+#endif
+
+  for(; i < n; i++)
+    out[i] = zigzag(order == 0 ? x[i] : order == 1 ? x[i] - x[i-1] : x[i] - 2*x[i-1] + x[i-2]);
+}
+
+
+#endif //SIMD_H
@@ -0,0 +1,75 @@
+#include "spectrum.hpp"
+#include <algorithm>
+#include <cmath>
+
+
+Spectrum::Spectrum(int size)
+{
+  n = 2;
+  while(2*n <= size)
+    n *= 2;
+
+  int bits = 0;
+  while((1 << bits) < n)
+    bits++;
+
+  window.resize(n);
+  reversed.resize(n);
+  twiddle.resize(n/2);
+  buffer.resize(n);
+  double sum = 0.0;
+  for(int i = 0; i < n; i++)
+    {
+      window[i] = 0.5 - 0.5*std::cos(2.0*M_PI*i/n);
+      sum      += window[i];
+      int r = 0;
+      for(int b = 0; b < bits; b++)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      reversed[i] = r;
+    }
+  for(int k = 0; k < n/2; k++)
+    twiddle[k] = std::polar(1.0, -2.0*M_PI*k/n);
+  gain = 2.0/sum;
+}
+
+
+int Spectrum::size()
+{
+  return n;
+}
+
+
+// size() samples in; frequencies in Hz and amplitudes in dB of the input
+// unit out, for the n/2 + 1 bins from DC to Nyquist.
+void Spectrum::process(const double * in, double sampleRate, std::vector<double> & freq, std::vector<double> & db)
+{
+  double mean = 0.0;
+  for(int i = 0; i < n; i++)
+    mean += in[i];
+  mean /= n;
+
+  for(int i = 0; i < n; i++)
+    buffer[reversed[i]] = (in[i] - mean)*window[i];
+
+  for(int len = 2; len <= n; len *= 2)
+    {
+      int step = n/len;
+      for(int start = 0; start < n; start += len)
+        for(int k = 0; k < len/2; k++)
+          {
+            std::complex<double> a = buffer[start + k];
+            std::complex<double> b = buffer[start + k + len/2]*twiddle[k*step];
+            buffer[start + k]         = a + b;
+            buffer[start + k + len/2] = a - b;
+          }
+    }
+
+  freq.resize(n/2 + 1);
+  db.resize(n/2 + 1);
+  for(int k = 0; k <= n/2; k++)
+    {
+      double a = std::abs(buffer[k])*(k == 0 || k == n/2 ? gain/2.0 : gain);
+      freq[k]  = k*sampleRate/n;
+      db[k]    = 20.0*std::log10(std::max(a, 1.0e-12));
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <complex>
+#include <vector>
+
+
+
+// Amplitude spectrum of a block of samples, mean removed and Hann
+// windowed, by an in place radix-2 FFT. The size is rounded down to a
+// power of two; window, twiddles and bit reversal are set up once.
+class Spectrum
+{
+public:
+                            Spectrum(int);
+
+  int                       size();
+  void                      process(const double *, double, std::vector<double> &, std::vector<double> &);
+
+private:
+  int                                 n;
+  double                              gain;
+  std::vector<double>                 window;
+  std::vector<int>                    reversed;
+  std::vector<std::complex<double>>   twiddle;
+  std::vector<std::complex<double>>   buffer;
+};
+
+
+#endif //SPECTRUM_H
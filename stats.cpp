@@ -0,0 +1,177 @@
+#include "stats.hpp"
+#include "simd.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+
+static const SUMMARY empty_summary = {0, 0.0, 0.0, INFINITY, -INFINITY, 0, 0, 0};
+
+
+Measurement::Measurement(double fs, double seconds)
+  : sampleRate(fs)
+  , segmentLength(std::max(64, (int)(fs/100.0)))
+{
+  reset();
+  set_window(seconds);
+}
+
+
+void Measurement::reset()
+{
+  current      = empty_summary;
+  window       = empty_summary;
+  total        = empty_summary;
+  segmentIndex = 0;
+  state        = false;
+  sampleIndex  = 0;
+  lastEdge     = -1;
+  level        = 0.0;
+  hysteresis   = 0.0;
+  segments.clear();
+  minQueue.clear();
+  maxQueue.clear();
+}
+
+
+void Measurement::set_window(double seconds)
+{
+  windowSegments = std::max(1, (int)(seconds*sampleRate/segmentLength));
+  trim();
+}
+
+
+// drops the segments that left the window of windowSegments
+void Measurement::trim()
+{
+  while((int)segments.size() > windowSegments)
+    {
+      SUMMARY & s = segments.front();
+      window.count         -= s.count;
+      window.sum           -= s.sum;
+      window.sumsq         -= s.sumsq;
+      window.high          -= s.high;
+      window.periods       -= s.periods;
+      window.periodSamples -= s.periodSamples;
+      segments.pop_front();
+    }
+  while(!minQueue.empty() && minQueue.front().first < segmentIndex - windowSegments)
+    minQueue.pop_front();
+  while(!maxQueue.empty() && maxQueue.front().first < segmentIndex - windowSegments)
+    maxQueue.pop_front();
+}
+
+
+void Measurement::add(SUMMARY * to, const SUMMARY & s)
+{
+  to->count         += s.count;
+  to->sum           += s.sum;
+  to->sumsq         += s.sumsq;
+  to->min            = std::min(to->min, s.min);
+  to->max            = std::max(to->max, s.max);
+  to->high          += s.high;
+  to->periods       += s.periods;
+  to->periodSamples += s.periodSamples;
+}
+
+
+// Moments of each chunk come from one SIMD pass; only the trigger, which
+// needs the previous sample's state, runs sample by sample.
+void Measurement::process(const double * x, int n)
+{
+  int i = 0;
+  while(i < n)
+    {
+      int chunk = std::min(n - i, (int)(segmentLength - current.count));
+
+      double sum, sumsq, min, max;
+      simd_moments(x+i, chunk, &sum, &sumsq, &min, &max);
+      current.count += chunk;
+      current.sum   += sum;
+      current.sumsq += sumsq;
+      current.min    = std::min(current.min, min);
+      current.max    = std::max(current.max, max);
+
+      for(int j = i; j < i + chunk; j++)
+        {
+          if(!state && x[j] > level + hysteresis)
+            {
+              state = true;
+              if(lastEdge >= 0)
+                {
+                  current.periods++;
+                  current.periodSamples += sampleIndex + (j-i) - lastEdge;
+                }
+              lastEdge = sampleIndex + (j-i);
+            }
+          else if(state && x[j] < level - hysteresis)
+            state = false;
+          current.high += state;
+        }
+
+      sampleIndex += chunk;
+      i           += chunk;
+
+      if(current.count == segmentLength)
+        close_segment();
+    }
+}
+
+
+void Measurement::close_segment()
+{
+  add(&window, current);
+  add(&total, current);
+  segments.push_back(current);
+
+  while(!minQueue.empty() && minQueue.back().second >= current.min)
+    minQueue.pop_back();
+  minQueue.push_back({segmentIndex, current.min});
+  while(!maxQueue.empty() && maxQueue.back().second <= current.max)
+    maxQueue.pop_back();
+  maxQueue.push_back({segmentIndex, current.max});
+
+  segmentIndex++;
+  trim();
+
+  // the trigger level follows the middle of the windowed signal range
+  double lo = minQueue.front().second;
+  double hi = maxQueue.front().second;
+  level      = (hi + lo)/2.0;
+  hysteresis = (hi - lo)*0.05;
+
+  current = empty_summary;
+}
+
+
+static void fill(const SUMMARY & s, double sampleRate, double * out)
+{
+  if(s.count == 0)
+    {
+      std::fill(out, out + M_VALUES, 0.0);
+      return;
+    }
+  out[M_MEAN] = s.sum/s.count;
+  out[M_RMS]  = std::sqrt(s.sumsq/s.count);
+  out[M_MIN]  = s.min;
+  out[M_MAX]  = s.max;
+  out[M_PP]   = s.max - s.min;
+  out[M_FREQ] = s.periodSamples ? s.periods*sampleRate/s.periodSamples : 0.0;
+  out[M_DUTY] = (double)s.high/s.count;
+}
+
+
+// Both result arrays hold M_VALUES entries; the window includes the
+// segment still being filled.
+void Measurement::results(double * windowed, double * since_start)
+{
+  SUMMARY w = window;
+  w.min = minQueue.empty() ? INFINITY : minQueue.front().second;
+  w.max = maxQueue.empty() ? -INFINITY : maxQueue.front().second;
+  add(&w, current);
+  fill(w, sampleRate, windowed);
+
+  SUMMARY t = total;
+  add(&t, current);
+  fill(t, sampleRate, since_start);
+}
@@ -0,0 +1,70 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+
+
+typedef enum
+  {
+    M_MEAN, M_RMS, M_MIN, M_MAX, M_PP, M_FREQ, M_DUTY, M_VALUES
+  }MEASUREMENT;
+
+
+// Summary of a run of samples. Everything except min/max can be added and
+// subtracted, which is what makes the sliding window O(1).
+typedef struct
+{
+  int64_t                   count;
+  double                    sum;
+  double                    sumsq;
+  double                    min;
+  double                    max;
+  int64_t                   high;         // samples above the trigger level
+  int64_t                   periods;      // complete periods ending in this run
+  int64_t                   periodSamples;
+}SUMMARY;
+
+
+
+// Incremental statistics of one channel over a sliding window and since
+// the start of the stream. Only per-segment summaries are kept, never the
+// raw samples.
+class Measurement
+{
+public:
+                            Measurement(double, double);
+
+  void                      process(const double *, int);
+  void                      results(double *, double *);
+  void                      set_window(double);
+  void                      reset();
+
+private:
+  void                      close_segment();
+  void                      trim();
+  void                      add(SUMMARY *, const SUMMARY &);
+
+  double                    sampleRate;
+  int                       segmentLength;
+  int                       windowSegments;
+
+  SUMMARY                   current;
+  SUMMARY                   window;
+  SUMMARY                   total;
+  std::deque<SUMMARY>       segments;
+  int64_t                   segmentIndex;
+  std::deque<std::pair<int64_t,double>>  minQueue;
+  std::deque<std::pair<int64_t,double>>  maxQueue;
+
+  bool                      state;
+  int64_t                   sampleIndex;
+  int64_t                   lastEdge;
+  double                    level;
+  double                    hysteresis;
+};
+
+
+#endif //STATS_H
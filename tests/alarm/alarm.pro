@@ -0,0 +1,9 @@
+CONFIG -= qt
+CONFIG += console c++17
+TEMPLATE = app
+TARGET = alarm_test
+INCLUDEPATH += ../../
+
+# Input
+HEADERS += ../../alarm.hpp ../../simd.hpp
+SOURCES += alarm_test.cpp ../../alarm.cpp
@@ -0,0 +1,108 @@
+#include "alarm.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+#define RATE  1000.0      // samples per second
+#define BLOCK 1000
+
+
+static int failures = 0;
+
+
+static void check(bool ok, const char * what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+
+// the stream sample of the n-th event of a rule that raised or cleared, -1 if none
+static long long event(const std::vector<ALARM_EVENT> & events, int rule, bool raised, int n = 0)
+{
+  for(auto & e: events)
+    if(e.rule == rule && e.raised == raised && n-- == 0)
+      return (long long)e.sample;
+  return -1;
+}
+
+
+static ALARM_RULE rule(const char * source, ALARM_KIND kind, double level, double hold, double hysteresis)
+{
+  ALARM_RULE r;
+  r.name       = source;
+  r.source     = source;
+  r.kind       = kind;
+  r.level      = level;
+  r.upper      = level;
+  r.hold       = hold;
+  r.hysteresis = hysteresis;
+  r.enabled    = true;
+  return r;
+}
+
+
+int main()
+{
+  AlarmMonitor monitor;
+  monitor.start(RATE, {"z0", "z1"});
+  monitor.set_rules({rule("z0", AL_ABOVE, 1000.0, 0.01, 100.0),
+                     rule("z1", AL_RATE, 1500.0, 0.0, 0.0),
+                     rule("z0 + z1", AL_ABOVE, 1400.0, 0.0, 0.0)});
+
+  // z0 steps to 1.5 V, back to 950 mV and 850 mV; z1 ramps at 2 V/s from 500
+  std::vector<double> z0(BLOCK), z1(BLOCK);
+  for(int i = 0; i < BLOCK; i++)
+    {
+      z0[i] = i < 400 ? 0.0 : i < 700 ? 1500.0 : i < 800 ? 950.0 : 850.0;
+      z1[i] = i < 500 ? 0.0 : 2.0*(i - 500);
+    }
+  const double *           block[2] = {z0.data(), z1.data()};
+  std::vector<ALARM_EVENT> events;
+  monitor.process(block, 2, BLOCK, 0, events);
+
+  check(event(events, 0, true) == 400, "a 1000 mV level trips at the step to 1500 mV");
+  for(auto & e: events)
+    if(e.rule == 0 && e.raised)
+      check(e.detected == 409, "and is recognised after the 10 ms hold");
+  check(event(events, 0, false) == 800, "it clears only below the hysteresis, not at 950 mV");
+  check(event(events, 1, true) == 501, "a 1500 mV/s rate trips on a 2000 mV/s ramp");
+  check(event(events, 2, true) == 400 && event(events, 2, false) == 700 && event(events, 2, true, 1) == 726,
+        "an expression rule follows the sum of its slots");
+
+  // a quiet block for the level rule; the ramp stops
+  std::fill(z0.begin(), z0.end(), 0.0);
+  std::fill(z1.begin(), z1.end(), 1000.0);
+  events.clear();
+  monitor.process(block, 2, BLOCK, BLOCK, events);
+  check(event(events, 0, true) < 0 && event(events, 0, false) < 0, "a block inside the limit raises nothing");
+  check(event(events, 1, false) == BLOCK + 1, "the rate clears once the ramp has stopped");
+  check(event(events, 2, false) == BLOCK, "the expression clears at the first sample of the block");
+
+  // a source chattering across a limit without hysteresis
+  {
+    AlarmMonitor chatter;
+    chatter.start(RATE, {"z0"});
+    chatter.set_rules({rule("z0", AL_ABOVE, 1000.0, 0.0, 0.0)});
+    std::vector<double> z(BLOCK);
+    for(int i = 0; i < BLOCK; i++)
+      z[i] = i < 900 ? (i%2 ? 500.0 : 1500.0) : 1500.0;
+    const double *           slot = z.data();
+    std::vector<ALARM_EVENT> chattered;
+    chatter.process(&slot, 1, BLOCK, 0, chattered);
+    check(chattered.size() < 100, "a burst of transitions is cut short");
+    check(!chattered.empty() && chattered.back().raised && chattered.back().sample == 900,
+          "but the last event still carries the final state");
+
+    for(int i = 0; i < BLOCK; i++)
+      z[i] = i < 900 ? (i%2 ? 1500.0 : 500.0) : 500.0;
+    chattered.clear();
+    chatter.process(&slot, 1, BLOCK, BLOCK, chattered);
+    check(!chattered.empty() && !chattered.back().raised, "also when it ends cleared");
+  }
+
+  printf(failures ? "%d failed\n" : "all passed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,9 @@
+CONFIG -= qt
+CONFIG += console c++17
+TEMPLATE = app
+TARGET = history_test
+INCLUDEPATH += ../../
+
+# Input
+HEADERS += ../../history.hpp
+SOURCES += history_test.cpp ../../history.cpp
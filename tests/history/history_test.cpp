@@ -0,0 +1,144 @@
+#include "history.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+#define SLOTS   28
+#define SAMPLES (20LL << 20)
+#define COLUMNS 1000
+#define STEP    (1000.0/32767.0)      // mV per count of the 1 V range
+
+
+static int failures = 0;
+
+
+static void check(bool ok, const char * what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+
+// a sawtooth of ADC codes on slot 0, a slow sine on slot 1, the rest unused
+static int16_t code(long long i)
+{
+  return (int16_t)(i%60000 - 30000);
+}
+
+
+static void sample(long long i, double * v)
+{
+  for(int s = 0; s < SLOTS; s++)
+    v[s] = 0.0;
+  v[0] = code(i)*STEP;
+  v[1] = std::sin(i*1.0e-4);
+}
+
+
+int main()
+{
+  char dir[] = "/var/tmp/history-test-XXXXXX";
+  if(!mkdtemp(dir))
+    {
+      perror("mkdtemp");
+      return 1;
+    }
+
+  std::vector<double> v(SLOTS);
+
+  // input slots keep their ADC codes, lazily allocated slots cost nothing
+  {
+    History history(SLOTS, 1 << 16);
+    history.set_scale(0, STEP);
+    for(long long i = 0; i < 8*HISTORY_SEGMENT; i++)
+      {
+        sample(i, v.data());
+        history.append(v.data());
+      }
+    bool exact = true;
+    for(long long i = 0; i < 8*HISTORY_SEGMENT; i++)
+      exact &= std::lrint(history.value(0, i)/STEP) == code(i);
+    check(exact, "ADC codes come back unchanged");
+    check(history.bytes() < (size_t)3*(1 << 16)*sizeof(int16_t) + (size_t)SLOTS*(64*sizeof(float) + HISTORY_SEGMENT*sizeof(double)),
+          "only the two written slots are allocated");
+  }
+
+  // 20M samples of 28 slots through the spill, then one zoomed out view
+  {
+    History history(SLOTS, 1 << 20, dir, (size_t)2048 << 20);
+    history.set_scale(0, STEP);
+    for(long long i = 0; i < SAMPLES; i++)
+      {
+        sample(i, v.data());
+        history.append(v.data());
+      }
+    check(history.first() == 0, "the whole run is reachable");
+    check(std::lrint(history.value(0, 12345)/STEP) == code(12345), "an early sample reads back from the spill");
+
+    std::vector<double> keys, values;
+    auto start = std::chrono::steady_clock::now();
+    history.envelope(0, 0, history.count(), COLUMNS, keys, values);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("      envelope of %lld samples into %d columns: %.1f ms\n", history.count(), COLUMNS, ms);
+
+    double lo = INFINITY, hi = -INFINITY;
+    for(double x: values)
+      {
+        lo = std::min(lo, x);
+        hi = std::max(hi, x);
+      }
+    check(keys.size() == 2*COLUMNS, "two points per column");
+    check(std::fabs(lo + 30000*STEP) < 0.01 && std::fabs(hi - 29999*STEP) < 0.01, "the envelope spans the sawtooth");
+    check(ms < 100.0, "the envelope only touches the summary index");
+  }
+
+  // a spill limit turns the files into a ring
+  {
+    size_t    limit = (size_t)64 << 20;
+    History   history(SLOTS, 1 << 16, dir, limit);
+    long long n     = 4*(long long)(limit/((size_t)SLOTS*HISTORY_SEGMENT*sizeof(int16_t)))*HISTORY_SEGMENT;
+    history.set_scale(0, STEP);
+    for(long long i = 0; i < n; i++)
+      {
+        sample(i, v.data());
+        history.append(v.data());
+      }
+    check(history.spilled() <= limit, "the spill stays within its limit");
+    check(history.first() > 0, "the oldest spilled segments were overwritten");
+    long long f = history.first();
+    check(std::lrint(history.value(0, f)/STEP) == code(f), "the oldest kept sample is intact");
+
+    history.set_spill_limit(limit/2);
+    check(history.spilled() == 0 && history.first() == history.count() - history.count()%HISTORY_SEGMENT - (1 << 16),
+          "shrinking the limit drops the spilled past");
+  }
+
+  // a thinned sample is held for the samples it stands for
+  {
+    History history(SLOTS, 1 << 16, dir);
+    history.set_scale(0, STEP);
+    for(long long i = 0; i < 1000; i++)
+      {
+        sample(i, v.data());
+        history.append(v.data());
+      }
+    for(long long i = 1000; i < 1000 + 16*100; i += 16)
+      {
+        sample(i, v.data());
+        history.append(v.data(), 16);
+      }
+    check(history.count() == 1000 + 16*100, "held samples keep the stream's index");
+    check(std::lrint(history.value(0, 1000 + 16*7 + 5)/STEP) == code(1000 + 16*7), "a held sample repeats the one sent");
+    check(!history.thinned(0, 1000), "acquired samples are not marked");
+    check(history.thinned(1500, 1600), "held samples are marked");
+  }
+
+  rmdir(dir);
+  printf(failures ? "%d failed\n" : "all passed\n", failures);
+  return failures ? 1 : 0;
+}
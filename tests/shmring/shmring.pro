@@ -0,0 +1,10 @@
+CONFIG -= qt
+CONFIG += console c++17
+TEMPLATE = app
+TARGET = shmring_test
+INCLUDEPATH += ../../
+LIBS += -lrt
+
+# Input
+HEADERS += ../../shmring.hpp
+SOURCES += shmring_test.cpp ../../shmring.cpp
@@ -0,0 +1,82 @@
+#include "shmring.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+
+#define CAPACITY 1024
+
+
+static int failures = 0;
+
+
+static void check(bool ok, const char * what)
+{
+  printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+  failures += !ok;
+}
+
+
+// Publishes blocks of the given sample counts on one slot, each sample the
+// block number, and reads every one back right after it was written. True
+// if all arrived intact and none was counted as lost.
+static bool round_trip(const std::vector<int> & counts)
+{
+  std::string name = "/shmring-test-" + std::to_string(getpid());
+  ShmWriter   writer(name.c_str(), CAPACITY, 1000.0, 1.0e-3, {"z0"});
+  ShmReader   reader(name.c_str());
+  if(!writer.ok() || !reader.ok())
+    return false;
+
+  bool ok = true;
+  for(size_t b = 0; b < counts.size(); b++)
+    {
+      std::vector<double> block(counts[b], (double)b);
+      const double *      slot = block.data();
+      writer.publish_block(b, &slot, 1, counts[b]);
+
+      const SHM_RECORD * record;
+      const float *      values;
+      if(!reader.next(&record, &values) || record->first != b || (int)record->count != counts[b])
+        {
+          ok = false;
+          continue;
+        }
+      for(int i = 0; i < counts[b]; i++)
+        ok &= values[i] == (float)b;
+      ok &= reader.still_valid();
+    }
+  return ok && reader.lost() == 0;
+}
+
+
+int main()
+{
+  // a record is 40 header bytes and 4 per sample
+  check(round_trip({116, 116, 2, 2}), "a tail shorter than a record header wraps without one");
+  check(round_trip({110, 110, 20, 2}), "a longer tail is filled with a pad record");
+  check(round_trip({118, 118, 2, 2}), "a record that ends exactly at the end of the ring");
+  check(round_trip({50, 70, 90, 110, 30, 116, 116, 10, 112, 5, 100, 100, 100, 100, 100}), "many laps of mixed sizes");
+
+  // a reader that falls behind resynchronises and counts what it missed
+  {
+    std::string name = "/shmring-test-" + std::to_string(getpid());
+    ShmWriter   writer(name.c_str(), CAPACITY, 1000.0, 1.0e-3, {"z0"});
+    ShmReader   reader(name.c_str());
+    std::vector<double> block(100, 1.0);
+    const double *      slot = block.data();
+    for(int b = 0; b < 10; b++)
+      writer.publish_block(b, &slot, 1, 100);
+
+    const SHM_RECORD * record;
+    const float *      values;
+    check(!reader.next(&record, &values) && reader.lost() > 0 && reader.lost() <= 10*CAPACITY,
+          "a lapped reader skips to the newest head");
+    writer.publish_block(10, &slot, 1, 100);
+    check(reader.next(&record, &values) && record->first == 10, "and reads on from there");
+  }
+
+  printf(failures ? "%d failed\n" : "all passed\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+# Checks of the modules that build without Qt or a device:
+#   cd tests && qmake && make && history/history_test && alarm/alarm_test && shmring/shmring_test
+
+TEMPLATE = subdirs
+SUBDIRS += history alarm shmring
@@ -0,0 +1,88 @@
+// Sample client for the shared memory rings published by live-plotter-4000.
+// Prints one line per block or frame with per slot means, and reports
+// when it fell behind.
+//
+//   shmreader [/live-plotter-blocks | /live-plotter-frames]
+
+#include "shmring.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+
+
+int main(int argc, char **argv)
+{
+  const char * name = argc > 1 ? argv[1] : "/live-plotter-blocks";
+
+  std::unique_ptr<ShmReader> attached;
+  while(true)
+    {
+      attached.reset(new ShmReader(name));
+      if(attached->ok())
+        break;
+      printf("waiting for %s\n", name);
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+  ShmReader &        reader = *attached;
+  const SHM_HEADER * info   = reader.info();
+  printf("%s: %.0f S/s, %g V/unit, slots:", name, info->sampleRate, info->unitScale);
+  for(uint32_t s = 0; s < info->slots; s++)
+    printf(" %s", info->names[s]);
+  printf("\n");
+
+  uint64_t lost = 0, generation = info->generation.load();
+  while(true)
+    {
+      const SHM_RECORD * record;
+      const float *      values;
+      if(!reader.next(&record, &values))
+        {
+          std::this_thread::sleep_for(std::chrono::milliseconds(5));
+          continue;
+        }
+
+      // everything below reads the ring in place, so copy what is kept
+      // and check afterwards that the producer did not overwrite it
+      double   mean[SHM_SLOTS] = {0.0};
+      uint64_t sequence = record->sequence, first = record->first;
+      uint32_t type = record->type, count = record->count, rows = record->rows;
+      uint64_t mask = record->mask;
+      int      k = 0;
+      if(type == SHM_BLOCK)
+        for(uint32_t s = 0; s < info->slots; s++)
+          if(mask >> s & 1)
+            {
+              for(uint32_t i = 0; i < count; i++)
+                mean[s] += values[k*count + i];
+              mean[s] /= count;
+              k++;
+            }
+      if(!reader.still_valid())
+        continue;
+
+      if(info->generation.load() != generation)
+        {
+          generation = info->generation.load();
+          printf("stream restarted, %.0f S/s\n", info->sampleRate);
+        }
+      if(reader.lost() != lost)
+        {
+          lost = reader.lost();
+          printf("lagged, %llu bytes skipped so far\n", (unsigned long long)lost);
+        }
+
+      if(type == SHM_FRAME)
+        {
+          printf("#%llu frame %llu %ux%u\n", (unsigned long long)sequence, (unsigned long long)first, count, rows);
+          continue;
+        }
+
+      printf("#%llu sample %llu n=%u", (unsigned long long)sequence, (unsigned long long)first, count);
+      for(uint32_t s = 0; s < info->slots; s++)
+        if(mask >> s & 1)
+          printf(" %s=%.3f", info->names[s], mean[s]);
+      printf("\n");
+    }
+}
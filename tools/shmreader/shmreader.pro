@@ -0,0 +1,13 @@
+# Sample client for the shared memory rings, built on its own:
+#   cd tools/shmreader && qmake && make
+
+CONFIG -= qt
+CONFIG += console c++17
+TEMPLATE = app
+TARGET = shmreader
+INCLUDEPATH += ../../
+
+LIBS += -lrt
+# Input
+HEADERS += ../../shmring.hpp
+SOURCES += shmreader.cpp ../../shmring.cpp
@@ -0,0 +1,202 @@
+#include "trace.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+Tracer::Tracer()
+  : epoch(std::chrono::steady_clock::now())
+  , active(false)
+  , captureEnd(0)
+{
+  reset();
+  std::fill(originBlock, originBlock + TRACE_ORIGINS, UINT64_MAX);
+}
+
+
+// ns since the tracer was created
+int64_t Tracer::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+
+// Small per thread numbers, in the order threads first show up.
+int Tracer::thread_id()
+{
+  thread_local int id = -1;
+  if(id < 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      id = threads.size();
+      threads.push_back("Thread " + std::to_string(id));
+    }
+  return id;
+}
+
+
+void Tracer::name_thread(const std::string & name)
+{
+  int id = thread_id();
+  std::lock_guard<std::mutex> lock(mutex);
+  threads[id] = name;
+}
+
+
+// Registers when the driver delivered a block; later stages measure their
+// latency against it.
+void Tracer::begin_block(uint64_t block, int64_t callback)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  originBlock[block % TRACE_ORIGINS] = block;
+  origin[block % TRACE_ORIGINS]      = callback;
+}
+
+
+void Tracer::stage(TRACE_STAGE s, uint64_t block, int64_t start, int64_t end)
+{
+  int  thread = thread_id();
+  bool done   = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if(originBlock[block % TRACE_ORIGINS] == block)
+      {
+        int64_t late   = std::max<int64_t>(end - origin[block % TRACE_ORIGINS], 0);
+        int     bucket = late < 1000 ? 0 : (int)(std::log2(late/1000.0)*8.0) + 1;
+        histogram[s][std::min(bucket, TRACE_BUCKETS - 1)]++;
+        worst[s] = std::max(worst[s], late);
+      }
+
+    if(active)
+      {
+        if(events.size() < TRACE_EVENTS)
+          events.push_back({s, thread, block, start, end});
+        if(end >= captureEnd)
+          {
+            active = false;
+            captured.swap(events);
+            done = true;
+          }
+      }
+  }
+
+  if(done && finished)
+    finished();
+}
+
+
+// Latency percentiles in ms, from the upper edge of the histogram bucket.
+void Tracer::latency(int s, double * p50, double * p99, double * max)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  uint64_t total = 0;
+  for(int b = 0; b < TRACE_BUCKETS; b++)
+    total += histogram[s][b];
+
+  *p50 = *p99 = 0.0;
+  *max = worst[s]*1.0e-6;
+  if(!total)
+    return;
+
+  uint64_t sum = 0;
+  for(int b = 0; b < TRACE_BUCKETS; b++)
+    {
+      double edge = 1.0e-3*std::exp2(b/8.0);
+      if(sum < total/2 && sum + histogram[s][b] >= total/2)
+        *p50 = edge;
+      if(sum < total*99/100 && sum + histogram[s][b] >= total*99/100)
+        *p99 = edge;
+      sum += histogram[s][b];
+    }
+  *p50 = std::min(*p50, *max);
+  *p99 = std::min(*p99, *max);
+}
+
+
+void Tracer::reset()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  memset(histogram, 0, sizeof(histogram));
+  memset(worst, 0, sizeof(worst));
+}
+
+
+// Keeps every span for the next seconds, then writes them to path.
+bool Tracer::capture(const std::string & path, double seconds)
+{
+  int64_t start = now();
+  std::lock_guard<std::mutex> lock(mutex);
+  if(active || !captured.empty())
+    return false;
+  events.clear();
+  capturePath = path;
+  captureEnd  = start + (int64_t)(seconds*1.0e9);
+  active      = true;
+  return true;
+}
+
+
+// true until the capture has been written
+bool Tracer::capturing()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return active || !captured.empty();
+}
+
+
+// Called, once per capture, on the thread whose stage ended it. It should
+// only arrange for write_capture to run elsewhere.
+void Tracer::on_capture(std::function<void()> f)
+{
+  finished = f;
+}
+
+
+// Complete events ("ph":"X") in us, one track per thread, with the block
+// number as argument. The finished capture is taken over under the lock
+// and written without it.
+void Tracer::write_capture()
+{
+  std::vector<TRACE_EVENT> spans;
+  std::vector<std::string> names;
+  std::string              path;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    spans.swap(captured);
+    names = threads;
+    path  = capturePath;
+  }
+  if(spans.empty())
+    return;
+
+  FILE * file = fopen(path.c_str(), "w");
+  if(!file)
+    {
+      perror(("Tracer: " + path).c_str());
+      return;
+    }
+
+  std::vector<std::string> labels = trace_labels();
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for(size_t t = 0; t < names.size(); t++)
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}},\n",
+            t, names[t].c_str());
+  for(size_t i = 0; i < spans.size(); i++)
+    {
+      const TRACE_EVENT & e = spans[i];
+      fprintf(file, "{\"name\":\"%s\",\"cat\":\"block\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+                    "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"block\":%llu}}%s\n",
+              labels[e.stage].c_str(), e.thread, e.start*1.0e-3, (e.end - e.start)*1.0e-3,
+              (unsigned long long)e.block, i + 1 < spans.size() ? "," : "");
+    }
+  fprintf(file, "]}\n");
+  fclose(file);
+  printf("Trace: %zu events written to %s\n", spans.size(), path.c_str());
+}
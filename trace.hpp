@@ -0,0 +1,87 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+#define TRACE_ORIGINS   4096
+#define TRACE_BUCKETS   160
+#define TRACE_EVENTS    (1 << 20)
+
+
+
+// Points a block passes on its way from the ADC to the screen.
+typedef enum
+  {
+    TR_CALLBACK, TR_CONVERT, TR_ALARM, TR_DEQUEUE, TR_MATH, TR_BINNING, TR_REPLOT, TR_STAGES
+  }TRACE_STAGE;
+
+
+inline std::vector<std::string> trace_labels()
+{
+  return {"Callback", "Convert", "Alarms", "Dequeue", "Math", "Binning", "Replot"};
+}
+
+
+typedef struct
+{
+  int                       stage;
+  int                       thread;
+  uint64_t                  block;
+  int64_t                   start;
+  int64_t                   end;
+}TRACE_EVENT;
+
+
+
+// Per block timestamps from every thread on one steady clock. Each stage
+// keeps a histogram of its latency, the time from the driver callback of
+// the block to the end of the stage, in 8 buckets per octave from 1 us.
+// A capture additionally keeps every span for a while and then hands them
+// to whoever was registered with on_capture, which writes them as Chrome
+// trace events, which chrome://tracing and Perfetto open. The stage that
+// ends a capture only swaps the buffer, so no thread being traced waits for
+// the file.
+class Tracer
+{
+public:
+                            Tracer();
+
+  int64_t                   now();
+  void                      name_thread(const std::string &);
+  void                      begin_block(uint64_t, int64_t);
+  void                      stage(TRACE_STAGE, uint64_t, int64_t, int64_t);
+  void                      latency(int, double *, double *, double *);
+  void                      reset();
+  bool                      capture(const std::string &, double);
+  bool                      capturing();
+  void                      on_capture(std::function<void()>);
+  void                      write_capture();
+
+private:
+  int                       thread_id();
+
+  std::chrono::steady_clock::time_point   epoch;
+  std::mutex                mutex;
+  std::vector<std::string>  threads;
+
+  uint64_t                  originBlock[TRACE_ORIGINS];
+  int64_t                   origin[TRACE_ORIGINS];
+  uint64_t                  histogram[TR_STAGES][TRACE_BUCKETS];
+  int64_t                   worst[TR_STAGES];
+
+  bool                      active;
+  int64_t                   captureEnd;
+  std::string               capturePath;
+  std::vector<TRACE_EVENT>  events;
+  std::vector<TRACE_EVENT>  captured;     // finished, waiting for write_capture
+  std::function<void()>     finished;
+};
+
+
+#endif //TRACE_H
@@ -1,8 +1,16 @@
 #include "window.hpp"
 #include "qcustomplot.h"
+#include <QApplication>
 #include <QDateTime>
 #include <QString>
 #include <QCloseEvent>
+#include <QElapsedTimer>
+#include <QFileDialog>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
 #include <ctime>
@@ -34,13 +42,23 @@ TypeBox::TypeBox()
 }
 
 
-ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot * xy, QCPColorMap * c)
+FilterBox::FilterBox()
+  : layout(new QGridLayout())
+{
+  labels = {"No Filter", "FIR", "Biquad", "Average"};
+  for(auto p: labels)
+    addItem(tr(p.c_str()));
+
+  this->setLayout(layout);
+}
+
+
+ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot * xy)
   : unit(u)
   , worker(w)
   , loop(new QEventLoop)
   , timePlot(t)
   , xyPlot(xy)
-  , colorMap(c)
   , layout(new QGridLayout)
   , unit_Box(new QGroupBox[_UNITCOUNT_])
   , unit_Layout(new QGridLayout[_UNITCOUNT_])
@@ -48,6 +66,11 @@ ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot
   , RangeBox_Obj(new RangeBox*[_UNITCOUNT_])
   , Offset_SpinBox_Obj(new QDoubleSpinBox*[_UNITCOUNT_])
   , TypeBox_Obj(new TypeBox*[_UNITCOUNT_])
+  , FilterBox_Obj(new FilterBox*[_UNITCOUNT_])
+  , Order_SpinBox_Obj(new QSpinBox*[_UNITCOUNT_])
+  , Cutoff_SpinBox_Obj(new QDoubleSpinBox*[_UNITCOUNT_])
+  , Decimation_SpinBox_Obj(new QSpinBox*[_UNITCOUNT_])
+  , Interval_SpinBox_Obj(new QSpinBox[_UNITCOUNT_])
 {
   for(int16_t i = 0; i < _UNITCOUNT_; i++)
     {
@@ -55,6 +78,10 @@ ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot
       RangeBox_Obj[i]       = new RangeBox[unit[i].channelCount];
       Offset_SpinBox_Obj[i] = new QDoubleSpinBox[unit[i].channelCount];
       TypeBox_Obj[i]        = new TypeBox[unit[i].channelCount];
+      FilterBox_Obj[i]          = new FilterBox[unit[i].channelCount];
+      Order_SpinBox_Obj[i]      = new QSpinBox[unit[i].channelCount];
+      Cutoff_SpinBox_Obj[i]     = new QDoubleSpinBox[unit[i].channelCount];
+      Decimation_SpinBox_Obj[i] = new QSpinBox[unit[i].channelCount];
     }
 
   for(int16_t u = 0; u < _UNITCOUNT_; u++)
@@ -63,6 +90,15 @@ ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot
         {
           unit_Layout[u].addWidget(create_group_box(u,ch), 0, ch);
         }
+
+      // a unit slower than the fastest one is resampled onto its timebase;
+      // the interval takes effect when the stream starts
+      Interval_SpinBox_Obj[u].setRange(1, 1000000);
+      Interval_SpinBox_Obj[u].setValue(unit[u].sampleInterval);
+      Interval_SpinBox_Obj[u].setPrefix("Sample interval ");
+      Interval_SpinBox_Obj[u].setSuffix(" us");
+      unit_Layout[u].addWidget(Interval_SpinBox_Obj+u, 1, 0, 1, unit[u].channelCount);
+      connect(Interval_SpinBox_Obj+u, SIGNAL(valueChanged(int)), this, SLOT(set_channels()));
       unit_Box[u].setLayout(unit_Layout+u);
       std::stringstream ss;
       ss << "HANDLE: " << unit[u].handle << "    SERIAL: " << unit[u].serial;
@@ -72,11 +108,14 @@ ChannelWindow::ChannelWindow(UNIT * u, Worker * w, QCustomPlot * t, QCustomPlot
 
   Update_Button = new QPushButton(tr("&Update"));
   layout->addWidget(Update_Button, _UNITCOUNT_, 0);
+  gapLabel = new QLabel;
+  layout->addWidget(gapLabel, _UNITCOUNT_ + 1, 0);
 
   setLayout(layout);
 
   connect(Update_Button, SIGNAL(clicked()), this, SLOT(set_channels_of_pico()));
   connect(worker, SIGNAL(unit_stopped_signal()), loop, SLOT(quit()));
+  connect(worker, SIGNAL(reconfigured(int, double)), this, SLOT(reconfigured(int, double)));
 
   voltages = {10.0, 20.0, 50.0, 100.0, 200.0, 500.0, 1000.0, 2000.0, 5000.0, 10000.0, 20000.0, 50000.0};
 }
@@ -87,20 +126,46 @@ QGroupBox * ChannelWindow::create_group_box(int u, int ch)
   QString str('A' + ch);
   channelBox[u][ch].setTitle("    " + str);
   channelBox[u][ch].setCheckable(true);
-  channelBox[u][ch].setChecked(false);
+  channelBox[u][ch].setChecked(unit[u].channelSettings[ch].enabled);
   connect(channelBox[u]+ch, SIGNAL(clicked(bool)), this, SLOT(set_channels()));
 
   QVBoxLayout * channelLayout = new QVBoxLayout();
 
+  RangeBox_Obj[u][ch].setCurrentIndex(unit[u].channelSettings[ch].range);
   channelLayout->addWidget(RangeBox_Obj[u]+ch);
   connect(RangeBox_Obj[u]+ch, SIGNAL(currentIndexChanged(int)), this, SLOT(set_channels()));
 
+  Offset_SpinBox_Obj[u][ch].setRange(unit[u].channelSettings[ch].minOffset, unit[u].channelSettings[ch].maxOffset);
+  Offset_SpinBox_Obj[u][ch].setValue(unit[u].channelSettings[ch].offset);
   channelLayout->addWidget(Offset_SpinBox_Obj[u]+ch);
   connect(Offset_SpinBox_Obj[u]+ch, SIGNAL(valueChanged(double)), this, SLOT(set_channels()));
 
+  TypeBox_Obj[u][ch].setCurrentIndex(unit[u].channelSettings[ch].mode);
   channelLayout->addWidget(TypeBox_Obj[u]+ch);
   connect(TypeBox_Obj[u]+ch, SIGNAL(currentIndexChanged(int)), this, SLOT(set_channels()));
 
+  FilterBox_Obj[u][ch].setCurrentIndex(unit[u].channelSettings[ch].filter.type);
+  channelLayout->addWidget(FilterBox_Obj[u]+ch);
+  connect(FilterBox_Obj[u]+ch, SIGNAL(currentIndexChanged(int)), this, SLOT(set_channels()));
+
+  Order_SpinBox_Obj[u][ch].setRange(1, 255);
+  Order_SpinBox_Obj[u][ch].setValue(unit[u].channelSettings[ch].filter.order);
+  Order_SpinBox_Obj[u][ch].setPrefix("Order ");
+  channelLayout->addWidget(Order_SpinBox_Obj[u]+ch);
+  connect(Order_SpinBox_Obj[u]+ch, SIGNAL(valueChanged(int)), this, SLOT(set_channels()));
+
+  Cutoff_SpinBox_Obj[u][ch].setRange(0.0, 0.5e6/(double)g_sampleInterval);
+  Cutoff_SpinBox_Obj[u][ch].setValue(unit[u].channelSettings[ch].filter.cutoff);
+  Cutoff_SpinBox_Obj[u][ch].setSuffix(" Hz");
+  channelLayout->addWidget(Cutoff_SpinBox_Obj[u]+ch);
+  connect(Cutoff_SpinBox_Obj[u]+ch, SIGNAL(valueChanged(double)), this, SLOT(set_channels()));
+
+  Decimation_SpinBox_Obj[u][ch].setRange(1, 1000);
+  Decimation_SpinBox_Obj[u][ch].setValue(unit[u].channelSettings[ch].filter.decimation);
+  Decimation_SpinBox_Obj[u][ch].setPrefix("1/");
+  channelLayout->addWidget(Decimation_SpinBox_Obj[u]+ch);
+  connect(Decimation_SpinBox_Obj[u]+ch, SIGNAL(valueChanged(int)), this, SLOT(set_channels()));
+
   channelBox[u][ch].setLayout(channelLayout);
 
   return channelBox[u]+ch;
@@ -129,9 +194,7 @@ void ChannelWindow::update_axis()
         }
     }
 
-  colorMap->data()->setRange(QCPRange(-xRange,xRange), QCPRange(-yRange, yRange));
-  xyPlot->rescaleAxes();
-  xyPlot->replot();
+  emit(scan_range_changed(QCPRange(-xRange,xRange), QCPRange(-yRange, yRange)));
   timePlot->yAxis->setRange(-fRange, fRange);
   timePlot->replot();
 }
@@ -141,6 +204,7 @@ void ChannelWindow::set_channels()
 {
   for(int u = 0; u < _UNITCOUNT_; u++)
     {
+      unit[u].sampleInterval = (uint32_t)Interval_SpinBox_Obj[u].value();
       for(int ch = 0; ch < unit[u].channelCount; ch++)
         {
           unit[u].channelSettings[ch].enabled   = channelBox[u][ch].isChecked();
@@ -148,55 +212,69 @@ void ChannelWindow::set_channels()
           get_offset_bounds(u, ch);
           unit[u].channelSettings[ch].offset    = (float)Offset_SpinBox_Obj[u][ch].value();
           unit[u].channelSettings[ch].mode      = (MODE)TypeBox_Obj[u][ch].currentIndex();
+          unit[u].channelSettings[ch].filter.type       = (FILTER_TYPE)FilterBox_Obj[u][ch].currentIndex();
+          unit[u].channelSettings[ch].filter.order      = Order_SpinBox_Obj[u][ch].value();
+          unit[u].channelSettings[ch].filter.cutoff     = Cutoff_SpinBox_Obj[u][ch].value();
+          unit[u].channelSettings[ch].filter.decimation = Decimation_SpinBox_Obj[u][ch].value();
         }
     }
   update_axis();
 }
 
 
+// A running stream is reconfigured in place, see Worker::apply_reconfig.
 void ChannelWindow::set_channels_of_pico()
 {
-  bool stream_was_running_flag = g_streamIsRunning ? true : false;
-
-  g_streamIsRunning = false;
-  if(stream_was_running_flag)
-    loop->exec();
+  if(g_streamIsRunning)
+    {
+      worker->request_reconfig(unit);
+      this->close();
+      return;
+    }
 
+  // queued per channel, so repeated updates collapse into one driver call
   for(int u = 0; u < _UNITCOUNT_; u++)
     {
       for (int ch = 0; ch < unit[u].channelCount; ch++)
         {
-          PICO_STATUS status = ps4000aSetChannel(unit[u].handle,
-                                                 (PS4000A_CHANNEL)(PS4000A_CHANNEL_A + ch),
-                                                 unit[u].channelSettings[ch].enabled,
-                                                 unit[u].channelSettings[ch].coupling,
-                                                 unit[u].channelSettings[ch].range,
-                                                 unit[u].channelSettings[ch].offset);
-
-          printf(status?"SetDefaults:ps4000aSetChannel------ 0x%08lx \n":"", (long unsigned int)status);
+          int16_t          handle   = unit[u].handle;
+          CHANNEL_SETTINGS settings = unit[u].channelSettings[ch];
+          unit[u].queue->post(ch, [handle, ch, settings]()
+                              {
+                                PICO_STATUS status = ps4000aSetChannel(handle,
+                                                                       (PS4000A_CHANNEL)(PS4000A_CHANNEL_A + ch),
+                                                                       settings.enabled,
+                                                                       settings.coupling,
+                                                                       settings.range,
+                                                                       settings.offset);
+
+                                printf(status?"SetDefaults:ps4000aSetChannel------ 0x%08lx \n":"", (long unsigned int)status);
+                              });
         }
     }
 
-  if(stream_was_running_flag)
-    emit(do_work(unit));
-
   this->close();
 }
 
 
+void ChannelWindow::reconfigured(int u, double gap)
+{
+  std::stringstream ss;
+  ss << "Last reconfiguration: unit " << unit[u].serial << ", gap " << std::fixed << std::setprecision(1)
+     << gap << " ms (" << (long)(gap*1000.0/g_sampleInterval) << " samples)";
+  gapLabel->setText(ss.str().c_str());
+  printf("%s\n", ss.str().c_str());
+}
+
+
 void ChannelWindow::get_offset_bounds(int u, int ch)
 {
-  float min, max;
-  ps4000aGetAnalogueOffset(unit[u].handle,
-                           unit[u].channelSettings[ch].range,
-                           unit[u].channelSettings[ch].coupling,
-                           &max,
-                           &min);
-  unit[u].channelSettings[ch].maxOffset = max;
-  unit[u].channelSettings[ch].minOffset = min;
+  CHANNEL_SETTINGS & c = unit[u].channelSettings[ch];
+  c.minOffset = unit[u].offsetBounds[c.range][c.coupling][0];
+  c.maxOffset = unit[u].offsetBounds[c.range][c.coupling][1];
 
-  Offset_SpinBox_Obj[u][ch].setMaximum((double)max);
-  Offset_SpinBox_Obj[u][ch].setMinimum((double)min);
+  Offset_SpinBox_Obj[u][ch].setMaximum((double)c.maxOffset);
+  Offset_SpinBox_Obj[u][ch].setMinimum((double)c.minOffset);
 }
 
 
@@ -208,96 +286,240 @@ void ChannelWindow::get_offset_bounds(int u, int ch)
 Window::Window()
   : toolBar(new QToolBar())
   , Worker_Obj(new Worker)
+  , renderer(new Renderer)
   , loop(new QEventLoop)
   , splitter(new QSplitter(this))
   , timePlot(new QCustomPlot)
   , xyPlot(new QCustomPlot)
-  , colorMap(new QCPColorMap(xyPlot->xAxis, xyPlot->yAxis))
-  , mathChannel_vec(QVector<double>(30))
+  , xyPixmap(new QCPItemPixmap(xyPlot))
+  , ChannelWindow_Obj(nullptr)
+  , shmFrames(nullptr)
 {
   Worker_Obj->moveToThread(&Thread_Obj);
   Thread_Obj.start();
   qRegisterMetaType<UNIT>();
   qRegisterMetaType<std::vector<double>>();
+  qRegisterMetaType<LOCKIN_SETTINGS>();
+  qRegisterMetaType<AVERAGE_SETTINGS>();
+  qRegisterMetaType<PHOSPHOR_SETTINGS>();
+  qRegisterMetaType<XY_IMAGE>();
+  qRegisterMetaType<SCAN_CALIBRATION>();
+  qRegisterMetaType<std::vector<ALARM_EVENT>>();
 
   g_streamIsRunning = false;
+  g_sampleInterval  = 10;
+  g_measureWindow   = 1.0;
+  g_measureReset    = false;
+  g_averageReset    = false;
+  g_publish         = false;
+  g_record          = false;
   counter           = 0;
-
-  for(int mode = X; mode != Z9 + 1; mode++)
-    data_vec.push_back(0.0);
-
-  colorMapData_ptr = &data_vec[Z0-1];
+  sampleStride      = 1;
+  traceBlock        = 0;
+  mathStart         = 0;
+  mathEnd           = 0;
+  replotStart       = 0;
+  g_tracer.name_thread("GUI");
+
+  frameBuilder  = new FrameBuilder(200, 16);
+  frameSyncSlot = 0;
+
+  scanX           = QCPRange(-5000.0, 5000.0);
+  scanY           = QCPRange(-5000.0, 5000.0);
+  scanCalibration = ScanMap::linear(scanX.lower, scanX.upper, scanY.lower, scanY.upper);
+  frameMap        = new ScanMap;
+  frameMap->set_calibration(scanCalibration);
+  renderer->set_calibration(scanCalibration);
+  renderer->moveToThread(&renderThread);
+  renderThread.start();
+  connect(renderer, SIGNAL(rendered(XY_IMAGE)), this, SLOT(xy_image_slot(XY_IMAGE)));
+
+  // the time plot takes part in the linked range and cursor of the views
+  viewLink   = new ViewLink;
+  xyViews    = 0;
+  timeCursor = new QCPItemStraightLine(timePlot);
+  timeCursor->setPen(QPen(Qt::gray, 0, Qt::DashLine));
+  timeCursor->setVisible(false);
+  connect(viewLink, SIGNAL(range_changed(double, double)), this, SLOT(linked_range_slot(double, double)));
+  connect(viewLink, SIGNAL(cursor_changed(double)), this, SLOT(linked_cursor_slot(double)));
+  connect(timePlot, SIGNAL(mouseMove(QMouseEvent *)), this, SLOT(time_cursor_slot(QMouseEvent *)));
 }
 
 
 void Window::start()
 {
-  open_unit();
-  get_unit_info();
+  QElapsedTimer phase;
+  startupTimer.start();
+  phase.start();
+
+  enumerate_units();
+  printf("Startup: enumerate %lld ms\n", (long long)phase.restart());
+
   set_channels();
-  set_channels_of_pico();
-  ChannelWindow_Obj = new ChannelWindow(unit, Worker_Obj, timePlot, xyPlot, colorMap);
+  for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    load_unit_config(i);
+  register_channels();
+  printf("Startup: load config %lld ms, %d data slots\n", (long long)phase.restart(), data_slots());
+
   set_main_window();
   set_actions();
   set_connections();
   this->show();
-  ChannelWindow_Obj->show();
   GraphWindow_Obj = new GraphWindow(this);
   MathWindow_Obj = new MathWindow(this);
   ColorMapDataChooser_Obj = new ColorMapDataChooser(this);
+  LockInWindow_Obj = new LockInWindow(this);
+  MeasurementWindow_Obj = new MeasurementWindow(this);
+  AverageWindow_Obj = new AverageWindow(this);
+  PhosphorWindow_Obj = new PhosphorWindow(this);
+  FrameWindow_Obj = new FrameWindow(this);
+  ScanWindow_Obj = new ScanWindow(this);
+  AlarmWindow_Obj = new AlarmWindow(this);
+  load_calibration();
+  register_memory();
+  PipelineWindow_Obj = new PipelineWindow(this);
+  printf("Startup: gui %lld ms\n", (long long)phase.restart());
+
+  memoryPressure = false;
+  memoryTimer    = new QTimer(this);
+  connect(memoryTimer, SIGNAL(timeout()), this, SLOT(memory_slot()));
+  memoryTimer->start(1000);
+
+  // firmware loading dominates, so every unit is opened on its own device
+  // queue and the queues run in parallel
+  streamButton->setEnabled(false);
+  statusBar()->showMessage(tr("Opening ") + QString::number(_UNITCOUNT_) + tr(" unit(s)..."));
+  unitsReady = 0;
+  for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    {
+      unit[i].queue = new DeviceQueue;
+      unit[i].queue->post(-1, [this, i]()
+                          {
+                            open_unit(i);
+                            QMetaObject::invokeMethod(this, "unit_ready", Qt::QueuedConnection, Q_ARG(int, i));
+                          });
+    }
+  if(_UNITCOUNT_ == 0)
+    units_attached();
+}
+
+
+// Fills g_channels once the units are known and sizes everything that
+// holds one entry per slot. Math expressions bind to data_vec elements, so
+// it is never resized afterwards.
+void Window::register_channels()
+{
+  g_channels.clear();
+  for(auto r: {"X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"})
+    g_channels.add(CH_ROLE, r);
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    for(auto o: {"X", "Y", "R", "Theta"})
+      g_channels.add(CH_LOCKIN, "L" + std::to_string(k) + "." + o);
+  for(int k = 0; k < PLUGIN_OUTPUTS; k++)
+    g_channels.add(CH_PLUGIN, "P" + std::to_string(k));
+  for(int16_t u = 0; u < _UNITCOUNT_; u++)
+    for(int ch = 0; ch < unit[u].channelCount; ch++)
+      g_channels.add(CH_INPUT, "U" + std::to_string(u) + "." + std::string(1, 'A' + ch), u, ch);
+
+  data_vec         = std::vector<double>(data_slots(), 0.0);
+  colorMapData_ptr = &data_vec[Z0-1];
+  measure_vec      = std::vector<double>(data_slots()*2*M_VALUES, 0.0);
+  mathChannel_vec  = QVector<double>(plot_graphs() + 30);
+
+  // the spill wants a real disk; /tmp is a tmpfs on most systems
+  QSettings config("live-plotter-4000", "memory");
+  QString   spillDir = config.value("spillDirectory", QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).toString();
+  QDir().mkpath(spillDir);
+  history = new History(data_slots(), HISTORY_SAMPLES, spillDir.toLocal8Bit().constData(),
+                        (size_t)config.value("spillLimit", 4096).toInt() << 20);
+}
+
+
+// Runs on the unit's device queue and touches nothing but its own unit.
+void Window::open_unit(int u)
+{
+  QElapsedTimer phase;
+  phase.start();
+
+  PICO_STATUS status = ps4000aOpenUnit(&unit[u].handle, unit[u].serial);
+  if(status != PICO_OK)
+    std::cout << "Error: open_unit(): " << std::hex << status << std::dec << std::endl;
+  unit[u].openTime = phase.restart();
+
+  get_unit_info(u);
+  cache_offset_bounds(u);
+  set_channels_of_pico(u);
+  get_allowed_offset(u);
+  unit[u].configTime = phase.restart();
+}
 
+
+void Window::unit_ready(int u)
+{
+  unitsReady++;
+  printf("Startup: Pico %s open %lld ms, configure %lld ms\n",
+         (char*)unit[u].serial, (long long)unit[u].openTime, (long long)unit[u].configTime);
+  statusBar()->showMessage(tr("Pico ") + QString((char*)unit[u].serial) + tr(" ready (") +
+                           QString::number(unitsReady) + "/" + QString::number(_UNITCOUNT_) + ")", 3000);
+
+  if(unitsReady == _UNITCOUNT_)
+    units_attached();
 }
 
 
-void Window::open_unit()
+// The stream runs all units together, so channels and streaming become
+// available once the last one has attached.
+void Window::units_attached()
 {
-  PICO_STATUS status;
+  ChannelWindow_Obj = new ChannelWindow(unit, Worker_Obj, timePlot, xyPlot);
+  connect(ChannelWindow_Obj, SIGNAL(do_work(UNIT *)), this, SLOT(stream_button_slot()));
+  connect(ChannelWindow_Obj, SIGNAL(scan_range_changed(QCPRange, QCPRange)), this, SLOT(set_scan_range(QCPRange, QCPRange)));
+  ChannelWindow_Obj->show();
+  streamButton->setEnabled(true);
+  printf("Startup: ready after %lld ms\n", (long long)startupTimer.elapsed());
+}
+
 
+void Window::enumerate_units()
+{
   int16_t serialLth = 100;
-  int8_t * serials = new int8_t[serialLth];
+  int8_t * serials = new int8_t[serialLth]();
   ps4000aEnumerateUnits(&_UNITCOUNT_, serials, &serialLth);
   std::cout << "\nNumber of Pico's found: " << _UNITCOUNT_ << std::endl;
 
-  unit = new UNIT[_UNITCOUNT_];
+  unit = new UNIT[_UNITCOUNT_]();
 
+  int8_t * s = serials;
   for(int16_t i = 0; i < _UNITCOUNT_; i++)
     {
-      int8_t j = 0;
-      do
+      int j = 0, k = 0;
+      while(s + j < serials + serialLth && s[j] != 44 && s[j] != 0)
         {
-          if(serials[j] == 32)
+          if(s[j] == 32)
             {
               j++;
               continue;
             }
 
-          unit[i].serial[j] = serials[j];
+          if(k < (int)sizeof(unit[i].serial) - 1)
+            unit[i].serial[k++] = s[j];
           j++;
         }
-      while(serials[j] != 44  && j < serialLth);
-
-      serials = serials+j+1;
+      unit[i].serial[k] = 0;
 
-      status = ps4000aOpenUnit(&unit[i].handle, unit[i].serial);
-
-      if(status == PICO_OK)
-        std::cout << "Pico " << unit[i].serial << " check.\n";
-      else
-        std::cout << "Error: open_unit(): " << std::hex << status << std::endl;
+      s = s+j+1;
     }
+  delete[] serials;
 }
 
 
-void Window::get_unit_info()
+void Window::get_unit_info(int i)
 {
-  for(int i = 0; i < _UNITCOUNT_; i++)
-    {
-      unit[i].minRange        = PS4000A_10MV;
-      unit[i].maxRange        = PS4000A_50V;
-      unit[i].channelCount    = PS4000A_MAX_CHANNELS;
-      ps4000aMaximumValue(unit[i].handle, &unit[i].maxSampleValue);
-      ps4000aMinimumValue(unit[i].handle, &unit[i].minSampleValue);
-    }
+  unit[i].minRange        = PS4000A_10MV;
+  unit[i].maxRange        = PS4000A_50V;
+  unit[i].channelCount    = PS4000A_MAX_CHANNELS;
+  ps4000aMaximumValue(unit[i].handle, &unit[i].maxSampleValue);
+  ps4000aMinimumValue(unit[i].handle, &unit[i].minSampleValue);
 }
 
 
@@ -306,6 +528,8 @@ void Window::get_unit_info()
 
     for(int16_t i = 0; i < _UNITCOUNT_; i++)
       {
+        unit[i].channelCount   = PS4000A_MAX_CHANNELS;
+        unit[i].sampleInterval = g_sampleInterval;
         for (int ch = 0; ch < unit[i].channelCount; ch++)
           {
             unit[i].channelSettings[ch].range         = (PICO_CONNECT_PROBE_RANGE)PS4000A_5V;
@@ -316,46 +540,113 @@ void Window::get_unit_info()
             unit[i].channelSettings[ch].maxOffset     = 0.0;
             unit[i].channelSettings[ch].minOffset     = 0.0;
             unit[i].channelSettings[ch].coupling      = (PS4000A_COUPLING)false;
+            unit[i].channelSettings[ch].filter.type       = FILTER_OFF;
+            unit[i].channelSettings[ch].filter.cutoff     = 1000.0;
+            unit[i].channelSettings[ch].filter.order      = 31;
+            unit[i].channelSettings[ch].filter.decimation = 1;
+            unit[i].channelSettings[ch].filterStage       = nullptr;
+            unit[i].channelSettings[ch].resampler         = nullptr;
+            unit[i].channelSettings[ch].voltage_buffer    = nullptr;
           }
       }
   }
 
 
-  void Window::set_channels_of_pico()
+  // Applies the whole channel configuration of a unit in one pass.
+  void Window::set_channels_of_pico(int i)
   {
-    for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    for(int ch = 0; ch < unit[i].channelCount; ch++)
       {
-        for(int ch = 0; ch < unit[i].channelCount; ch++)
-          {
-            PICO_STATUS status = ps4000aSetChannel(unit[i].handle,
-                                                   (PS4000A_CHANNEL)(PS4000A_CHANNEL_A + ch),
-                                                   unit[i].channelSettings[ch].enabled,
-                                                   unit[i].channelSettings[ch].coupling,
-                                                   unit[i].channelSettings[ch].range,
-                                                   unit[i].channelSettings[ch].offset);
-
-            printf(status?"SetDefaults:ps4000aSetChannel------ 0x%08lx \n":"", (long unsigned int)status);
-          }
+        PICO_STATUS status = ps4000aSetChannel(unit[i].handle,
+                                               (PS4000A_CHANNEL)(PS4000A_CHANNEL_A + ch),
+                                               unit[i].channelSettings[ch].enabled,
+                                               unit[i].channelSettings[ch].coupling,
+                                               unit[i].channelSettings[ch].range,
+                                               unit[i].channelSettings[ch].offset);
+
+        printf(status?"SetDefaults:ps4000aSetChannel------ 0x%08lx \n":"", (long unsigned int)status);
       }
   }
 
 
-  void Window::get_allowed_offset()
+  void Window::get_allowed_offset(int i)
   {
-    for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    for(int ch = 0; ch < unit[i].channelCount; ch++)
       {
-        for(int ch = 0; ch < unit[i].channelCount; ch++)
-          {
-            ps4000aGetAnalogueOffset(unit[i].handle,
-                                     unit[i].channelSettings[ch].range,
-                                     unit[i].channelSettings[ch].coupling,
-                                     &unit[i].channelSettings[ch].maxOffset,
-                                     &unit[i].channelSettings[ch].minOffset);
-          }
+        CHANNEL_SETTINGS & c = unit[i].channelSettings[ch];
+        c.minOffset = unit[i].offsetBounds[c.range][c.coupling][0];
+        c.maxOffset = unit[i].offsetBounds[c.range][c.coupling][1];
       }
   }
 
 
+  // The offset bounds only depend on range and coupling, so they are read
+  // once per unit and the channel window never has to ask the driver.
+  void Window::cache_offset_bounds(int i)
+  {
+    for(int r = 0; r < OFFSET_RANGES; r++)
+      for(int c = 0; c < 2; c++)
+        {
+          float max = 0.0f, min = 0.0f;
+          ps4000aGetAnalogueOffset(unit[i].handle, (PICO_CONNECT_PROBE_RANGE)r, (PS4000A_COUPLING)c, &max, &min);
+          unit[i].offsetBounds[r][c][0] = min;
+          unit[i].offsetBounds[r][c][1] = max;
+        }
+  }
+
+
+// The last used channel configuration is kept per serial number.
+void Window::load_unit_config(int i)
+{
+  QSettings config("live-plotter-4000", "units");
+  config.beginGroup(QString((char*)unit[i].serial));
+  unit[i].sampleInterval = config.value("sampleInterval", unit[i].sampleInterval).toUInt();
+  for(int ch = 0; ch < unit[i].channelCount; ch++)
+    {
+      CHANNEL_SETTINGS & c = unit[i].channelSettings[ch];
+      config.beginGroup(QString('A' + ch));
+      c.enabled           = config.value("enabled", c.enabled).toBool();
+      c.range             = (PICO_CONNECT_PROBE_RANGE)config.value("range", (int)c.range).toInt();
+      c.offset            = config.value("offset", c.offset).toFloat();
+      c.coupling          = (PS4000A_COUPLING)config.value("coupling", (int)c.coupling).toInt();
+      c.mode              = (MODE)config.value("mode", (int)c.mode).toInt();
+      c.filter.type       = (FILTER_TYPE)config.value("filter", (int)c.filter.type).toInt();
+      c.filter.cutoff     = config.value("cutoff", c.filter.cutoff).toDouble();
+      c.filter.order      = config.value("order", c.filter.order).toInt();
+      c.filter.decimation = config.value("decimation", c.filter.decimation).toInt();
+      config.endGroup();
+    }
+  config.endGroup();
+}
+
+
+void Window::save_unit_config()
+{
+  QSettings config("live-plotter-4000", "units");
+  for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    {
+      config.beginGroup(QString((char*)unit[i].serial));
+      config.setValue("sampleInterval", unit[i].sampleInterval);
+      for(int ch = 0; ch < unit[i].channelCount; ch++)
+        {
+          CHANNEL_SETTINGS & c = unit[i].channelSettings[ch];
+          config.beginGroup(QString('A' + ch));
+          config.setValue("enabled", c.enabled);
+          config.setValue("range", (int)c.range);
+          config.setValue("offset", c.offset);
+          config.setValue("coupling", (int)c.coupling);
+          config.setValue("mode", (int)c.mode);
+          config.setValue("filter", (int)c.filter.type);
+          config.setValue("cutoff", c.filter.cutoff);
+          config.setValue("order", c.filter.order);
+          config.setValue("decimation", c.filter.decimation);
+          config.endGroup();
+        }
+      config.endGroup();
+    }
+}
+
+
 void Window::set_main_window()
 {
   splitter->addWidget(timePlot);
@@ -378,16 +669,46 @@ void Window::set_main_window()
   connect(timePlot->selectionRect(), &QCPSelectionRect::started, this, &Window::set_rawValue1);
   connect(timePlot->selectionRect(), &QCPSelectionRect::accepted, this, &Window::set_rawValue2);
 
-  colorMap->setGradient(QCPColorGradient::gpGrayscale);
-  colorMap->setDataRange(QCPRange(-1.0, 1.0));
-  colorMap->data()->setSize(200, 200);
-  colorMap->data()->fill(0.0);
-
-  std::vector<std::string> labels = {"X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"};
+  xyPixmap->setScaled(true, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+  xyPlot->xAxis->setRange(scanX);
+  xyPlot->yAxis->setRange(scanY);
+  renderer->pendingViews[0]++;
+  QMetaObject::invokeMethod(renderer, "render_view", Qt::QueuedConnection,
+                            Q_ARG(double, scanX.lower), Q_ARG(double, scanX.upper),
+                            Q_ARG(double, scanY.lower), Q_ARG(double, scanY.upper),
+                            Q_ARG(int, frameBuilder->size()), Q_ARG(int, 0));
+  connect(xyPlot->xAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(xy_range_slot()));
+  connect(timePlot->xAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(history_range_slot()));
+  connect(xyPlot->yAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(xy_range_slot()));
+
+  std::vector<std::string> labels = slot_labels();
   for(auto p: labels)
     {
       timePlot->addGraph();
     }
+  for(int slot = Z9; slot < data_slots(); slot++)
+    timePlot->graph(slot)->setVisible(false);
+  for(int i = 0; i < Worker_Obj->plugins.stages(); i++)
+    for(uint32_t k = 0; k < Worker_Obj->plugins.stage(i).info->outputs; k++)
+      timePlot->graph(Worker_Obj->plugins.stage(i).slot + k)->setVisible(true);
+
+  // averaged sweep on the top axis, microseconds after the trigger
+  for(int i = average_graph(); i < plot_graphs(); i++)
+    {
+      timePlot->addGraph(timePlot->xAxis2, timePlot->yAxis);
+      timePlot->graph(i)->setPen(QPen(QColor(220, 40, 40, i == average_graph() ? 255 : 60)));
+    }
+  timePlot->graph(average_graph()+1)->setBrush(QBrush(QColor(220, 40, 40, 30)));
+  timePlot->graph(average_graph()+1)->setChannelFillGraph(timePlot->graph(average_graph()+2));
+
+  // persistence image, stretched over the whole axis rect
+  phosphorPixmap = new QCPItemPixmap(timePlot);
+  phosphorPixmap->topLeft->setType(QCPItemPosition::ptAxisRectRatio);
+  phosphorPixmap->topLeft->setCoords(0.0, 0.0);
+  phosphorPixmap->bottomRight->setType(QCPItemPosition::ptAxisRectRatio);
+  phosphorPixmap->bottomRight->setCoords(1.0, 1.0);
+  phosphorPixmap->setScaled(true, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+  phosphorPixmap->setVisible(false);
 
   // timePlot->graph(0)->setPen(QPen(QColor(40, 110, 255)));
   QSharedPointer<QCPAxisTickerTime> timeTicker(new QCPAxisTickerTime);
@@ -415,6 +736,11 @@ void Window::set_actions()
   toolBar->addWidget(videoButton);
   connect(videoButton, SIGNAL(clicked()), this, SLOT(video_button_slot()));
 
+  recordButton = new QPushButton(tr("&Record"));
+  recordButton->setToolTip(tr("Record the raw channels, losslessly compressed, to recordings/"));
+  toolBar->addWidget(recordButton);
+  connect(recordButton, SIGNAL(clicked()), this, SLOT(record_button_slot()));
+
 
   // scaleOffsetBox = new QDoubleSpinBox();
   // scaleOffsetBox->setMaximum(20);
@@ -431,13 +757,22 @@ void Window::set_actions()
   // scaleAmplitudeBoxAction = toolBar->addWidget(scaleAmplitudeBox);
 
   sizeBox = new QSpinBox();
-  sizeBox->setMaximum(350);
+  sizeBox->setMaximum(1000);
   sizeBox->setMinimum(50);
   sizeBox->setSingleStep(10);
   sizeBox->setValue(200);
   sizeBoxAction = toolBar->addWidget(sizeBox);
   connect(sizeBox, SIGNAL(valueChanged(int)), this, SLOT(set_size_slot(int)));
 
+  budgetBox = new QSpinBox();
+  budgetBox->setRange(16, 1024);
+  budgetBox->setSingleStep(16);
+  budgetBox->setValue(128);
+  budgetBox->setSuffix(" MB");
+  budgetBox->setToolTip(tr("Memory for the XY accumulator"));
+  budgetBoxAction = toolBar->addWidget(budgetBox);
+  connect(budgetBox, SIGNAL(valueChanged(int)), this, SLOT(set_budget_slot(int)));
+
   show_ChannelMenu = new QAction(tr("&Channel"));
   menuBar()->addAction(show_ChannelMenu);
   connect(show_ChannelMenu, SIGNAL(triggered()), this, SLOT(show_channel_menu_slot()));
@@ -456,23 +791,73 @@ void Window::set_actions()
   view->addAction(xyplot_screen_Action);
   view->addAction(timeplot_screen_Action);
 
+  publish_Action = new QAction(tr("&Publish to shared memory"));
+  publish_Action->setCheckable(true);
+  connect(publish_Action, SIGNAL(toggled(bool)), this, SLOT(publish_slot(bool)));
+  view->addSeparator();
+  view->addAction(publish_Action);
+
+  replay_Action = new QAction(tr("&Replay recording..."));
+  connect(replay_Action, SIGNAL(triggered()), this, SLOT(replay_slot()));
+  view->addAction(replay_Action);
+
+  new_time_view = new QAction(tr("New &Time View"));
+  new_xy_view = new QAction(tr("New X&Y View"));
+  new_spectrum_view = new QAction(tr("New &Spectrum View"));
+  connect(new_time_view, SIGNAL(triggered()), this, SLOT(new_time_view_slot()));
+  connect(new_xy_view, SIGNAL(triggered()), this, SLOT(new_xy_view_slot()));
+  connect(new_spectrum_view, SIGNAL(triggered()), this, SLOT(new_spectrum_view_slot()));
+  view->addSeparator();
+  view->addAction(new_time_view);
+  view->addAction(new_xy_view);
+  view->addAction(new_spectrum_view);
+
   graphs = new QMenu();
   show_channel_list = new QAction(tr("&Pico Channel"));
   show_math_channel_window = new QAction(tr("&Math Channel"));
+  show_lockin_window = new QAction(tr("&Lock-In"));
+  show_measurement_window = new QAction(tr("M&easurements"));
+  show_average_window = new QAction(tr("&Averager"));
+  show_phosphor_window = new QAction(tr("&Persistence"));
+  show_frame_window = new QAction(tr("&Frames"));
+  show_pipeline_window = new QAction(tr("P&ipeline"));
+  show_scan_window = new QAction(tr("Sca&n Calibration"));
+  show_alarm_window = new QAction(tr("Ala&rms"));
   ColorMapDataChooser_Action = new QAction(tr("&XY-Signal"));
   graphs = menuBar()->addMenu(tr("&Graphs"));
   graphs->addAction(show_channel_list);
   graphs->addAction(show_math_channel_window);
+  graphs->addAction(show_lockin_window);
+  graphs->addAction(show_measurement_window);
+  graphs->addAction(show_average_window);
+  graphs->addAction(show_phosphor_window);
+  graphs->addAction(show_frame_window);
+  graphs->addAction(show_pipeline_window);
+  graphs->addAction(show_scan_window);
+  graphs->addAction(show_alarm_window);
   graphs->addAction(ColorMapDataChooser_Action);
 }
 
 
 void Window::set_connections()
 {
-  connect(ChannelWindow_Obj, SIGNAL(do_work(UNIT *)), this, SLOT(stream_button_slot()));
   connect(this, SIGNAL(do_work(UNIT *)), Worker_Obj, SLOT(stream_data(UNIT *)));
+  connect(this, SIGNAL(do_replay(QString)), Worker_Obj, SLOT(replay_data(QString)));
   connect(Worker_Obj, SIGNAL(data(std::vector<double>)), this, SLOT(data(std::vector<double>)));
+  connect(Worker_Obj, SIGNAL(measurements(std::vector<double>)), this, SLOT(measurements(std::vector<double>)));
+  connect(Worker_Obj, SIGNAL(averaged(std::vector<double>, std::vector<double>)),
+          this, SLOT(averaged(std::vector<double>, std::vector<double>)));
+  connect(Worker_Obj, SIGNAL(phosphor(QImage)), this, SLOT(phosphor(QImage)));
   connect(Worker_Obj, SIGNAL(unit_stopped_signal()), loop, SLOT(quit()));
+  connect(Worker_Obj, SIGNAL(unit_stopped_signal()), this, SLOT(stream_stopped_slot()));
+  connect(Worker_Obj, SIGNAL(block_stamp(qint64, qint64)), this, SLOT(block_stamp(qint64, qint64)));
+  connect(Worker_Obj, SIGNAL(history_scales(std::vector<double>)), this, SLOT(history_scales(std::vector<double>)));
+  connect(Worker_Obj, SIGNAL(sample_stride(int)), this, SLOT(sample_stride(int)));
+  for(QCustomPlot * plot: {timePlot, xyPlot})
+    {
+      connect(plot, SIGNAL(beforeReplot()), this, SLOT(replot_started()));
+      connect(plot, SIGNAL(afterReplot()), this, SLOT(replot_done()));
+    }
 }
 
 
@@ -487,9 +872,11 @@ void Window::set_rawValue2(QRect dum, QMouseEvent * event)
 {
   rawValueAmplitude2 = timePlot->yAxis->pixelToCoord(event->y());
   calculate_greyscale();
-  colorMap->setDataRange(QCPRange(greyScaleOffset-greyScaleAmplitude, greyScaleOffset+greyScaleAmplitude));
-  colorMap->data()->fill(greyScaleOffset);
-  xyPlot->replot();
+  xyBatch.clear();
+  QMetaObject::invokeMethod(renderer, "set_grey", Qt::QueuedConnection,
+                            Q_ARG(double, greyScaleOffset-greyScaleAmplitude),
+                            Q_ARG(double, greyScaleOffset+greyScaleAmplitude));
+  refresh_colormap();
 }
 
 
@@ -502,14 +889,220 @@ void Window::calculate_greyscale()
 
 void Window::show_channel_menu_slot()
 {
-  ChannelWindow_Obj->show();
+  if(ChannelWindow_Obj)
+    ChannelWindow_Obj->show();
 }
 
 
+// Only the displayed resolution changes; the accumulated image is kept
+// and resampled.
 void Window::set_size_slot(int size)
 {
-  colorMap->data()->setSize(size, size);
-  xyPlot->replot();
+  frameBuilder->resize(size, frameBuilder->depth());
+  if(frameBuilder->mode() == FRAME_OFF)
+    refresh_colormap();
+  else
+    xyPlot->replot();
+}
+
+
+void Window::set_budget_slot(int megabytes)
+{
+  QMetaObject::invokeMethod(renderer, "set_budget", Qt::QueuedConnection, Q_ARG(int, megabytes));
+  refresh_colormap();
+}
+
+
+// A new scan range invalidates everything binned so far.
+// The channel ranges set the scan range until a calibration has been
+// fitted, which knows the extent of the actual scan.
+void Window::set_scan_range(QCPRange x, QCPRange y)
+{
+  SCAN_CALIBRATION & c = scanCalibration;
+  if(!c.volts[0].empty() || !c.volts[1].empty())
+    {
+      x = QCPRange(c.lo[0], c.hi[0]);
+      y = QCPRange(c.lo[1], c.hi[1]);
+    }
+  c.lo[0] = x.lower;
+  c.hi[0] = x.upper;
+  c.lo[1] = y.lower;
+  c.hi[1] = y.upper;
+  frameMap->set_calibration(c);
+  QMetaObject::invokeMethod(renderer, "set_calibration", Qt::QueuedConnection, Q_ARG(SCAN_CALIBRATION, c));
+
+  scanX = x;
+  scanY = y;
+  xyPlot->xAxis->setRange(x);
+  xyPlot->yAxis->setRange(y);
+  refresh_colormap();
+}
+
+
+void Window::apply_calibration(const SCAN_CALIBRATION & c)
+{
+  scanCalibration = c;
+  set_scan_range(QCPRange(c.lo[0], c.hi[0]), QCPRange(c.lo[1], c.hi[1]));
+
+  QSettings config("live-plotter-4000", "scan");
+  config.setValue("delay", c.delay);
+  for(int axis = 0; axis < 2; axis++)
+    {
+      QVariantList volts, field;
+      for(size_t k = 0; k < c.volts[axis].size(); k++)
+        {
+          volts << c.volts[axis][k];
+          field << c.field[axis][k];
+        }
+      config.beginGroup(axis ? "y" : "x");
+      config.setValue("lo", c.lo[axis]);
+      config.setValue("hi", c.hi[axis]);
+      config.setValue("volts", volts);
+      config.setValue("field", field);
+      config.endGroup();
+    }
+  ScanWindow_Obj->update_status();
+}
+
+
+// The last calibration, or a linear one over the current scan range.
+void Window::load_calibration()
+{
+  apply_calibration(saved_calibration(scanX.lower, scanX.upper, scanY.lower, scanY.upper));
+}
+
+
+// The calibration last applied, or a linear one over the given range if
+// none was fitted. Also read by the batch mode, before any window exists.
+SCAN_CALIBRATION Window::saved_calibration(double x0, double x1, double y0, double y1)
+{
+  QSettings        config("live-plotter-4000", "scan");
+  SCAN_CALIBRATION c = ScanMap::linear(x0, x1, y0, y1);
+  c.delay = config.value("delay", 0).toInt();
+  for(int axis = 0; axis < 2; axis++)
+    {
+      config.beginGroup(axis ? "y" : "x");
+      QVariantList volts = config.value("volts").toList();
+      QVariantList field = config.value("field").toList();
+      if(volts.size() >= 2 && volts.size() == field.size())
+        {
+          c.lo[axis] = config.value("lo", c.lo[axis]).toDouble();
+          c.hi[axis] = config.value("hi", c.hi[axis]).toDouble();
+          for(int k = 0; k < volts.size(); k++)
+            {
+              c.volts[axis].push_back(volts[k].toDouble());
+              c.field[axis].push_back(field[k].toDouble());
+            }
+        }
+      config.endGroup();
+    }
+  return c;
+}
+
+
+// Zooming and panning re-render the visible part of the accumulator at
+// full detail.
+void Window::xy_range_slot()
+{
+  if(frameBuilder->mode() != FRAME_OFF)
+    return;
+  refresh_colormap();
+}
+
+
+// Hands the points binned since the last call to the renderer and asks
+// for the visible range. Requests that pile up while zooming are dropped
+// by the renderer in favour of the newest.
+void Window::refresh_colormap()
+{
+  if(!xyBatch.empty())
+    {
+      QMetaObject::invokeMethod(renderer, "bin_points", Qt::QueuedConnection,
+                                Q_ARG(std::vector<double>, xyBatch), Q_ARG(qint64, (qint64)traceBlock));
+      xyBatch.clear();
+    }
+  if(frameBuilder->mode() != FRAME_OFF)
+    return;
+
+  QCPRange x = xyPlot->xAxis->range();
+  QCPRange y = xyPlot->yAxis->range();
+  renderer->pendingViews[0]++;
+  QMetaObject::invokeMethod(renderer, "render_view", Qt::QueuedConnection,
+                            Q_ARG(double, x.lower), Q_ARG(double, x.upper),
+                            Q_ARG(double, y.lower), Q_ARG(double, y.upper),
+                            Q_ARG(int, sizeBox->value()), Q_ARG(int, 0));
+}
+
+
+// Arrives ahead of the samples of a block. Closes the math span of the
+// previous block and times how long the block waited in the queue.
+void Window::block_stamp(qint64 block, qint64 sent)
+{
+  int64_t now = g_tracer.now();
+  if(mathStart)
+    g_tracer.stage(TR_MATH, traceBlock, mathStart, mathEnd);
+  mathStart  = 0;
+  traceBlock = block;
+  g_tracer.stage(TR_DEQUEUE, block, sent, now);
+}
+
+
+// Arrives ahead of the first sample captured with the settings it
+// describes, on the same connection as the samples.
+void Window::history_scales(std::vector<double> steps)
+{
+  for(int slot = 0; slot < (int)steps.size(); slot++)
+    history->set_scale(slot, steps[slot]);
+}
+
+
+// Like the scales, ahead of the first sample it applies to.
+void Window::sample_stride(int stride)
+{
+  sampleStride = stride;
+}
+
+
+void Window::replot_started()
+{
+  replotStart = g_tracer.now();
+}
+
+
+// attributed to the newest block that reached the GUI
+void Window::replot_done()
+{
+  g_tracer.stage(TR_REPLOT, traceBlock, replotStart, g_tracer.now());
+}
+
+
+// Only blits: the image is complete when it arrives. QCustomPlot only
+// draws pixmaps, so it is still copied once here.
+void Window::xy_image_slot(XY_IMAGE xy)
+{
+  if(xy.view != 0 || xy.frame != (frameBuilder->mode() != FRAME_OFF))
+    return;
+
+  xyPixmap->setPixmap(QPixmap::fromImage(xy.image));
+  xyPixmap->topLeft->setCoords(xy.x0, xy.y1);
+  xyPixmap->bottomRight->setCoords(xy.x1, xy.y0);
+  xyPlot->replot(QCustomPlot::rpQueuedReplot);
+
+  if(videoIsRunning && g_streamIsRunning && (!xy.frame || FrameWindow_Obj->scrubAge == 0))
+    {
+      xyPlot->savePng("videos/" + QString::number(videoCounter) + "/" + QString::number(frameCounter) + ".png");
+      frameCounter++;
+    }
+}
+
+
+// Blocks are published by the worker, finished XY frames from here; see
+// tools/shmreader for a client.
+void Window::publish_slot(bool on)
+{
+  g_publish = on;
+  if(on && !shmFrames)
+    shmFrames = new ShmWriter(SHM_FRAMES_NAME, (size_t)64 << 20, 1.0e6/g_sampleInterval, 1.0e-3, {"Z"});
 }
 
 
@@ -581,13 +1174,48 @@ void Window::video_button_slot()
 }
 
 
+// The worker opens a new file under recordings/ at the next block and
+// reports the compression when it closes it.
+void Window::record_button_slot()
+{
+  if(!g_record)
+    QDir().mkpath("recordings");
+  g_record = !g_record;
+  recordButton->setText(g_record ? "&Recording..." : "&Record");
+}
+
+
+void Window::replay_slot()
+{
+  if(g_streamIsRunning)
+    return;
+
+  QString path = QFileDialog::getOpenFileName(this, tr("Replay recording"), "recordings", tr("Recordings (*.lpr)"));
+  if(path.isEmpty())
+    return;
+
+  g_streamIsRunning = true;
+  streamButton->setText("&Stop");
+  emit(do_replay(path));
+}
+
+
+// replays end on their own
+void Window::stream_stopped_slot()
+{
+  streamButton->setText(g_streamIsRunning ? "&Stop" : "&Start");
+}
+
+
 void Window::data(std::vector<double> d)
 {
+  g_queuedSamples--;
+  if(!mathStart)
+    mathStart = g_tracer.now();
   data_vec = d;
   int xInd, yInd;
 
-  for(int i = X; i < Z9+1; i++)
-    timePlot->graph(i-1)->addData((double)counter, data_vec[i-1]);
+  history->append(data_vec.data(), sampleStride);
 
   for(auto e : expression_vec.keys())
     {
@@ -596,109 +1224,377 @@ void Window::data(std::vector<double> d)
       mathChannel_vec[expression_vec.value(e)] = val;
     }
 
-  colorMap->data()->coordToCell(data_vec[X-1],data_vec[Y-1],&xInd,&yInd);
-  colorMap->data()->setCell(xInd, yInd, *colorMapData_ptr);
-  counter++;
-  if(counter%3000 == 0)
+  if(frameBuilder->mode() == FRAME_OFF)
+    xyBatch.insert(xyBatch.end(), {data_vec[X-1], data_vec[Y-1], *colorMapData_ptr});
+  else
     {
-      timePlot->xAxis->setRange(counter, 800, Qt::AlignRight);
-      timePlot->replot();
-      xyPlot->replot();
+      // line and frame detection see the raw scanner signals
+      double mx, my;
+      bool   inside = frameMap->map_point(data_vec[X-1], data_vec[Y-1], &mx, &my);
+      xInd = inside ? frameMap->cell(0, mx, frameBuilder->size()) : -1;
+      yInd = inside ? frameMap->cell(1, my, frameBuilder->size()) : -1;
+      if(frameBuilder->add(xInd, yInd, data_vec[X-1], data_vec[Y-1], data_vec[frameSyncSlot], *colorMapData_ptr))
+        show_frame();
+    }
 
-      if(videoIsRunning)
-        {
-          xyPlot->savePng("videos/" + QString::number(videoCounter) + "/" + QString::number(frameCounter) + ".png");
-          frameCounter++;
-        }
+  mathEnd = g_tracer.now();
+
+  counter += sampleStride;
+  if(counter/3000 != (counter - sampleStride)/3000)
+    {
+      timePlot->xAxis->setRange(counter, 800, Qt::AlignRight);
+      refresh_history();
+      timePlot->replot(QCustomPlot::rpQueuedReplot);
+      refresh_colormap();
+      emit(views_tick());
     }
-  if(counter%1000000 == 0)
-    for(int i = 0; i < timePlot->graphCount(); i++)
-      timePlot->graph(i)->data()->clear();
 }
 
 
+// The slot graphs only ever hold what is on screen: at most a minimum and
+// maximum per pixel column of the visible range, read from the history.
+void Window::refresh_history()
+{
+  QCPRange range   = timePlot->xAxis->range();
+  int      columns = std::max(timePlot->axisRect()->width(), 1);
+  std::vector<double> keys, values;
 
-void Window::contextMenuEvent(QContextMenuEvent *event)
+  for(int slot = 0; slot < data_slots(); slot++)
+    {
+      if(!timePlot->graph(slot)->visible())
+        continue;
+      history->envelope(slot, (long long)std::floor(range.lower), (long long)std::ceil(range.upper) + 1,
+                        columns, keys, values);
+      timePlot->graph(slot)->setData(QVector<double>(keys.begin(), keys.end()),
+                                     QVector<double>(values.begin(), values.end()), true);
+    }
+}
+
+
+// Every subsystem whose memory grows with the run registers here. The math
+// graphs and the data queue have fixed reservations; the frame history and
+// the XY image keep what was chosen for them until the process nears the
+// limit. The time history, the views and the equations are only reported.
+// The history spill is held to its own limit and only counts against the
+// budget when its directory is a tmpfs.
+void Window::register_memory()
 {
-  QMenu menu(this);
-  menu.exec(event->globalPos());
+  QSettings config("live-plotter-4000", "memory");
+  g_memory.set_limit((size_t)config.value("budget", 2048).toInt() << 20);
+
+  auto mathBytes = [this]()
+  {
+    size_t points = 0;
+    for(int i = plot_graphs(); i < timePlot->graphCount(); i++)
+      points += timePlot->graph(i)->data()->size();
+    return points*sizeof(QCPGraphData);
+  };
+  g_memory.add("Math graphs", 0, (size_t)64 << 20, mathBytes,
+               [this, mathBytes](size_t allowed)
+               {
+                 // the older half of every math graph goes
+                 if(mathBytes() <= allowed)
+                   return;
+                 for(int i = plot_graphs(); i < timePlot->graphCount(); i++)
+                   {
+                     QSharedPointer<QCPGraphDataContainer> points = timePlot->graph(i)->data();
+                     if(points->size() > 1)
+                       points->removeBefore((points->constBegin() + points->size()/2)->key);
+                   }
+               });
+
+  g_memory.add("Frame history", 1, 0,
+               [this](){ return frameBuilder->bytes(); },
+               [this](size_t allowed)
+               {
+                 size_t bytes = frameBuilder->bytes();
+                 if(bytes > allowed && frameBuilder->depth() > 1)
+                   FrameWindow_Obj->limit_depth(std::max(1, (int)(frameBuilder->depth()*((double)allowed/bytes))));
+               });
+
+  g_memory.add("XY image", 2, 0,
+               [this](){ return renderer->footprint.load(); },
+               [this](size_t allowed)
+               {
+                 if(renderer->footprint > allowed && budgetBox->value() > budgetBox->minimum())
+                   budgetBox->setValue(std::max(budgetBox->minimum(), budgetBox->value()/2));
+               });
+
+  // a queued sample is its vector and the event that carries it
+  size_t sampleBytes = data_slots()*sizeof(double) + 128;
+  g_memory.add("Data queue", 3, (size_t)256 << 20,
+               [sampleBytes](){ return (size_t)std::max<int64_t>(g_queuedSamples, 0)*sampleBytes; },
+               [sampleBytes](size_t allowed){ g_queueLimit = (int64_t)(allowed/sampleBytes); });
+
+  g_memory.add("Time history", 4, 0, [this](){ return history->bytes(); });
+  spillEntry = g_memory.add("History spill", 4, (size_t)config.value("spillLimit", 4096).toInt() << 20,
+                            [this](){ return history->spilled(); },
+                            [this](size_t allowed){ history->set_spill_limit(allowed); },
+                            history->spill_resident());
+  g_memory.add("Views", 5, 0, [this]()
+               {
+                 size_t bytes = 0;
+                 for(auto v: views)
+                   bytes += v->bytes();
+                 return bytes;
+               });
+  g_memory.add("Equations", 4, 0,
+               [this]()
+               {
+                 size_t bytes = 0;
+                 for(Equation * e: *MathWindow_Obj->map)
+                   bytes += e->bytes();
+                 return bytes;
+               });
 }
 
 
-void Window::closeEvent(QCloseEvent *event)
+void Window::memory_slot()
 {
-  if(g_streamIsRunning == true)
+  g_memory.update();
+  if(g_memory.pressure() != memoryPressure)
     {
-      g_streamIsRunning = false;
-      loop->exec();
+      memoryPressure = g_memory.pressure();
+      printf("Memory: %.0f of %.0f MB in use, %s\n", g_memory.total()/1048576.0, g_memory.limit()/1048576.0,
+             memoryPressure ? "reclaiming" : "back within budget");
     }
-  for(int16_t i = 0; i < _UNITCOUNT_; i++)
-    ps4000aCloseUnit(unit[i].handle);
-  Thread_Obj.quit();
-  Thread_Obj.wait();
-  QCoreApplication::quit();
-  event->accept();
+  PipelineWindow_Obj->update_memory();
 }
 
 
+void Window::history_range_slot()
+{
+  QCPRange range = timePlot->xAxis->range();
+  viewLink->set_range(range.lower, range.upper);
+  if(g_streamIsRunning)
+    return;
+  refresh_history();
+  timePlot->replot(QCustomPlot::rpQueuedReplot);
+  emit(views_tick());
+}
+
 
-GraphWindow::GraphWindow(Window * parent)
-  : layout(new QGridLayout)
-  , parent(parent)
+// Views are kept when closed; XY views hold one of the renderer's view
+// numbers, so past the last one a closed one is opened again.
+void Window::open_view(VIEW_KIND kind)
 {
-  std::vector<std::string> labels = {"X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"};
-  for(auto p: labels)
+  int id = 0;
+  if(kind == VIEW_XY)
     {
-      QCheckBox * ptr = new QCheckBox(tr(p.c_str()));
-      layout->addWidget(ptr);
-      connect(ptr, SIGNAL(stateChanged(int)), this, SLOT(update_graphs()));
+      if(xyViews + 1 >= XY_VIEWS)
+        {
+          for(auto v: views)
+            if(v->kind == VIEW_XY && !v->isVisible())
+              {
+                v->show();
+                v->refresh();
+                return;
+              }
+          statusBar()->showMessage(tr("At most ") + QString::number(XY_VIEWS - 1) + tr(" XY views"), 5000);
+          return;
+        }
+      id = ++xyViews;
     }
+  PlotView * v = new PlotView(kind, id, this);
+  views.push_back(v);
+  v->show();
+  v->refresh();
+}
 
-  setLayout(layout);
 
-  connect(parent->show_channel_list, SIGNAL(triggered()), this, SLOT(show()));
+void Window::new_time_view_slot()
+{
+  open_view(VIEW_TIME);
 }
 
 
-void GraphWindow::update_graphs()
+void Window::new_xy_view_slot()
 {
-  int rows = layout->rowCount();
-  for(int i = 0; i < rows; i++)
-    {
-      if(dynamic_cast<QCheckBox*>(layout->itemAtPosition(i,0)->widget())->isChecked())
-        parent->timePlot->graph(i)->setVisible(true);
-      else
-        parent->timePlot->graph(i)->setVisible(false);
-    }
+  open_view(VIEW_XY);
 }
 
 
+void Window::new_spectrum_view_slot()
+{
+  open_view(VIEW_SPECTRUM);
+}
 
-MathWindow::MathWindow(Window * parent)
-  : parent(parent)
-  , layout(new QGridLayout)
-  , entryField(new QLineEdit)
-  , eval_button(new QPushButton(tr("&Eval")))
-  , map(new QMap<QString, Equation*>)
+
+// While streaming the time plot keeps scrolling on its own.
+void Window::linked_range_slot(double lower, double upper)
 {
-  layout->addWidget(entryField, 0, 0);
-  layout->addWidget(eval_button, 0, 1);
-  setLayout(layout);
+  QCPRange range = timePlot->xAxis->range();
+  if(g_streamIsRunning || (range.lower == lower && range.upper == upper))
+    return;
+  timePlot->xAxis->setRange(lower, upper);
+}
 
-  connect(eval_button, SIGNAL(clicked()), this, SLOT(eval_slot()));
-  connect(parent->show_math_channel_window, SIGNAL(triggered()), this, SLOT(show()));
+
+void Window::linked_cursor_slot(double cursor)
+{
+  timeCursor->point1->setCoords(cursor, 0.0);
+  timeCursor->point2->setCoords(cursor, 1.0);
+  timeCursor->setVisible(true);
+  timePlot->replot(QCustomPlot::rpQueuedReplot);
 }
 
 
-void MathWindow::eval_slot()
+void Window::time_cursor_slot(QMouseEvent * event)
 {
-  if(!map->contains(entryField->text()))
-    map->insert(entryField->text(), new Equation(entryField->text(), this));
+  viewLink->set_cursor(timePlot->xAxis->pixelToCoord(event->pos().x()));
 }
 
 
 
-Equation::Equation(QString equation_str, MathWindow * parent)
+// copied in place, the math channels hold pointers into measure_vec
+void Window::measurements(std::vector<double> d)
+{
+  std::copy(d.begin(), d.end(), measure_vec.begin());
+
+  if(MeasurementWindow_Obj->isVisible())
+    MeasurementWindow_Obj->update_table();
+}
+
+
+void Window::averaged(std::vector<double> mean, std::vector<double> sigma)
+{
+  QVector<double> keys(mean.size()), values(mean.begin(), mean.end()), upper(mean.size()), lower(mean.size());
+
+  for(size_t i = 0; i < mean.size(); i++)
+    {
+      keys[i]  = (double)(i*g_sampleInterval);
+      upper[i] = mean[i] + sigma[i];
+      lower[i] = mean[i] - sigma[i];
+    }
+
+  timePlot->graph(average_graph())->setData(keys, values, true);
+  timePlot->graph(average_graph()+1)->setData(keys, upper, true);
+  timePlot->graph(average_graph()+2)->setData(keys, lower, true);
+  timePlot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+void Window::phosphor(QImage image)
+{
+  phosphorPixmap->setPixmap(QPixmap::fromImage(image));
+  timePlot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+// Sends one finished frame to the renderer, so the display and the video
+// only ever see whole frames.
+void Window::show_frame()
+{
+  std::vector<double> frame;
+  if(FrameWindow_Obj->averageCount > 1)
+    frameBuilder->average(FrameWindow_Obj->averageCount, frame);
+  else
+    frame = frameBuilder->history(FrameWindow_Obj->scrubAge);
+
+  int size = frameBuilder->size();
+  if(g_publish && shmFrames && FrameWindow_Obj->scrubAge == 0)
+    shmFrames->publish_frame(frameBuilder->frame_count(), frame.data(), size, size);
+  QMetaObject::invokeMethod(renderer, "render_frame", Qt::QueuedConnection,
+                            Q_ARG(std::vector<double>, frame), Q_ARG(int, size),
+                            Q_ARG(double, scanX.lower), Q_ARG(double, scanX.upper),
+                            Q_ARG(double, scanY.lower), Q_ARG(double, scanY.upper));
+
+  if(FrameWindow_Obj->isVisible())
+    FrameWindow_Obj->update_status();
+}
+
+
+
+void Window::contextMenuEvent(QContextMenuEvent *event)
+{
+  QMenu menu(this);
+  menu.exec(event->globalPos());
+}
+
+
+void Window::closeEvent(QCloseEvent *event)
+{
+  if(g_streamIsRunning == true)
+    {
+      g_streamIsRunning = false;
+      loop->exec();
+    }
+  save_unit_config();
+  for(int16_t i = 0; i < _UNITCOUNT_; i++)
+    {
+      int16_t handle = unit[i].handle;
+      unit[i].queue->run([handle]{ ps4000aCloseUnit(handle); });
+      delete unit[i].queue;
+    }
+  Thread_Obj.quit();
+  Thread_Obj.wait();
+  renderThread.quit();
+  renderThread.wait();
+  QCoreApplication::quit();
+  event->accept();
+}
+
+
+
+GraphWindow::GraphWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+{
+  // one check box per slot, in columns of 20
+  std::vector<std::string> labels = slot_labels();
+  for(size_t i = 0; i < labels.size(); i++)
+    {
+      QCheckBox * ptr = new QCheckBox(tr(labels[i].c_str()));
+      layout->addWidget(ptr, i%20, i/20);
+      connect(ptr, SIGNAL(stateChanged(int)), this, SLOT(update_graphs()));
+    }
+
+  setLayout(layout);
+
+  connect(parent->show_channel_list, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void GraphWindow::update_graphs()
+{
+  for(int i = 0; i < layout->count(); i++)
+    {
+      if(dynamic_cast<QCheckBox*>(layout->itemAt(i)->widget())->isChecked())
+        parent->timePlot->graph(i)->setVisible(true);
+      else
+        parent->timePlot->graph(i)->setVisible(false);
+    }
+  parent->refresh_history();
+  parent->timePlot->replot();
+}
+
+
+
+MathWindow::MathWindow(Window * parent)
+  : parent(parent)
+  , layout(new QGridLayout)
+  , entryField(new QLineEdit)
+  , eval_button(new QPushButton(tr("&Eval")))
+  , map(new QMap<QString, Equation*>)
+{
+  layout->addWidget(entryField, 0, 0);
+  layout->addWidget(eval_button, 0, 1);
+  setLayout(layout);
+
+  connect(eval_button, SIGNAL(clicked()), this, SLOT(eval_slot()));
+  connect(parent->show_math_channel_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void MathWindow::eval_slot()
+{
+  if(!map->contains(entryField->text()))
+    map->insert(entryField->text(), new Equation(entryField->text(), this));
+}
+
+
+
+Equation::Equation(QString equation_str, MathWindow * parent)
   : parent(parent)
   , equation_str(equation_str)
   , layout(new QGridLayout)
@@ -710,11 +1606,14 @@ Equation::Equation(QString equation_str, MathWindow * parent)
 {
   int i = 0;
   QVector<QString>            tracker;
-  for(auto c: equation_str)
+  QRegExp                     px("\\b[a-m]\\b");
+  int                         ppos = 0;
+  while((ppos = px.indexIn(equation_str, ppos)) != -1)
     {
-      QString str(c);
+      QString str = px.cap(0);
+      ppos += px.matchedLength();
 
-      if(str.contains(QRegExp("[a-m]")) && !tracker.contains(str))
+      if(!tracker.contains(str))
         {
           tracker.push_back(str);
 
@@ -724,7 +1623,7 @@ Equation::Equation(QString equation_str, MathWindow * parent)
           slider->setSliderPosition(2);
           layout->addWidget(slider, 1, layout->columnCount());
           slider->show();
-          connect(slider, &QSlider::valueChanged, [this, slider, equation_str, i, c](){this->params[i] = (double)slider->value();});
+          connect(slider, &QSlider::valueChanged, [this, slider, i](){this->params[i] = (double)slider->value();});
 
           QLabel *  label  = new QLabel(str, this);
           layout->addWidget(label, 0, layout->columnCount());
@@ -735,28 +1634,25 @@ Equation::Equation(QString equation_str, MathWindow * parent)
         }
     }
 
-  QRegExp rx("[x-z][0-7]");
-  int pos = 0;
-  QStringList list;
-  while(((pos = rx.indexIn(equation_str, pos)) != -1) && !tracker.contains(rx.cap(0)))
-    {
-      tracker.push_back(rx.cap(0));
-      std::string str = rx.cap(0).toStdString().c_str();
-      if(str=="x0"){symbol_table->add_variable(str, parent->parent->data_vec[X-1]);}
-      if(str=="y0"){symbol_table->add_variable(str, parent->parent->data_vec[Y-1]);}
-      if(str=="z0"){symbol_table->add_variable(str, parent->parent->data_vec[Z0-1]);}
-      if(str=="z1"){symbol_table->add_variable(str, parent->parent->data_vec[Z1-1]);}
-      if(str=="z2"){symbol_table->add_variable(str, parent->parent->data_vec[Z2-1]);}
-      if(str=="z3"){symbol_table->add_variable(str, parent->parent->data_vec[Z3-1]);}
-      if(str=="z4"){symbol_table->add_variable(str, parent->parent->data_vec[Z4-1]);}
-      if(str=="z5"){symbol_table->add_variable(str, parent->parent->data_vec[Z5-1]);}
-      if(str=="z6"){symbol_table->add_variable(str, parent->parent->data_vec[Z6-1]);}
-      if(str=="z7"){symbol_table->add_variable(str, parent->parent->data_vec[Z7-1]);}
-      if(str=="z8"){symbol_table->add_variable(str, parent->parent->data_vec[Z8-1]);}
-      if(str=="z9"){symbol_table->add_variable(str, parent->parent->data_vec[Z9-1]);}
-      pos += rx.matchedLength();
+  // every slot by its variable name, e.g. x0, z3, l0_r, p1 or u1_c
+  for(int slot = 0; slot < data_slots(); slot++)
+    {
+      std::string str = slot_variable(slot);
+      if(equation_str.contains(QRegExp(QString::fromStdString("\\b" + str + "\\b"))))
+        symbol_table->add_variable(str, parent->parent->data_vec[slot]);
     }
 
+  // measurements as <name>_<slot> over the window, <name>_<slot>_all since start
+  std::vector<std::string> names = {"mean", "rms", "min", "max", "pp", "freq", "duty"};
+  for(int slot = 0; slot < data_slots(); slot++)
+    for(int m = 0; m < M_VALUES; m++)
+      for(int all = 0; all < 2; all++)
+        {
+          std::string str = names[m] + "_" + slot_variable(slot) + (all ? "_all" : "");
+          if(equation_str.contains(QRegExp(QString::fromStdString("\\b" + str + "\\b"))))
+            symbol_table->add_variable(str, parent->parent->measure_vec[slot*2*M_VALUES + all*M_VALUES + m]);
+        }
+
   expression->register_symbol_table(*symbol_table);
   if(!parser->compile(equation_str.toStdString(), *expression))
     printf("Error: %s\n", parser->error().c_str());
@@ -771,36 +1667,1548 @@ Equation::Equation(QString equation_str, MathWindow * parent)
 }
 
 
+size_t Equation::bytes()
+{
+  return params.capacity()*sizeof(double);
+}
 
-ColorMapDataChooser::ColorMapDataChooser(Window * parent)
-  : parent(parent)
-  , layout(new QVBoxLayout)
+
+
+LockInWindow::LockInWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , referenceBox(new QComboBox)
+  , frequencyBox(new QDoubleSpinBox)
+  , bandwidthBox(new QDoubleSpinBox)
+  , timeConstantBox(new QDoubleSpinBox)
+  , orderBox(new QSpinBox)
+  , decimationBox(new QSpinBox)
+  , signalBox(new TypeBox[LOCKIN_SIGNALS])
+  , apply_button(new QPushButton(tr("&Apply")))
 {
-  std::vector<std::string> labels = {"X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"};
+  std::vector<std::string> labels = {"Oscillator", "X", "Y", "Z0", "Z1", "Z2", "Z3", "Z4", "Z5", "Z6", "Z7", "Z8", "Z9"};
   for(auto p: labels)
+    referenceBox->addItem(tr(p.c_str()));
+
+  frequencyBox->setRange(0.001, 0.5e6/(double)g_sampleInterval);
+  frequencyBox->setValue(1000.0);
+  frequencyBox->setSuffix(" Hz");
+  bandwidthBox->setRange(0.01, 1000.0);
+  bandwidthBox->setValue(10.0);
+  bandwidthBox->setSuffix(" Hz");
+  timeConstantBox->setDecimals(4);
+  timeConstantBox->setRange(0.0001, 10.0);
+  timeConstantBox->setValue(0.01);
+  timeConstantBox->setSuffix(" s");
+  orderBox->setRange(1, 4);
+  orderBox->setValue(2);
+  decimationBox->setRange(1, 10000);
+  decimationBox->setValue(10);
+  decimationBox->setPrefix("1/");
+
+  layout->addWidget(new QLabel(tr("Reference")), 0, 0);
+  layout->addWidget(referenceBox, 0, 1);
+  layout->addWidget(new QLabel(tr("Frequency")), 1, 0);
+  layout->addWidget(frequencyBox, 1, 1);
+  layout->addWidget(new QLabel(tr("PLL Bandwidth")), 2, 0);
+  layout->addWidget(bandwidthBox, 2, 1);
+  layout->addWidget(new QLabel(tr("Time Constant")), 3, 0);
+  layout->addWidget(timeConstantBox, 3, 1);
+  layout->addWidget(new QLabel(tr("Filter Order")), 4, 0);
+  layout->addWidget(orderBox, 4, 1);
+  layout->addWidget(new QLabel(tr("Decimation")), 5, 0);
+  layout->addWidget(decimationBox, 5, 1);
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
     {
-      QRadioButton * ptr = new QRadioButton(tr(p.c_str()), this);
-      layout->addWidget(ptr);
-      connect(ptr, &QRadioButton::toggled, this, &ColorMapDataChooser::check_buttons_channel);
+      layout->addWidget(new QLabel("L" + QString::number(k)), 6+k, 0);
+      layout->addWidget(signalBox+k, 6+k, 1);
     }
+  layout->addWidget(apply_button, 6+LOCKIN_SIGNALS, 1);
   setLayout(layout);
-  connect(parent->ColorMapDataChooser_Action, SIGNAL(triggered()), this, SLOT(show()));
+
+  connect(apply_button, SIGNAL(clicked()), this, SLOT(apply_slot()));
+  connect(this, SIGNAL(lockin_settings_changed(LOCKIN_SETTINGS)), parent->Worker_Obj, SLOT(set_lockin(LOCKIN_SETTINGS)));
+  connect(parent->show_lockin_window, SIGNAL(triggered()), this, SLOT(show()));
 }
 
 
-void ColorMapDataChooser::check_buttons_channel()
+void LockInWindow::apply_slot()
 {
-  for(int i = X; i < Z9+1; i++)
-    if(((QRadioButton*)layout->itemAt(i-1)->widget())->isChecked())
-      parent->colorMapData_ptr = (double*)&parent->data_vec[i-1];
+  LOCKIN_SETTINGS settings;
+  settings.reference    = referenceBox->currentIndex();
+  settings.frequency    = frequencyBox->value();
+  settings.bandwidth    = bandwidthBox->value();
+  settings.timeConstant = timeConstantBox->value();
+  settings.order        = orderBox->value();
+  settings.decimation   = decimationBox->value();
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    settings.signal[k] = signalBox[k].currentIndex();
+
+  // the worker only picks the settings up between streams
+  bool stream_was_running_flag = g_streamIsRunning;
+  if(stream_was_running_flag)
+    {
+      parent->stream_button_slot();
+      parent->loop->exec();
+    }
+
+  emit(lockin_settings_changed(settings));
+
+  for(int k = 0; k < LOCKIN_SIGNALS; k++)
+    for(int o = 0; o < LI_OUTPUTS; o++)
+      parent->timePlot->graph(Z9 + k*LI_OUTPUTS + o)->setVisible(settings.signal[k] != OFF);
+
+  if(stream_was_running_flag)
+    parent->stream_button_slot();
 }
 
 
-void ColorMapDataChooser::check_buttons_math()
+
+MeasurementWindow::MeasurementWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , table(new QTableWidget(data_slots(), M_VALUES))
+  , windowBox(new QDoubleSpinBox)
+  , sinceStartBox(new QCheckBox(tr("Since Start")))
+  , reset_button(new QPushButton(tr("&Reset")))
 {
-  for(int i = Z9; i < expression_vec.size()+Z9; i++)
-    if(((QRadioButton*)layout->itemAt(i)->widget())->isChecked())
-      parent->colorMapData_ptr = &parent->mathChannel_vec[i];
+  QStringList columns = {"Mean", "RMS", "Min", "Max", "Pk-Pk", "Freq", "Duty"};
+  QStringList rows;
+  for(auto p: slot_labels())
+    rows << tr(p.c_str());
+  table->setHorizontalHeaderLabels(columns);
+  table->setVerticalHeaderLabels(rows);
+  table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  for(int slot = 0; slot < data_slots(); slot++)
+    for(int m = 0; m < M_VALUES; m++)
+      table->setItem(slot, m, new QTableWidgetItem);
+
+  windowBox->setRange(0.01, 3600.0);
+  windowBox->setValue(g_measureWindow);
+  windowBox->setSuffix(" s");
+
+  layout->addWidget(table, 0, 0, 1, 3);
+  layout->addWidget(windowBox, 1, 0);
+  layout->addWidget(sinceStartBox, 1, 1);
+  layout->addWidget(reset_button, 1, 2);
+  setLayout(layout);
+  resize(700, 500);
+
+  connect(windowBox, SIGNAL(valueChanged(double)), this, SLOT(set_window_slot(double)));
+  connect(reset_button, SIGNAL(clicked()), this, SLOT(reset_slot()));
+  connect(sinceStartBox, SIGNAL(stateChanged(int)), this, SLOT(update_table()));
+  connect(parent->show_measurement_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+// Unit of the level measurements of a slot: lock-in phases are in rad,
+// plug-in outputs in whatever the plug-in makes of its input.
+static QString level_unit(int slot)
+{
+  const CHANNEL_ENTRY & e = g_channels.entry(slot);
+  if(e.kind == CH_LOCKIN && e.label.size() > 6 && e.label.compare(e.label.size() - 6, 6, ".Theta") == 0)
+    return " rad";
+  if(e.kind == CH_PLUGIN)
+    return "";
+  return " mV";
+}
+
+
+void MeasurementWindow::update_table()
+{
+  int offset = sinceStartBox->isChecked() ? M_VALUES : 0;
+
+  for(int slot = 0; slot < data_slots(); slot++)
+    for(int m = 0; m < M_VALUES; m++)
+      {
+        double value = parent->measure_vec[slot*2*M_VALUES + offset + m];
+        QString str  = m == M_FREQ ? QString::number(value, 'f', 2) + " Hz" :
+                       m == M_DUTY ? QString::number(value*100.0, 'f', 1) + " %" :
+                                     QString::number(value, 'f', 4) + level_unit(slot);
+        table->item(slot, m)->setText(str);
+      }
+}
+
+
+void MeasurementWindow::set_window_slot(double seconds)
+{
+  g_measureWindow = seconds;
+}
+
+
+void MeasurementWindow::reset_slot()
+{
+  g_measureReset = true;
+}
+
+
+
+AverageWindow::AverageWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , sourceBox(new QComboBox)
+  , triggerBox(new QComboBox)
+  , levelBox(new QDoubleSpinBox)
+  , edgeBox(new QComboBox)
+  , lengthBox(new QSpinBox)
+  , modeBox(new QComboBox)
+  , sweepsBox(new QSpinBox)
+  , apply_button(new QPushButton(tr("&Apply")))
+  , reset_button(new QPushButton(tr("&Reset")))
+{
+  sourceBox->addItem(tr("Off"));
+  for(auto p: slot_labels())
+    {
+      sourceBox->addItem(tr(p.c_str()));
+      triggerBox->addItem(tr(p.c_str()));
+    }
+  levelBox->setRange(-50000.0, 50000.0);
+  levelBox->setSuffix(" mV");
+  edgeBox->addItem(tr("Rising"));
+  edgeBox->addItem(tr("Falling"));
+  lengthBox->setRange(2, 1000000);
+  lengthBox->setValue(1000);
+  lengthBox->setSuffix(" Samples");
+  modeBox->addItem(tr("Count"));
+  modeBox->addItem(tr("Exponential"));
+  sweepsBox->setRange(1, 1000000);
+  sweepsBox->setValue(100);
+
+  layout->addWidget(new QLabel(tr("Signal")), 0, 0);
+  layout->addWidget(sourceBox, 0, 1);
+  layout->addWidget(new QLabel(tr("Trigger")), 1, 0);
+  layout->addWidget(triggerBox, 1, 1);
+  layout->addWidget(new QLabel(tr("Level")), 2, 0);
+  layout->addWidget(levelBox, 2, 1);
+  layout->addWidget(new QLabel(tr("Edge")), 3, 0);
+  layout->addWidget(edgeBox, 3, 1);
+  layout->addWidget(new QLabel(tr("Sweep Length")), 4, 0);
+  layout->addWidget(lengthBox, 4, 1);
+  layout->addWidget(new QLabel(tr("Weighting")), 5, 0);
+  layout->addWidget(modeBox, 5, 1);
+  layout->addWidget(new QLabel(tr("Sweeps")), 6, 0);
+  layout->addWidget(sweepsBox, 6, 1);
+  layout->addWidget(reset_button, 7, 0);
+  layout->addWidget(apply_button, 7, 1);
+  setLayout(layout);
+
+  connect(apply_button, SIGNAL(clicked()), this, SLOT(apply_slot()));
+  connect(reset_button, SIGNAL(clicked()), this, SLOT(reset_slot()));
+  connect(this, SIGNAL(average_settings_changed(AVERAGE_SETTINGS)), parent->Worker_Obj, SLOT(set_average(AVERAGE_SETTINGS)));
+  connect(parent->show_average_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void AverageWindow::apply_slot()
+{
+  AVERAGE_SETTINGS settings;
+  settings.source  = sourceBox->currentIndex() - 1;
+  settings.trigger = triggerBox->currentIndex();
+  settings.level   = levelBox->value();
+  settings.rising  = edgeBox->currentIndex() == 0;
+  settings.length  = lengthBox->value();
+  settings.mode    = (AVERAGE_MODE)modeBox->currentIndex();
+  settings.sweeps  = sweepsBox->value();
+
+  bool stream_was_running_flag = g_streamIsRunning;
+  if(stream_was_running_flag)
+    {
+      parent->stream_button_slot();
+      parent->loop->exec();
+    }
+
+  emit(average_settings_changed(settings));
+
+  // the top axis stops following the scrolling time axis while averaging
+  QCustomPlot * plot = parent->timePlot;
+  disconnect(plot->xAxis, SIGNAL(rangeChanged(QCPRange)), plot->xAxis2, SLOT(setRange(QCPRange)));
+  if(settings.source >= 0)
+    {
+      plot->xAxis2->setTickLabels(true);
+      plot->xAxis2->setRange(0.0, (double)settings.length*g_sampleInterval);
+    }
+  else
+    {
+      plot->xAxis2->setTickLabels(false);
+      connect(plot->xAxis, SIGNAL(rangeChanged(QCPRange)), plot->xAxis2, SLOT(setRange(QCPRange)));
+    }
+  for(int i = average_graph(); i < plot_graphs(); i++)
+    {
+      plot->graph(i)->data()->clear();
+      plot->graph(i)->setVisible(settings.source >= 0);
+    }
+  plot->replot();
+
+  if(stream_was_running_flag)
+    parent->stream_button_slot();
+}
+
+
+void AverageWindow::reset_slot()
+{
+  g_averageReset = true;
+}
+
+
+
+PhosphorWindow::PhosphorWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , sourceBox(new QComboBox)
+  , widthBox(new QSpinBox)
+  , heightBox(new QSpinBox)
+  , spanBox(new QSpinBox)
+  , persistenceBox(new QDoubleSpinBox)
+  , triggerBox(new QCheckBox(tr("Trigger")))
+  , levelBox(new QDoubleSpinBox)
+  , apply_button(new QPushButton(tr("&Apply")))
+{
+  sourceBox->addItem(tr("Off"));
+  for(auto p: slot_labels())
+    sourceBox->addItem(tr(p.c_str()));
+  widthBox->setRange(16, 4096);
+  widthBox->setValue(400);
+  heightBox->setRange(16, 4096);
+  heightBox->setValue(256);
+  spanBox->setRange(2, 10000000);
+  spanBox->setValue(800);
+  spanBox->setSuffix(" Samples");
+  persistenceBox->setRange(0.0, 100.0);
+  persistenceBox->setValue(0.5);
+  persistenceBox->setSuffix(" s");
+  levelBox->setRange(-50000.0, 50000.0);
+  levelBox->setSuffix(" mV");
+
+  layout->addWidget(new QLabel(tr("Signal")), 0, 0);
+  layout->addWidget(sourceBox, 0, 1);
+  layout->addWidget(new QLabel(tr("Width")), 1, 0);
+  layout->addWidget(widthBox, 1, 1);
+  layout->addWidget(new QLabel(tr("Height")), 2, 0);
+  layout->addWidget(heightBox, 2, 1);
+  layout->addWidget(new QLabel(tr("Span")), 3, 0);
+  layout->addWidget(spanBox, 3, 1);
+  layout->addWidget(new QLabel(tr("Persistence")), 4, 0);
+  layout->addWidget(persistenceBox, 4, 1);
+  layout->addWidget(triggerBox, 5, 0);
+  layout->addWidget(levelBox, 5, 1);
+  layout->addWidget(apply_button, 6, 1);
+  setLayout(layout);
+
+  connect(apply_button, SIGNAL(clicked()), this, SLOT(apply_slot()));
+  connect(this, SIGNAL(phosphor_settings_changed(PHOSPHOR_SETTINGS)), parent->Worker_Obj, SLOT(set_phosphor(PHOSPHOR_SETTINGS)));
+  connect(parent->show_phosphor_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void PhosphorWindow::apply_slot()
+{
+  QCustomPlot * plot = parent->timePlot;
+
+  PHOSPHOR_SETTINGS settings;
+  settings.source      = sourceBox->currentIndex() - 1;
+  settings.width       = widthBox->value();
+  settings.height      = heightBox->value();
+  settings.span        = spanBox->value();
+  settings.min         = plot->yAxis->range().lower;
+  settings.max         = plot->yAxis->range().upper;
+  settings.persistence = persistenceBox->value();
+  settings.trigger     = triggerBox->isChecked();
+  settings.level       = levelBox->value();
+
+  bool stream_was_running_flag = g_streamIsRunning;
+  if(stream_was_running_flag)
+    {
+      parent->stream_button_slot();
+      parent->loop->exec();
+    }
+
+  emit(phosphor_settings_changed(settings));
+
+  // the image replaces the line graphs while it is shown
+  bool enable = settings.source >= 0;
+  if(enable && !parent->phosphorPixmap->visible())
+    {
+      graphVisible.clear();
+      for(int i = 0; i < plot->graphCount(); i++)
+        {
+          graphVisible.push_back(plot->graph(i)->visible());
+          plot->graph(i)->setVisible(false);
+        }
+    }
+  if(!enable && parent->phosphorPixmap->visible())
+    for(int i = 0; i < (int)graphVisible.size() && i < plot->graphCount(); i++)
+      plot->graph(i)->setVisible(graphVisible[i]);
+  parent->phosphorPixmap->setVisible(enable);
+  plot->replot();
+
+  if(stream_was_running_flag)
+    parent->stream_button_slot();
+}
+
+
+
+FrameWindow::FrameWindow(Window * parent)
+  : layout(new QGridLayout)
+  , scrubAge(0)
+  , averageCount(1)
+  , parent(parent)
+  , modeBox(new QComboBox)
+  , syncBox(new QComboBox)
+  , levelBox(new QDoubleSpinBox)
+  , depthBox(new QSpinBox)
+  , scrubSlider(new QSlider(Qt::Horizontal))
+  , averageBox(new QSpinBox)
+  , statusLabel(new QLabel)
+{
+  modeBox->addItem(tr("Free Run"));
+  modeBox->addItem(tr("Y Flyback"));
+  modeBox->addItem(tr("Sync Channel"));
+  for(auto p: slot_labels())
+    syncBox->addItem(tr(p.c_str()));
+  levelBox->setRange(-50000.0, 50000.0);
+  levelBox->setSuffix(" mV");
+  depthBox->setRange(1, 1000);
+  depthBox->setValue(parent->frameBuilder->depth());
+  scrubSlider->setRange(0, parent->frameBuilder->depth() - 1);
+  scrubSlider->setInvertedAppearance(true);
+  averageBox->setRange(1, parent->frameBuilder->depth());
+  averageBox->setPrefix("Average ");
+
+  layout->addWidget(new QLabel(tr("Frame Start")), 0, 0);
+  layout->addWidget(modeBox, 0, 1);
+  layout->addWidget(new QLabel(tr("Sync")), 1, 0);
+  layout->addWidget(syncBox, 1, 1);
+  layout->addWidget(new QLabel(tr("Level")), 2, 0);
+  layout->addWidget(levelBox, 2, 1);
+  layout->addWidget(new QLabel(tr("History")), 3, 0);
+  layout->addWidget(depthBox, 3, 1);
+  layout->addWidget(new QLabel(tr("Frame")), 4, 0);
+  layout->addWidget(scrubSlider, 4, 1);
+  layout->addWidget(averageBox, 5, 1);
+  layout->addWidget(statusLabel, 6, 0, 1, 2);
+  setLayout(layout);
+
+  connect(modeBox, SIGNAL(currentIndexChanged(int)), this, SLOT(set_mode_slot()));
+  connect(syncBox, SIGNAL(currentIndexChanged(int)), this, SLOT(set_mode_slot()));
+  connect(levelBox, SIGNAL(valueChanged(double)), this, SLOT(set_mode_slot()));
+  connect(depthBox, SIGNAL(valueChanged(int)), this, SLOT(set_depth_slot(int)));
+  connect(scrubSlider, SIGNAL(valueChanged(int)), this, SLOT(scrub_slot()));
+  connect(averageBox, SIGNAL(valueChanged(int)), this, SLOT(scrub_slot()));
+  connect(parent->show_frame_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void FrameWindow::set_mode_slot()
+{
+  parent->frameSyncSlot = syncBox->currentIndex();
+  parent->frameBuilder->set_mode((FRAME_MODE)modeBox->currentIndex(), levelBox->value());
+  parent->refresh_colormap();
+  parent->xyPlot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+// The memory governor shortens the history through the box, so the
+// window shows the depth that is actually kept.
+void FrameWindow::limit_depth(int depth)
+{
+  depthBox->setValue(depth);
+}
+
+
+void FrameWindow::set_depth_slot(int depth)
+{
+  parent->frameBuilder->resize(parent->frameBuilder->size(), depth);
+  scrubSlider->setRange(0, depth - 1);
+  averageBox->setRange(1, depth);
+}
+
+
+// age 0 is the live frame, older frames are replayed from the history
+void FrameWindow::scrub_slot()
+{
+  scrubAge     = scrubSlider->value();
+  averageCount = averageBox->value();
+  if(parent->frameBuilder->frames())
+    parent->show_frame();
+}
+
+
+void FrameWindow::update_status()
+{
+  statusLabel->setText(tr("Frames: ") + QString::number(parent->frameBuilder->frame_count()) +
+                       tr("    Lines: ") + QString::number(parent->frameBuilder->lines()) +
+                       tr("    Stored: ") + QString::number(parent->frameBuilder->frames()));
+}
+
+
+
+ScanWindow::ScanWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , delayBox(new QSpinBox)
+  , fitButton(new QPushButton(tr("&Fit from Recording...")))
+  , linearButton(new QPushButton(tr("&Linear")))
+  , statusLabel(new QLabel)
+{
+  delayBox->setRange(0, SCANMAP_MAXDELAY);
+  delayBox->setSuffix(tr(" samples"));
+  delayBox->setToolTip(tr("How many samples the detector lags the X and Y signals"));
+  fitButton->setToolTip(tr("Fit range, linearity and delay to a recorded scan with X, Y and a detector channel"));
+
+  layout->addWidget(new QLabel(tr("Detector Delay")), 0, 0);
+  layout->addWidget(delayBox, 0, 1);
+  layout->addWidget(fitButton, 1, 0);
+  layout->addWidget(linearButton, 1, 1);
+  layout->addWidget(statusLabel, 2, 0, 1, 2);
+  setLayout(layout);
+
+  connect(delayBox, SIGNAL(valueChanged(int)), this, SLOT(set_delay_slot(int)));
+  connect(fitButton, SIGNAL(clicked()), this, SLOT(fit_slot()));
+  connect(linearButton, SIGNAL(clicked()), this, SLOT(linear_slot()));
+  connect(parent->show_scan_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+void ScanWindow::update_status()
+{
+  const SCAN_CALIBRATION & c = parent->scanCalibration;
+  delayBox->blockSignals(true);
+  delayBox->setValue(c.delay);
+  delayBox->blockSignals(false);
+
+  bool fitted = !c.volts[0].empty() || !c.volts[1].empty();
+  statusLabel->setText((fitted ? tr("Fitted, ") + QString::number(c.volts[0].size()) + "/" +
+                                 QString::number(c.volts[1].size()) + tr(" knots") : tr("Linear")) +
+                       tr("\nX ") + QString::number(c.lo[0], 'f', 1) + " .. " + QString::number(c.hi[0], 'f', 1) + " mV" +
+                       tr("\nY ") + QString::number(c.lo[1], 'f', 1) + " .. " + QString::number(c.hi[1], 'f', 1) + " mV" +
+                       tr("\nDelay ") + QString::number(c.delay*(double)g_sampleInterval, 'f', 0) + " us");
+}
+
+
+void ScanWindow::set_delay_slot(int delay)
+{
+  SCAN_CALIBRATION c = parent->scanCalibration;
+  c.delay = delay;
+  parent->apply_calibration(c);
+}
+
+
+// Keeps the range, so the channel ranges take over again with their next
+// change.
+void ScanWindow::linear_slot()
+{
+  const SCAN_CALIBRATION & now = parent->scanCalibration;
+  SCAN_CALIBRATION c = ScanMap::linear(now.lo[0], now.hi[0], now.lo[1], now.hi[1]);
+  c.delay = now.delay;
+  parent->apply_calibration(c);
+}
+
+
+// The detector is the XY colour source if it was recorded, otherwise the
+// first recorded Z role. Reading the recording and the fit run on a pool
+// thread; fitted_slot takes the result.
+void ScanWindow::fit_slot()
+{
+  QString path = QFileDialog::getOpenFileName(this, tr("Calibration scan"), "recordings", tr("Recordings (*.lpr)"));
+  if(path.isEmpty())
+    return;
+
+  Playback playback;
+  if(!playback.open(path.toStdString()))
+    {
+      statusLabel->setText(tr("Cannot read ") + path);
+      return;
+    }
+
+  int source = -1;
+  for(int slot = 0; slot < data_slots(); slot++)
+    if(&parent->data_vec[slot] == parent->colorMapData_ptr)
+      source = slot;
+
+  int cx = -1, cy = -1, cz = -1, cs = -1;
+  for(int c = 0; c < playback.channels(); c++)
+    {
+      int slot = playback.channel(c).slot;
+      if(slot == X-1)
+        cx = c;
+      if(slot == Y-1)
+        cy = c;
+      if(slot >= Z0-1 && slot < LOCKIN_SLOT && cz < 0)
+        cz = c;
+      if(slot >= 0 && slot == source)
+        cs = c;
+    }
+  if(cs >= 0)
+    cz = cs;
+  if(cx < 0 || cy < 0 || cz < 0)
+    {
+      statusLabel->setText(tr("The recording needs X, Y and a Z channel"));
+      return;
+    }
+
+  fitButton->setEnabled(false);
+  statusLabel->setText(tr("Fitting..."));
+  QtConcurrent::run([this, path, cx, cy, cz]()
+  {
+    Playback playback;
+    playback.open(path.toStdString());
+
+    int n = (int)std::min<uint64_t>(playback.samples(), (uint64_t)1 << 21);
+    std::vector<double> x(n), y(n), z(n);
+    std::vector<std::vector<int16_t>> counts(playback.channels(), std::vector<int16_t>(REC_BLOCK));
+    std::vector<int16_t *>            out(playback.channels());
+    for(int c = 0; c < playback.channels(); c++)
+      out[c] = counts[c].data();
+
+    int read = 0;
+    while(read < n)
+      {
+        int got = playback.read(read, std::min(REC_BLOCK, n - read), out.data());
+        if(got <= 0)
+          break;
+        for(int i = 0; i < got; i++)
+          {
+            x[read+i] = counts[cx][i]*playback.channel(cx).scale;
+            y[read+i] = counts[cy][i]*playback.channel(cy).scale;
+            z[read+i] = counts[cz][i]*playback.channel(cz).scale;
+          }
+        read += got;
+      }
+
+    SCAN_CALIBRATION c = ScanMap::fit(x.data(), y.data(), z.data(), read);
+    QMetaObject::invokeMethod(this, "fitted_slot", Qt::QueuedConnection,
+                              Q_ARG(SCAN_CALIBRATION, c), Q_ARG(QString, path), Q_ARG(int, read));
+  });
+}
+
+
+void ScanWindow::fitted_slot(SCAN_CALIBRATION c, QString path, int read)
+{
+  fitButton->setEnabled(true);
+  parent->apply_calibration(c);
+  printf("Scan calibration from %s (%d samples): x %.1f..%.1f mV, y %.1f..%.1f mV, delay %d samples\n",
+         path.toLocal8Bit().constData(), read, c.lo[0], c.hi[0], c.lo[1], c.hi[1], c.delay);
+}
+
+
+
+ColorMapDataChooser::ColorMapDataChooser(Window * parent)
+  : parent(parent)
+  , layout(new QVBoxLayout)
+{
+  std::vector<std::string> labels = slot_labels();
+  for(auto p: labels)
+    {
+      QRadioButton * ptr = new QRadioButton(tr(p.c_str()), this);
+      layout->addWidget(ptr);
+      connect(ptr, &QRadioButton::toggled, this, &ColorMapDataChooser::check_buttons_channel);
+    }
+  setLayout(layout);
+  connect(parent->ColorMapDataChooser_Action, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+AlarmWindow::AlarmWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , ruleTable(new QTableWidget(0, 8))
+  , eventTable(new QTableWidget(0, 6))
+  , addButton(new QPushButton(tr("&Add")))
+  , removeButton(new QPushButton(tr("&Remove")))
+  , applyButton(new QPushButton(tr("A&pply")))
+  , clearButton(new QPushButton(tr("&Clear Log")))
+  , statusLabel(new QLabel)
+  , logFile(nullptr)
+  , eventCount(0)
+{
+  ruleTable->setHorizontalHeaderLabels({tr("Name"), tr("Source"), tr("Kind"), tr("Level mV"),
+                                        tr("Upper mV"), tr("Hold ms"), tr("Hysteresis mV"), tr("On")});
+  ruleTable->setToolTip(tr("Source is a slot variable such as z0 or u1_c, or a math expression of them.\n"
+                           "Levels are in mV, rates in mV/s; Upper only applies to Outside."));
+  eventTable->setHorizontalHeaderLabels({tr("Time"), tr("Sample"), tr("Rule"), tr("Event"),
+                                         tr("Value"), tr("Latency")});
+  eventTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+
+  layout->addWidget(ruleTable, 0, 0, 1, 4);
+  layout->addWidget(addButton, 1, 0);
+  layout->addWidget(removeButton, 1, 1);
+  layout->addWidget(applyButton, 1, 2);
+  layout->addWidget(clearButton, 1, 3);
+  layout->addWidget(statusLabel, 2, 0, 1, 4);
+  layout->addWidget(eventTable, 3, 0, 1, 4);
+  setLayout(layout);
+  resize(720, 600);
+
+  connect(addButton, SIGNAL(clicked()), this, SLOT(add_slot()));
+  connect(removeButton, SIGNAL(clicked()), this, SLOT(remove_slot()));
+  connect(applyButton, SIGNAL(clicked()), this, SLOT(apply_slot()));
+  connect(clearButton, SIGNAL(clicked()), this, SLOT(clear_slot()));
+  connect(parent->Worker_Obj, SIGNAL(alarm_events(std::vector<ALARM_EVENT>)),
+          this, SLOT(alarm_events(std::vector<ALARM_EVENT>)));
+  connect(parent->show_alarm_window, SIGNAL(triggered()), this, SLOT(show()));
+
+  load_rules();
+  apply_slot();
+}
+
+
+void AlarmWindow::add_row(const ALARM_RULE & rule)
+{
+  int row = ruleTable->rowCount();
+  ruleTable->insertRow(row);
+  ruleTable->setItem(row, 0, new QTableWidgetItem(QString::fromStdString(rule.name)));
+  ruleTable->setItem(row, 1, new QTableWidgetItem(QString::fromStdString(rule.source)));
+
+  QComboBox * kind = new QComboBox;
+  kind->addItems({tr("Above"), tr("Below"), tr("Outside"), tr("Rate")});
+  kind->setCurrentIndex(rule.kind);
+  ruleTable->setCellWidget(row, 2, kind);
+
+  ruleTable->setItem(row, 3, new QTableWidgetItem(QString::number(rule.level)));
+  ruleTable->setItem(row, 4, new QTableWidgetItem(QString::number(rule.upper)));
+  ruleTable->setItem(row, 5, new QTableWidgetItem(QString::number(rule.hold*1000.0)));
+  ruleTable->setItem(row, 6, new QTableWidgetItem(QString::number(rule.hysteresis)));
+  QTableWidgetItem * on = new QTableWidgetItem;
+  on->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+  on->setCheckState(rule.enabled ? Qt::Checked : Qt::Unchecked);
+  ruleTable->setItem(row, 7, on);
+}
+
+
+std::vector<ALARM_RULE> AlarmWindow::table_rules()
+{
+  std::vector<ALARM_RULE> rules;
+  for(int row = 0; row < ruleTable->rowCount(); row++)
+    {
+      ALARM_RULE r;
+      r.name       = ruleTable->item(row, 0)->text().toStdString();
+      r.source     = ruleTable->item(row, 1)->text().trimmed().toStdString();
+      r.kind       = (ALARM_KIND)((QComboBox*)ruleTable->cellWidget(row, 2))->currentIndex();
+      r.level      = ruleTable->item(row, 3)->text().toDouble();
+      r.upper      = ruleTable->item(row, 4)->text().toDouble();
+      r.hold       = ruleTable->item(row, 5)->text().toDouble()/1000.0;
+      r.hysteresis = std::fabs(ruleTable->item(row, 6)->text().toDouble());
+      r.enabled    = ruleTable->item(row, 7)->checkState() == Qt::Checked;
+      if(r.name.empty())
+        r.name = r.source;
+      rules.push_back(r);
+    }
+  return rules;
+}
+
+
+void AlarmWindow::load_rules()
+{
+  QSettings config("live-plotter-4000", "alarms");
+  int n = config.beginReadArray("rules");
+  for(int i = 0; i < n; i++)
+    {
+      config.setArrayIndex(i);
+      ALARM_RULE r;
+      r.name       = config.value("name").toString().toStdString();
+      r.source     = config.value("source", "z0").toString().toStdString();
+      r.kind       = (ALARM_KIND)std::min(std::max(config.value("kind", 0).toInt(), 0), (int)AL_RATE);
+      r.level      = config.value("level", 1.0).toDouble();
+      r.upper      = config.value("upper", 1.0).toDouble();
+      r.hold       = config.value("hold", 0.0).toDouble();
+      r.hysteresis = config.value("hysteresis", 0.0).toDouble();
+      r.enabled    = config.value("enabled", true).toBool();
+      add_row(r);
+    }
+  config.endArray();
+}
+
+
+void AlarmWindow::save_rules()
+{
+  QSettings config("live-plotter-4000", "alarms");
+  config.remove("rules");
+  config.beginWriteArray("rules");
+  for(size_t i = 0; i < applied.size(); i++)
+    {
+      const ALARM_RULE & r = applied[i];
+      config.setArrayIndex(i);
+      config.setValue("name", QString::fromStdString(r.name));
+      config.setValue("source", QString::fromStdString(r.source));
+      config.setValue("kind", (int)r.kind);
+      config.setValue("level", r.level);
+      config.setValue("upper", r.upper);
+      config.setValue("hold", r.hold);
+      config.setValue("hysteresis", r.hysteresis);
+      config.setValue("enabled", r.enabled);
+    }
+  config.endArray();
+}
+
+
+void AlarmWindow::add_slot()
+{
+  ALARM_RULE r;
+  r.name       = "Alarm " + std::to_string(ruleTable->rowCount());
+  r.source     = "z0";
+  r.kind       = AL_ABOVE;
+  r.level      = 1000.0;
+  r.upper      = 1000.0;
+  r.hold       = 0.0;
+  r.hysteresis = 0.0;
+  r.enabled    = true;
+  add_row(r);
+}
+
+
+void AlarmWindow::remove_slot()
+{
+  if(ruleTable->currentRow() >= 0)
+    ruleTable->removeRow(ruleTable->currentRow());
+}
+
+
+// Rules take effect at the next block; every rule starts out clear.
+void AlarmWindow::apply_slot()
+{
+  applied = table_rules();
+  active  = std::vector<bool>(applied.size(), false);
+  parent->Worker_Obj->alarms.set_rules(applied);
+  save_rules();
+  update_status();
+}
+
+
+void AlarmWindow::clear_slot()
+{
+  eventTable->setRowCount(0);
+}
+
+
+void AlarmWindow::update_status()
+{
+  QStringList raised;
+  for(size_t r = 0; r < applied.size(); r++)
+    if(active[r])
+      raised << QString::fromStdString(applied[r].name);
+  statusLabel->setText(tr("Rules: ") + QString::number(applied.size()) +
+                       tr("    Events: ") + QString::number(eventCount) +
+                       tr("    Active: ") + (raised.isEmpty() ? tr("none") : raised.join(", ")));
+}
+
+
+// One line per event: wall clock, stream sample, its time into the stream,
+// rule, event, value and detection latency.
+void AlarmWindow::log_event(const ALARM_EVENT & e, const QString & name)
+{
+  if(!logFile)
+    {
+      QDir().mkpath("alarms");
+      logFile = new QFile("alarms/" + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".csv");
+      if(!logFile->open(QIODevice::WriteOnly | QIODevice::Text))
+        printf("Alarm log %s cannot be written\n", logFile->fileName().toLocal8Bit().constData());
+      else
+        logFile->write("time,sample,stream_s,rule,event,value,latency_us\n");
+    }
+  if(!logFile->isOpen())
+    return;
+
+  QString line = QDateTime::currentDateTime().toString(Qt::ISODateWithMs) + "," +
+                 QString::number(e.sample) + "," +
+                 QString::number(e.sample*(double)g_sampleInterval*1.0e-6, 'f', 6) + ",\"" +
+                 name + "\"," + (e.raised ? "raised" : "cleared") + "," +
+                 QString::number(e.value, 'g', 9) + "," +
+                 QString::number(e.latency*1.0e-3, 'f', 1) + "\n";
+  logFile->write(line.toUtf8());
+  logFile->flush();
+}
+
+
+void AlarmWindow::alarm_events(std::vector<ALARM_EVENT> events)
+{
+  for(const ALARM_EVENT & e: events)
+    {
+      if(e.rule < 0 || e.rule >= (int)applied.size())
+        continue;
+      QString name = QString::fromStdString(applied[e.rule].name);
+      active[e.rule] = e.raised;
+      eventCount++;
+      log_event(e, name);
+
+      eventTable->insertRow(0);
+      eventTable->setItem(0, 0, new QTableWidgetItem(QDateTime::currentDateTime().toString("hh:mm:ss.zzz")));
+      eventTable->setItem(0, 1, new QTableWidgetItem(QString::number(e.sample)));
+      eventTable->setItem(0, 2, new QTableWidgetItem(name));
+      eventTable->setItem(0, 3, new QTableWidgetItem(e.raised ? tr("Raised") : tr("Cleared")));
+      eventTable->setItem(0, 4, new QTableWidgetItem(QString::number(e.value, 'g', 6)));
+      eventTable->setItem(0, 5, new QTableWidgetItem(QString::number(e.latency*1.0e-3, 'f', 1) + " us"));
+      if(e.raised)
+        for(int c = 0; c < eventTable->columnCount(); c++)
+          eventTable->item(0, c)->setForeground(Qt::red);
+      if(eventTable->rowCount() > ALARM_LOG)
+        eventTable->setRowCount(ALARM_LOG);
+
+      if(e.raised)
+        {
+          parent->statusBar()->showMessage(tr("Alarm: ") + name + " = " + QString::number(e.value, 'g', 6) +
+                                           tr(" at sample ") + QString::number(e.sample), 10000);
+          QApplication::beep();
+        }
+    }
+  update_status();
+}
+
+
+
+ViewLink::ViewLink()
+  : lower(0.0)
+  , upper(0.0)
+  , cursor(-1.0)
+{
+}
+
+
+void ViewLink::set_range(double l, double u)
+{
+  if(l == lower && u == upper)
+    return;
+  lower = l;
+  upper = u;
+  emit(range_changed(l, u));
+}
+
+
+void ViewLink::set_cursor(double c)
+{
+  if(c == cursor)
+    return;
+  cursor = c;
+  emit(cursor_changed(c));
+}
+
+
+
+PlotView::PlotView(VIEW_KIND kind, int id, Window * parent)
+  : kind(kind)
+  , id(id)
+  , parent(parent)
+  , layout(new QGridLayout)
+  , plot(new QCustomPlot)
+  , slotList(nullptr)
+  , sourceBox(nullptr)
+  , sizeBox(nullptr)
+  , linkBox(new QCheckBox(tr("&Linked")))
+  , followBox(new QCheckBox(tr("&Follow")))
+  , cursorLine(new QCPItemStraightLine(plot))
+  , linkRect(new QCPItemRect(plot))
+  , pixmap(nullptr)
+  , colorMap(nullptr)
+  , spectrum(nullptr)
+  , moving(false)
+  , rescale(true)
+{
+  std::vector<std::string> labels = slot_labels();
+
+  linkBox->setChecked(true);
+  linkBox->setToolTip(tr("Share range and cursor with the time plot and the other linked views"));
+  followBox->setChecked(true);
+  followBox->setToolTip(tr("Show the newest samples while streaming"));
+  plot->axisRect()->setupFullAxesBox(true);
+  plot->setInteraction(QCP::iRangeZoom, true);
+  plot->setInteraction(QCP::iRangeDrag, true);
+  cursorLine->setPen(QPen(Qt::gray, 0, Qt::DashLine));
+  cursorLine->setVisible(false);
+  linkRect->setPen(QPen(QColor(0, 120, 215)));
+  linkRect->setBrush(QBrush(QColor(0, 120, 215, 40)));
+  linkRect->setVisible(false);
+
+  layout->addWidget(plot, 0, 0, 1, 4);
+  layout->addWidget(linkBox, 1, 0);
+  layout->addWidget(followBox, 1, 1);
+
+  switch(kind)
+    {
+    case VIEW_TIME:
+      setWindowTitle(tr("Time View"));
+      plot->axisRect()->setRangeZoom(Qt::Horizontal);
+      plot->axisRect()->setRangeDrag(Qt::Horizontal);
+      slotList = new QListWidget;
+      for(size_t s = 0; s < labels.size(); s++)
+        {
+          QListWidgetItem * item = new QListWidgetItem(QString::fromStdString(labels[s]), slotList);
+          item->setFlags(Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
+          item->setCheckState(parent->timePlot->graph(s)->visible() ? Qt::Checked : Qt::Unchecked);
+        }
+      slotList->setMaximumWidth(120);
+      layout->addWidget(slotList, 0, 4);
+      plot->xAxis->setRange(parent->timePlot->xAxis->range());
+      connect(slotList, SIGNAL(itemChanged(QListWidgetItem *)), this, SLOT(slots_changed()));
+      slots_changed();
+      break;
+
+    case VIEW_XY:
+      setWindowTitle(tr("XY View ") + QString::number(id));
+      sourceBox = new QComboBox;
+      sourceBox->addItem(tr("XY image"));
+      for(auto l: labels)
+        sourceBox->addItem(QString::fromStdString(l));
+      sourceBox->setToolTip(tr("The shared XY image, or a Z source binned from the time history"));
+      pixmap = new QCPItemPixmap(plot);
+      pixmap->setScaled(true, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+      colorMap = new QCPColorMap(plot->xAxis, plot->yAxis);
+      colorMap->setGradient(QCPColorGradient::gpGrayscale);
+      colorMap->setVisible(false);
+      plot->xAxis->setRange(parent->xyPlot->xAxis->range());
+      plot->yAxis->setRange(parent->xyPlot->yAxis->range());
+      layout->addWidget(sourceBox, 1, 2);
+      connect(sourceBox, SIGNAL(currentIndexChanged(int)), this, SLOT(source_changed()));
+      connect(parent->renderer, SIGNAL(rendered(XY_IMAGE)), this, SLOT(xy_image(XY_IMAGE)));
+      connect(plot->yAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(range_slot(QCPRange)));
+      break;
+
+    case VIEW_SPECTRUM:
+      setWindowTitle(tr("Spectrum View"));
+      sourceBox = new QComboBox;
+      for(auto l: labels)
+        sourceBox->addItem(QString::fromStdString(l));
+      sizeBox = new QComboBox;
+      for(int n = 1024; n <= 65536; n *= 2)
+        sizeBox->addItem(QString::number(n) + tr(" points"), n);
+      sizeBox->setCurrentIndex(2);
+      sizeBox->setToolTip(tr("Samples per transform, ending at the newest sample or centred on the linked cursor"));
+      spectrum = new Spectrum(sizeBox->currentData().toInt());
+      plot->addGraph();
+      plot->xAxis->setLabel(tr("Hz"));
+      plot->yAxis->setLabel(tr("dB"));
+      layout->addWidget(sourceBox, 1, 2);
+      layout->addWidget(sizeBox, 1, 3);
+      connect(sourceBox, SIGNAL(currentIndexChanged(int)), this, SLOT(source_changed()));
+      connect(sizeBox, SIGNAL(currentIndexChanged(int)), this, SLOT(source_changed()));
+      break;
+    }
+
+  setLayout(layout);
+  resize(700, 450);
+
+  connect(plot->xAxis, SIGNAL(rangeChanged(QCPRange)), this, SLOT(range_slot(QCPRange)));
+  connect(plot, SIGNAL(mouseMove(QMouseEvent *)), this, SLOT(mouse_slot(QMouseEvent *)));
+  connect(parent->viewLink, SIGNAL(range_changed(double, double)), this, SLOT(linked_range(double, double)));
+  connect(parent->viewLink, SIGNAL(cursor_changed(double)), this, SLOT(linked_cursor(double)));
+  connect(parent, SIGNAL(views_tick()), this, SLOT(refresh()));
+}
+
+
+// what the view holds on top of the shared stores
+size_t PlotView::bytes()
+{
+  size_t b = (keys.capacity() + values.capacity() + points.capacity() +
+              mx.capacity() + my.capacity() + mz.capacity())*sizeof(double);
+  for(int g = 0; g < plot->graphCount(); g++)
+    b += plot->graph(g)->data()->size()*sizeof(QCPGraphData);
+  if(colorMap)
+    b += (size_t)XY_CELLS*XY_CELLS*(sizeof(double) + 1);
+  if(pixmap)
+    b += (size_t)pixmap->pixmap().width()*pixmap->pixmap().height()*4;
+  return b;
+}
+
+
+// While streaming at most every VIEW_INTERVAL ms, and only while visible.
+void PlotView::refresh()
+{
+  if(!isVisible())
+    return;
+  if(g_streamIsRunning && lastRefresh.isValid() && lastRefresh.elapsed() < VIEW_INTERVAL)
+    return;
+  lastRefresh.start();
+
+  switch(kind)
+    {
+    case VIEW_TIME:     refresh_time();     break;
+    case VIEW_XY:       refresh_xy();       break;
+    case VIEW_SPECTRUM: refresh_spectrum(); break;
+    }
+}
+
+
+// The linked range within the history, unless the view follows the stream.
+bool PlotView::linked_span(long long * from, long long * to)
+{
+  ViewLink * link = parent->viewLink;
+  if(!linkBox->isChecked() || (followBox->isChecked() && g_streamIsRunning) || !(link->upper > link->lower))
+    return false;
+  *from = std::max((long long)std::floor(link->lower), parent->history->first());
+  *to   = std::min((long long)std::ceil(link->upper), parent->history->count());
+  return *to > *from;
+}
+
+
+// Like the time plot, at most a minimum and maximum per pixel column. A
+// linked range narrower than the view is marked, so a wide view serves as
+// the overview of a zoomed one.
+void PlotView::refresh_time()
+{
+  History * history = parent->history;
+  if(followBox->isChecked() && g_streamIsRunning)
+    {
+      moving = true;
+      plot->xAxis->setRange(history->count(), plot->xAxis->range().size(), Qt::AlignRight);
+      moving = false;
+    }
+
+  QCPRange range   = plot->xAxis->range();
+  int      columns = std::max(plot->axisRect()->width(), 1);
+  for(size_t g = 0; g < shown.size(); g++)
+    {
+      history->envelope(shown[g], (long long)std::floor(range.lower), (long long)std::ceil(range.upper) + 1,
+                        columns, keys, values);
+      plot->graph(g)->setData(QVector<double>(keys.begin(), keys.end()),
+                              QVector<double>(values.begin(), values.end()), true);
+    }
+  if(!shown.empty())
+    {
+      plot->yAxis->rescale(true);
+      plot->yAxis->scaleRange(1.1, plot->yAxis->range().center());
+    }
+
+  ViewLink * link  = parent->viewLink;
+  bool       inner = linkBox->isChecked() && link->upper > link->lower &&
+                     link->upper - link->lower < 0.99*range.size();
+  linkRect->setVisible(inner);
+  if(inner)
+    {
+      linkRect->topLeft->setCoords(link->lower, plot->yAxis->range().upper);
+      linkRect->bottomRight->setCoords(link->upper, plot->yAxis->range().lower);
+    }
+  plot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+void PlotView::refresh_xy()
+{
+  int source = sourceBox->currentIndex();
+  pixmap->setVisible(source == 0);
+  colorMap->setVisible(source > 0);
+  if(source > 0)
+    {
+      bin_history(source - 1);
+      return;
+    }
+
+  QCPRange x = plot->xAxis->range();
+  QCPRange y = plot->yAxis->range();
+  parent->renderer->pendingViews[id]++;
+  QMetaObject::invokeMethod(parent->renderer, "render_view", Qt::QueuedConnection,
+                            Q_ARG(double, x.lower), Q_ARG(double, x.upper),
+                            Q_ARG(double, y.lower), Q_ARG(double, y.upper),
+                            Q_ARG(int, parent->sizeBox->value()), Q_ARG(int, id));
+}
+
+
+// Mean of a Z source per cell over the linked range or the newest
+// XY_HISTORY samples, read from the history and mapped through the scan
+// calibration like the live image.
+void PlotView::bin_history(int slot)
+{
+  History * history = parent->history;
+  long long from, to;
+  if(!linked_span(&from, &to))
+    {
+      to   = history->count();
+      from = history->first();
+    }
+  from  = std::max(from, to - XY_HISTORY);
+  int n = (int)(to - from);
+  if(n <= 0)
+    return;
+
+  mx.resize(n);
+  my.resize(n);
+  mz.resize(n);
+  points.resize(3*(size_t)n);
+  history->read(X-1, from, n, mx.data());
+  history->read(Y-1, from, n, my.data());
+  history->read(slot, from, n, mz.data());
+  for(int i = 0; i < n; i++)
+    {
+      points[3*i]   = mx[i];
+      points[3*i+1] = my[i];
+      points[3*i+2] = mz[i];
+    }
+  scanMap.set_calibration(parent->scanCalibration);
+  scanMap.map(points.data(), n, mx, my, mz);
+
+  keys.assign(XY_CELLS*XY_CELLS, 0.0);
+  values.assign(XY_CELLS*XY_CELLS, 0.0);
+  for(int i = 0; i < n; i++)
+    {
+      int cx = scanMap.cell(0, mx[i], XY_CELLS);
+      int cy = scanMap.cell(1, my[i], XY_CELLS);
+      if(cx < 0 || cy < 0 || std::isnan(mz[i]))
+        continue;
+      keys[cy*XY_CELLS + cx]   += mz[i];
+      values[cy*XY_CELLS + cx] += 1.0;
+    }
+
+  const SCAN_CALIBRATION & c    = scanMap.calibration();
+  QCPColorMapData *        data = colorMap->data();
+  double                   w    = (c.hi[0] - c.lo[0])/XY_CELLS;
+  double                   h    = (c.hi[1] - c.lo[1])/XY_CELLS;
+  double                   lo   = INFINITY, hi = -INFINITY;
+  data->setSize(XY_CELLS, XY_CELLS);
+  data->setRange(QCPRange(c.lo[0] + w/2, c.hi[0] - w/2), QCPRange(c.lo[1] + h/2, c.hi[1] - h/2));
+  for(int y = 0; y < XY_CELLS; y++)
+    for(int x = 0; x < XY_CELLS; x++)
+      {
+        double count = values[y*XY_CELLS + x];
+        double mean  = count > 0.0 ? keys[y*XY_CELLS + x]/count : 0.0;
+        data->setCell(x, y, mean);
+        data->setAlpha(x, y, count > 0.0 ? 255 : 0);
+        if(count > 0.0)
+          {
+            lo = std::min(lo, mean);
+            hi = std::max(hi, mean);
+          }
+      }
+  if(hi >= lo)
+    colorMap->setDataRange(QCPRange(lo, hi > lo ? hi : lo + 1.0e-9));
+  plot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+// Samples of the source ending at the newest one, or centred on the
+// linked cursor once the stream has stopped.
+void PlotView::refresh_spectrum()
+{
+  int size = sizeBox->currentData().toInt();
+  if(spectrum->size() != size)
+    {
+      delete spectrum;
+      spectrum = new Spectrum(size);
+    }
+
+  History *  history = parent->history;
+  ViewLink * link    = parent->viewLink;
+  long long  to      = history->count();
+  if(linkBox->isChecked() && !(followBox->isChecked() && g_streamIsRunning) && link->cursor >= 0.0)
+    to = std::min(to, (long long)link->cursor + size/2);
+  long long from = std::max(history->first(), to - size);
+  if(to - from < size)
+    return;
+
+  keys.resize(size);
+  history->read(sourceBox->currentIndex(), from, size, keys.data());
+  spectrum->process(keys.data(), 1.0e6/(double)g_sampleInterval, mx, my);
+  plot->xAxis->setLabel(history->thinned(from, to) ? tr("Hz (thinned, samples held)") : tr("Hz"));
+  plot->graph(0)->setData(QVector<double>(mx.begin(), mx.end()), QVector<double>(my.begin(), my.end()), true);
+  if(rescale)
+    {
+      plot->rescaleAxes();
+      rescale = false;
+    }
+  plot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+void PlotView::xy_image(XY_IMAGE xy)
+{
+  if(xy.view != id || xy.frame)
+    return;
+  pixmap->setPixmap(QPixmap::fromImage(xy.image));
+  pixmap->topLeft->setCoords(xy.x0, xy.y1);
+  pixmap->bottomRight->setCoords(xy.x1, xy.y0);
+  plot->replot(QCustomPlot::rpQueuedReplot);
+}
+
+
+// A time view that is moved by hand passes its range on; XY views only
+// need a new image for their own viewport.
+void PlotView::range_slot(QCPRange)
+{
+  if(kind == VIEW_XY)
+    {
+      if(sourceBox->currentIndex() == 0)
+        refresh_xy();
+      return;
+    }
+  if(kind != VIEW_TIME || moving)
+    return;
+  QCPRange r = plot->xAxis->range();
+  if(linkBox->isChecked())
+    parent->viewLink->set_range(r.lower, r.upper);
+  if(!g_streamIsRunning)
+    refresh_time();
+}
+
+
+void PlotView::linked_range(double lower, double upper)
+{
+  if(!linkBox->isChecked())
+    return;
+  if(kind == VIEW_TIME && !(followBox->isChecked() && g_streamIsRunning))
+    {
+      QCPRange r = plot->xAxis->range();
+      if(r.lower != lower || r.upper != upper)
+        {
+          moving = true;
+          plot->xAxis->setRange(lower, upper);
+          moving = false;
+        }
+    }
+  if(!g_streamIsRunning)
+    refresh();
+}
+
+
+void PlotView::linked_cursor(double cursor)
+{
+  if(!linkBox->isChecked())
+    return;
+  if(kind == VIEW_TIME)
+    {
+      cursorLine->point1->setCoords(cursor, 0.0);
+      cursorLine->point2->setCoords(cursor, 1.0);
+      cursorLine->setVisible(true);
+      plot->replot(QCustomPlot::rpQueuedReplot);
+    }
+  if(kind == VIEW_SPECTRUM && !g_streamIsRunning)
+    refresh_spectrum();
+}
+
+
+void PlotView::mouse_slot(QMouseEvent * event)
+{
+  if(kind != VIEW_TIME || !linkBox->isChecked())
+    return;
+  parent->viewLink->set_cursor(plot->xAxis->pixelToCoord(event->pos().x()));
+}
+
+
+void PlotView::slots_changed()
+{
+  shown.clear();
+  plot->clearGraphs();
+  for(int s = 0; s < slotList->count(); s++)
+    if(slotList->item(s)->checkState() == Qt::Checked)
+      {
+        shown.push_back(s);
+        plot->addGraph();
+        plot->graph()->setPen(parent->timePlot->graph(s)->pen());
+        plot->graph()->setName(slotList->item(s)->text());
+      }
+  refresh_time();
+}
+
+
+void PlotView::source_changed()
+{
+  rescale = true;
+  lastRefresh.invalidate();
+  refresh();
+}
+
+
+
+PipelineWindow::PipelineWindow(Window * parent)
+  : layout(new QGridLayout)
+  , parent(parent)
+  , table(new QTableWidget)
+{
+  QStringList rows;
+  for(auto p: stage_labels())
+    rows << tr(p.c_str());
+
+  PluginHost & plugins = parent->Worker_Obj->plugins;
+  std::vector<std::string> labels = slot_labels();
+  for(int i = 0; i < plugins.stages(); i++)
+    {
+      const PLUGIN_STAGE & p = plugins.stage(i);
+      QString slots = QString::fromStdString(labels[p.slot]);
+      if(p.info->outputs > 1)
+        slots += "-" + QString::fromStdString(labels[p.slot + p.info->outputs - 1]);
+      rows << QString(p.info->name) + " (" + slots + ")";
+    }
+
+  table->setRowCount(rows.size());
+  table->setColumnCount(2);
+  table->setHorizontalHeaderLabels({tr("Time/Block"), tr("Load")});
+  table->setVerticalHeaderLabels(rows);
+  table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  for(int r = 0; r < rows.size(); r++)
+    for(int c = 0; c < 2; c++)
+      table->setItem(r, c, new QTableWidgetItem);
+
+  // latency from the driver callback to the end of each stage
+  QStringList traceRows;
+  for(auto p: trace_labels())
+    traceRows << tr(p.c_str());
+  latencyTable = new QTableWidget(traceRows.size(), 3);
+  latencyTable->setHorizontalHeaderLabels({tr("p50"), tr("p99"), tr("Max")});
+  latencyTable->setVerticalHeaderLabels(traceRows);
+  latencyTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  for(int r = 0; r < traceRows.size(); r++)
+    for(int c = 0; c < 3; c++)
+      latencyTable->setItem(r, c, new QTableWidgetItem);
+
+  traceButton = new QPushButton(tr("&Trace 10 s"));
+  traceButton->setToolTip(tr("Write the next 10 s of block spans to traces/ as Chrome trace JSON"));
+
+  // what every subsystem holds and what the governor lets it keep
+  QStringList memoryRows;
+  for(int r = 0; r < g_memory.size(); r++)
+    memoryRows << tr(g_memory.entry(r).name.c_str());
+  memoryTable = new QTableWidget(memoryRows.size(), 2);
+  memoryTable->setHorizontalHeaderLabels({tr("Used"), tr("Allowed")});
+  memoryTable->setVerticalHeaderLabels(memoryRows);
+  memoryTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  for(int r = 0; r < memoryRows.size(); r++)
+    for(int c = 0; c < 2; c++)
+      memoryTable->setItem(r, c, new QTableWidgetItem);
+
+  limitBox = new QSpinBox;
+  limitBox->setRange(256, 262144);
+  limitBox->setSingleStep(256);
+  limitBox->setValue((int)(g_memory.limit() >> 20));
+  limitBox->setPrefix(tr("Memory budget "));
+  limitBox->setSuffix(" MB");
+  // the spill directory is opened once, at startup
+  QSettings config("live-plotter-4000", "memory");
+  spillBox = new QSpinBox;
+  spillBox->setRange(64, 1048576);
+  spillBox->setSingleStep(1024);
+  spillBox->setValue(config.value("spillLimit", 4096).toInt());
+  spillBox->setPrefix(tr("History spill "));
+  spillBox->setSuffix(" MB");
+  spillButton = new QPushButton(tr("Spill to ") +
+                                config.value("spillDirectory", QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).toString());
+  spillButton->setToolTip(tr("Takes effect at the next start"));
+  memoryLabel = new QLabel;
+
+  layout->addWidget(table, 0, 0);
+  layout->addWidget(new QLabel(tr("Plug-ins: ") + QString::number(plugins.stages()) +
+                               tr(", output slots P0-P") + QString::number(PLUGIN_OUTPUTS - 1)), 1, 0);
+  layout->addWidget(latencyTable, 2, 0);
+  layout->addWidget(traceButton, 3, 0);
+  layout->addWidget(memoryTable, 4, 0);
+  layout->addWidget(limitBox, 5, 0);
+  layout->addWidget(spillBox, 6, 0);
+  layout->addWidget(spillButton, 7, 0);
+  layout->addWidget(memoryLabel, 8, 0);
+  setLayout(layout);
+  resize(400, 800);
+
+  connect(traceButton, SIGNAL(clicked()), this, SLOT(trace_slot()));
+  g_tracer.on_capture([this](){ QMetaObject::invokeMethod(this, "write_trace_slot", Qt::QueuedConnection); });
+  connect(limitBox, SIGNAL(valueChanged(int)), this, SLOT(set_limit_slot(int)));
+  connect(spillBox, SIGNAL(valueChanged(int)), this, SLOT(set_spill_slot(int)));
+  connect(spillButton, SIGNAL(clicked()), this, SLOT(spill_directory_slot()));
+
+  connect(parent->Worker_Obj, SIGNAL(stage_times(std::vector<double>)), this, SLOT(update_times(std::vector<double>)));
+  connect(parent->show_pipeline_window, SIGNAL(triggered()), this, SLOT(show()));
+}
+
+
+// Time per block and share of real time of every stage, see stage_times.
+void PipelineWindow::update_times(std::vector<double> times)
+{
+  if(!isVisible() || times.size() < 2)
+    return;
+
+  double span   = times[times.size() - 2];
+  double blocks = std::max(times[times.size() - 1], 1.0);
+  for(int r = 0; r < table->rowCount() && r < (int)times.size() - 2; r++)
+    {
+      table->item(r, 0)->setText(QString::number(times[r]/blocks/1000.0, 'f', 1) + " us");
+      table->item(r, 1)->setText(QString::number(span > 0.0 ? times[r]/span*100.0 : 0.0, 'f', 2) + " %");
+    }
+
+  for(int r = 0; r < TR_STAGES; r++)
+    {
+      double p50, p99, max;
+      g_tracer.latency(r, &p50, &p99, &max);
+      latencyTable->item(r, 0)->setText(QString::number(p50, 'f', 2) + " ms");
+      latencyTable->item(r, 1)->setText(QString::number(p99, 'f', 2) + " ms");
+      latencyTable->item(r, 2)->setText(QString::number(max, 'f', 2) + " ms");
+    }
+  traceButton->setEnabled(!g_tracer.capturing());
+}
+
+
+void PipelineWindow::update_memory()
+{
+  if(!isVisible())
+    return;
+
+  for(int r = 0; r < memoryTable->rowCount() && r < g_memory.size(); r++)
+    {
+      BUDGET_ENTRY e = g_memory.entry(r);
+      memoryTable->item(r, 0)->setText(QString::number(e.bytes/1048576.0, 'f', 1) + " MB");
+      memoryTable->item(r, 1)->setText(e.allowed == SIZE_MAX ? tr("-") : QString::number(e.allowed/1048576.0, 'f', 1) + " MB");
+    }
+  memoryLabel->setText(tr("Total ") + QString::number(g_memory.total()/1048576.0, 'f', 0) + tr(" MB, process ") +
+                       QString::number(MemoryGovernor::resident()/1048576.0, 'f', 0) + " MB" +
+                       (g_memory.pressure() ? tr(", reclaiming") : ""));
+}
+
+
+void PipelineWindow::set_limit_slot(int megabytes)
+{
+  g_memory.set_limit((size_t)megabytes << 20);
+  QSettings config("live-plotter-4000", "memory");
+  config.setValue("budget", megabytes);
+}
+
+
+// the governor hands the new limit to the history at its next update
+void PipelineWindow::set_spill_slot(int megabytes)
+{
+  g_memory.set_reserved(parent->spillEntry, (size_t)megabytes << 20);
+  QSettings config("live-plotter-4000", "memory");
+  config.setValue("spillLimit", megabytes);
+}
+
+
+void PipelineWindow::spill_directory_slot()
+{
+  QSettings config("live-plotter-4000", "memory");
+  QString   dir = QFileDialog::getExistingDirectory(this, tr("Spill the time history to"),
+                                                    config.value("spillDirectory", QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).toString());
+  if(dir.isEmpty())
+    return;
+  config.setValue("spillDirectory", dir);
+  spillButton->setText(tr("Spill to ") + dir);
+}
+
+
+void PipelineWindow::trace_slot()
+{
+  QDir().mkpath("traces");
+  QString path = "traces/" + QString::number(QDateTime::currentMSecsSinceEpoch()) + ".json";
+  if(g_tracer.capture(path.toStdString(), 10.0))
+    traceButton->setEnabled(false);
+}
+
+
+// the capture ends on a traced thread, the file is written here
+void PipelineWindow::write_trace_slot()
+{
+  g_tracer.write_capture();
+  traceButton->setEnabled(!g_tracer.capturing());
+}
+
+
+
+void ColorMapDataChooser::check_buttons_channel()
+{
+  for(int i = 0; i < data_slots(); i++)
+    if(((QRadioButton*)layout->itemAt(i)->widget())->isChecked())
+      parent->colorMapData_ptr = (double*)&parent->data_vec[i];
+}
+
+
+void ColorMapDataChooser::check_buttons_math()
+{
+  for(int i = data_slots(); i < expression_vec.size()+data_slots(); i++)
+    {
+      QRadioButton * button = (QRadioButton*)layout->itemAt(i)->widget();
+      if(button->isChecked())
+        parent->colorMapData_ptr = &parent->mathChannel_vec[parent->expression_vec.value(expression_vec.key(button->text()))];
+    }
 }
 
 
@@ -6,15 +6,45 @@
 #include <QObject>
 #include "qcustomplot.h"
 #include <QToolBar>
+#include <QTableWidget>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QFile>
+#include <QListWidget>
 
 #include <libps4000a-1.0/ps4000aApi.h>
 #ifndef PICO_STATUS
 #include <libps4000a-1.0/PicoStatus.h>
 #endif //PICO_STATUS
 
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
 #include <string>
 #include <vector>
 #include "exprtk.hpp"
+#include "filter.hpp"
+#include "lockin.hpp"
+#include "stats.hpp"
+#include "average.hpp"
+#include "phosphor.hpp"
+#include "frames.hpp"
+#include "accumulator.hpp"
+#include "colorlayer.hpp"
+#include "devicequeue.hpp"
+#include "history.hpp"
+#include "shmring.hpp"
+#include "plugins.hpp"
+#include "recorder.hpp"
+#include "registry.hpp"
+#include "trace.hpp"
+#include "resample.hpp"
+#include "budget.hpp"
+#include "scanmap.hpp"
+#include "alarm.hpp"
+#include "spectrum.hpp"
 
 
 
@@ -24,6 +54,21 @@ inline bool       g_streamIsRunning;
 inline int32_t    g_sampleCount;
 inline uint32_t   g_startIndex;
 inline bool       g_ready;
+inline uint32_t   g_sampleInterval;
+inline double     g_measureWindow;
+inline bool       g_measureReset;
+inline bool       g_averageReset;
+inline bool       g_publish;
+inline bool       g_record;
+inline Tracer     g_tracer;
+inline int64_t    g_callbackTime;
+
+// one memory limit for every subsystem, see Window::register_memory
+inline MemoryGovernor       g_memory;
+// samples emitted by the worker and not yet taken by Window::data; above
+// the limit the worker thins the display stream
+inline std::atomic<int64_t> g_queuedSamples{0};
+inline std::atomic<int64_t> g_queueLimit{INT64_MAX};
 
 
 typedef enum
@@ -32,6 +77,86 @@ typedef enum
   }MODE;
 
 
+// Data slots come from g_channels: the X..Z9 roles, the lock-in outputs
+// and the outputs of the plug-in stages at fixed ids, then one slot per
+// input of every unit. A role carries whichever input is assigned to it,
+// the input slot always carries that input alone.
+#define LOCKIN_SLOT    Z9
+#define PLUGIN_SLOT    (LOCKIN_SLOT + LOCKIN_SIGNALS*LI_OUTPUTS)
+#define PLUGIN_OUTPUTS 8
+#define INPUT_SLOT     (PLUGIN_SLOT + PLUGIN_OUTPUTS)
+
+inline ChannelRegistry g_channels;
+
+// POSIX shared memory objects the live data is published to
+#define SHM_BLOCKS_NAME "/live-plotter-blocks"
+#define SHM_FRAMES_NAME "/live-plotter-frames"
+
+// samples per slot the time plot keeps in memory, 2 bytes each; older
+// ones are read back from the spill files
+#define HISTORY_SAMPLES (1 << 20)
+
+// while the GUI is behind the worker sends one of this many samples
+#define QUEUE_THIN 16
+
+// alarm events the alarm window lists; the log file keeps all of them
+#define ALARM_LOG 1000
+
+// XY images the renderer serves: the main XY plot and the XY views
+#define XY_VIEWS 8
+// samples an XY view bins from the history, and its cells per axis
+#define XY_HISTORY (1 << 17)
+#define XY_CELLS   256
+// ms between two refreshes of a view while streaming
+#define VIEW_INTERVAL 50
+
+
+inline int data_slots()
+{
+  return g_channels.size();
+}
+
+
+// timePlot graphs ahead of the math channels: one per slot, then the
+// averaged sweep and its upper and lower one sigma bounds
+inline int average_graph()
+{
+  return data_slots();
+}
+
+
+inline int plot_graphs()
+{
+  return data_slots() + 3;
+}
+
+
+inline std::vector<std::string> slot_labels()
+{
+  return g_channels.labels();
+}
+
+
+// built-in pipeline stages that are timed next to the plug-ins
+typedef enum
+  {
+    ST_CONVERT, ST_RECORD, ST_LOCKIN, ST_PLUGINS, ST_ALARM, ST_MEASURE, ST_AVERAGE, ST_PHOSPHOR, ST_PUBLISH, ST_EMIT, ST_STAGES
+  }PIPELINE_STAGE;
+
+
+inline std::vector<std::string> stage_labels()
+{
+  return {"Convert", "Record", "Lock-In", "Plug-ins", "Alarms", "Measure", "Average", "Phosphor", "Publish", "Emit"};
+}
+
+
+// name of a slot inside math expressions, e.g. x0, z3, l1_theta, p0 or u1_c
+inline std::string slot_variable(int slot)
+{
+  return g_channels.entry(slot).variable;
+}
+
+
 typedef struct
 {
   PICO_CONNECT_PROBE_RANGE  range;
@@ -44,12 +169,20 @@ typedef struct
   float                     maxOffset;
   float                     minOffset;
   PS4000A_COUPLING          coupling;
+  FILTER_SETTINGS           filter;
+  Filter *                  filterStage;
+  Resampler *               resampler;
+  double *                  voltage_buffer;
 }CHANNEL_SETTINGS;
 
 
 
 
 
+// ps4000aGetAnalogueOffset results per range and coupling, [min, max]
+#define OFFSET_RANGES (PS4000A_50V + 1)
+
+
 typedef struct t_unit
 {
   int16_t                   handle;
@@ -60,10 +193,22 @@ typedef struct t_unit
   int16_t                   maxSampleValue;
   int16_t                   minSampleValue;
   CHANNEL_SETTINGS          channelSettings[PS4000A_MAX_CHANNELS];
+  float                     offsetBounds[OFFSET_RANGES][2][2];
+  DeviceQueue *             queue;
+  uint32_t                  sampleInterval;   // us, slower units are resampled
+  int32_t                   readyCount;
+  uint32_t                  readyStart;
+  qint64                    openTime;
+  qint64                    configTime;
 }UNIT;
 
 
 Q_DECLARE_METATYPE(UNIT);
+Q_DECLARE_METATYPE(LOCKIN_SETTINGS);
+Q_DECLARE_METATYPE(AVERAGE_SETTINGS);
+Q_DECLARE_METATYPE(PHOSPHOR_SETTINGS);
+Q_DECLARE_METATYPE(SCAN_CALIBRATION);
+Q_DECLARE_METATYPE(ALARM_EVENT);
 
 
 typedef struct
@@ -90,6 +235,15 @@ struct TypeBox : public QComboBox
 
 
 
+struct FilterBox : public QComboBox
+{
+  FilterBox();
+  QGridLayout *               layout;
+  std::vector<std::string>    labels;
+};
+
+
+
 
 class Worker : public QObject
 {
@@ -101,18 +255,108 @@ public:
                                      uint32_t, int16_t,
                                      uint32_t, int16_t,
                                      int16_t, void *);
+  void                      request_reconfig(UNIT *);
+  PluginHost                plugins;
+  AlarmMonitor              alarms;
 
 private:
   double                    adc_to_voltage(int, int16_t, int16_t);
+  void                      convert_block(UNIT *, int, uint32_t, int32_t);
+  void                      prepare_channel(UNIT *, int, uint32_t);
+  void                      apply_reconfig(BUFFER_INFO *, uint32_t);
+  void                      start_unit(UNIT *, uint32_t);
+  uint32_t                  unit_samples(UNIT *, uint32_t);
+  void                      record_block(BUFFER_INFO *);
+  void                      close_recording();
+  std::vector<double>       slot_steps(BUFFER_INFO *);
   std::vector<double>       voltages;
+  LOCKIN_SETTINGS           lockin_settings;
+  AVERAGE_SETTINGS          average_settings;
+  PHOSPHOR_SETTINGS         phosphor_settings;
+
+  std::mutex                reconfigMutex;
+  std::vector<UNIT>         pendingReconfig;
+  std::atomic<bool>         reconfigPending;
+  ShmWriter *               shmBlocks;
+  std::vector<std::chrono::steady_clock::time_point>  restartTime;
+  std::vector<bool>         restartPending;
+  Recorder                  recorder;
+  std::vector<const int16_t *>  recordBlock;
+  std::vector<int>          recordChannels;
+  std::vector<int>          recordSettings;   // range and mode of each recorded channel
 
 public slots:
   void                      stream_data(UNIT *);
+  void                      replay_data(QString);
+  void                      set_lockin(LOCKIN_SETTINGS);
+  void                      set_average(AVERAGE_SETTINGS);
+  void                      set_phosphor(PHOSPHOR_SETTINGS);
 
 signals:
   void                      unit_stopped_signal();
+  void                      reconfigured(int, double);
 
   void                      data(std::vector<double>);
+  void                      measurements(std::vector<double>);
+  void                      averaged(std::vector<double>, std::vector<double>);
+  void                      phosphor(QImage);
+  void                      stage_times(std::vector<double>);
+  void                      block_stamp(qint64, qint64);
+  void                      alarm_events(std::vector<ALARM_EVENT>);
+  void                      history_scales(std::vector<double>);
+  void                      sample_stride(int);
+};
+
+
+
+// A finished XY image and the plot range it covers.
+typedef struct
+{
+  QImage                    image;
+  double                    x0, x1, y0, y1;
+  bool                      frame;
+  int                       view;         // 0 for the main XY plot
+}XY_IMAGE;
+
+
+Q_DECLARE_METATYPE(XY_IMAGE);
+
+
+
+// Owns the XY accumulator and a colour layer per view on its own thread. The GUI
+// thread hands over batches of points, frames and view requests by queued
+// calls and gets back finished images, so binning, resampling and colour
+// mapping never run on the GUI thread.
+class Renderer : public QObject
+{
+  Q_OBJECT
+
+public:
+                            Renderer();
+  std::atomic<int>          pendingViews[XY_VIEWS];
+  std::atomic<size_t>       footprint;
+
+private:
+  void                      finish(double, double, double, double, bool, int);
+  void                      account();
+  ColorLayer *              layer(int, int);
+  ImageAccumulator *        accumulator;
+  ColorLayer *              colorLayer[XY_VIEWS];   // created with the first image of a view
+  std::vector<uint32_t>     palette;
+  double                    greyLower, greyUpper;
+  ScanMap *                 scanMap;
+  std::vector<double>       mappedX, mappedY, mappedZ;
+
+public slots:
+  void                      bin_points(std::vector<double>, qint64);
+  void                      set_calibration(SCAN_CALIBRATION);
+  void                      set_budget(int);
+  void                      set_grey(double, double);
+  void                      render_view(double, double, double, double, int, int);
+  void                      render_frame(std::vector<double>, int, double, double, double, double);
+
+signals:
+  void                      rendered(XY_IMAGE);
 };
 
 
@@ -125,7 +369,7 @@ class ChannelWindow : public QWidget
   Q_OBJECT
 
 public:
-  ChannelWindow(UNIT *, Worker *, QCustomPlot *, QCustomPlot *, QCPColorMap *);
+  ChannelWindow(UNIT *, Worker *, QCustomPlot *, QCustomPlot *);
 
 private:
   QGroupBox *                   create_group_box(int,int);
@@ -138,13 +382,18 @@ private:
   RangeBox **                   RangeBox_Obj;
   QDoubleSpinBox **             Offset_SpinBox_Obj;
   TypeBox **                    TypeBox_Obj;
+  FilterBox **                  FilterBox_Obj;
+  QSpinBox **                   Order_SpinBox_Obj;
+  QDoubleSpinBox **             Cutoff_SpinBox_Obj;
+  QSpinBox **                   Decimation_SpinBox_Obj;
+  QSpinBox *                    Interval_SpinBox_Obj;
   QPushButton *                 Update_Button;
+  QLabel *                      gapLabel;
 
   UNIT *                        unit;
   Worker *                      worker;
   QCustomPlot *                 timePlot;
   QCustomPlot *                 xyPlot;
-  QCPColorMap *                 colorMap;
   QEventLoop *                  loop;
   std::vector<double>           voltages;
 
@@ -152,9 +401,11 @@ public slots:
   void                          set_channels();
   void                          set_channels_of_pico();
   void                          get_offset_bounds(int,int);
+  void                          reconfigured(int, double);
 
 signals:
   void                          do_work(UNIT *);
+  void                          scan_range_changed(QCPRange, QCPRange);
 };
 
 
@@ -190,6 +441,7 @@ public:
   exprtk::symbol_table<double>  * symbol_table;
   exprtk::expression<double>    * expression;
   exprtk::parser<double>        * parser;
+  size_t                        bytes();
 
 
 private:
@@ -219,6 +471,330 @@ public slots:
 
 
 
+class LockInWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  LockInWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QComboBox *                 referenceBox;
+  QDoubleSpinBox *            frequencyBox;
+  QDoubleSpinBox *            bandwidthBox;
+  QDoubleSpinBox *            timeConstantBox;
+  QSpinBox *                  orderBox;
+  QSpinBox *                  decimationBox;
+  TypeBox *                   signalBox;
+  QPushButton *               apply_button;
+
+public slots:
+  void                        apply_slot();
+
+signals:
+  void                        lockin_settings_changed(LOCKIN_SETTINGS);
+};
+
+
+
+class MeasurementWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  MeasurementWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QTableWidget *              table;
+  QDoubleSpinBox *            windowBox;
+  QCheckBox *                 sinceStartBox;
+  QPushButton *               reset_button;
+
+public slots:
+  void                        update_table();
+  void                        set_window_slot(double);
+  void                        reset_slot();
+};
+
+
+
+class AverageWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  AverageWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QComboBox *                 sourceBox;
+  QComboBox *                 triggerBox;
+  QDoubleSpinBox *            levelBox;
+  QComboBox *                 edgeBox;
+  QSpinBox *                  lengthBox;
+  QComboBox *                 modeBox;
+  QSpinBox *                  sweepsBox;
+  QPushButton *               apply_button;
+  QPushButton *               reset_button;
+
+public slots:
+  void                        apply_slot();
+  void                        reset_slot();
+
+signals:
+  void                        average_settings_changed(AVERAGE_SETTINGS);
+};
+
+
+
+class PhosphorWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  PhosphorWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QComboBox *                 sourceBox;
+  QSpinBox *                  widthBox;
+  QSpinBox *                  heightBox;
+  QSpinBox *                  spanBox;
+  QDoubleSpinBox *            persistenceBox;
+  QCheckBox *                 triggerBox;
+  QDoubleSpinBox *            levelBox;
+  QPushButton *               apply_button;
+  std::vector<bool>           graphVisible;
+
+public slots:
+  void                        apply_slot();
+
+signals:
+  void                        phosphor_settings_changed(PHOSPHOR_SETTINGS);
+};
+
+
+
+class FrameWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  FrameWindow(Window *);
+  QGridLayout *               layout;
+  int                         scrubAge;
+  int                         averageCount;
+  void                        limit_depth(int);
+
+private:
+  Window *                    parent;
+  QComboBox *                 modeBox;
+  QComboBox *                 syncBox;
+  QDoubleSpinBox *            levelBox;
+  QSpinBox *                  depthBox;
+  QSlider *                   scrubSlider;
+  QSpinBox *                  averageBox;
+  QLabel *                    statusLabel;
+
+public slots:
+  void                        set_mode_slot();
+  void                        set_depth_slot(int);
+  void                        scrub_slot();
+  void                        update_status();
+};
+
+
+
+// Calibration of the XY scan, see ScanMap.
+class ScanWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  ScanWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QSpinBox *                  delayBox;
+  QPushButton *               fitButton;
+  QPushButton *               linearButton;
+  QLabel *                    statusLabel;
+
+public slots:
+  void                        update_status();
+  void                        set_delay_slot(int);
+  void                        fit_slot();
+  void                        fitted_slot(SCAN_CALIBRATION, QString, int);
+  void                        linear_slot();
+};
+
+
+
+// Limit rules the worker checks on every block and the events they
+// raised. Every event is also appended to a log under alarms/.
+class AlarmWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  AlarmWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  void                        add_row(const ALARM_RULE &);
+  std::vector<ALARM_RULE>     table_rules();
+  void                        load_rules();
+  void                        save_rules();
+  void                        log_event(const ALARM_EVENT &, const QString &);
+  void                        update_status();
+
+  Window *                    parent;
+  QTableWidget *              ruleTable;
+  QTableWidget *              eventTable;
+  QPushButton *               addButton;
+  QPushButton *               removeButton;
+  QPushButton *               applyButton;
+  QPushButton *               clearButton;
+  QLabel *                    statusLabel;
+  std::vector<ALARM_RULE>     applied;
+  std::vector<bool>           active;
+  QFile *                     logFile;
+  int64_t                     eventCount;
+
+public slots:
+  void                        alarm_events(std::vector<ALARM_EVENT>);
+  void                        add_slot();
+  void                        remove_slot();
+  void                        apply_slot();
+  void                        clear_slot();
+};
+
+
+
+// Range and cursor shared by the linked views and the time plot, in
+// samples of the history. Only changes are passed on, so views that set
+// each other come to rest.
+class ViewLink : public QObject
+{
+  Q_OBJECT
+
+public:
+  ViewLink();
+  double                      lower, upper;
+  double                      cursor;
+
+public slots:
+  void                        set_range(double, double);
+  void                        set_cursor(double);
+
+signals:
+  void                        range_changed(double, double);
+  void                        cursor_changed(double);
+};
+
+
+
+typedef enum
+  {
+    VIEW_TIME, VIEW_XY, VIEW_SPECTRUM
+  }VIEW_KIND;
+
+
+// A further view of the session's data that owns nothing but its
+// viewport. Time views draw envelopes read from the shared history, XY
+// views have the renderer resample the shared accumulator or bin another
+// Z source from the history, spectrum views transform samples of the
+// history. Opening one adds no work to ingestion; it is refreshed with the
+// time plot while it is visible.
+class PlotView : public QWidget
+{
+  Q_OBJECT
+
+public:
+  PlotView(VIEW_KIND, int, Window *);
+  VIEW_KIND                   kind;
+  int                         id;         // XY views: the renderer's view number
+  size_t                      bytes();
+
+private:
+  void                        refresh_time();
+  void                        refresh_xy();
+  void                        refresh_spectrum();
+  void                        bin_history(int);
+  bool                        linked_span(long long *, long long *);
+
+  Window *                    parent;
+  QGridLayout *               layout;
+  QCustomPlot *               plot;
+  QListWidget *               slotList;
+  QComboBox *                 sourceBox;
+  QComboBox *                 sizeBox;
+  QCheckBox *                 linkBox;
+  QCheckBox *                 followBox;
+  QCPItemStraightLine *       cursorLine;
+  QCPItemRect *               linkRect;
+  QCPItemPixmap *             pixmap;
+  QCPColorMap *               colorMap;
+  Spectrum *                  spectrum;
+  ScanMap                     scanMap;
+  std::vector<int>            shown;
+  std::vector<double>         keys, values;
+  std::vector<double>         points, mx, my, mz;
+  bool                        moving;     // the view sets its own range
+  bool                        rescale;
+  QElapsedTimer               lastRefresh;
+
+public slots:
+  void                        refresh();
+  void                        xy_image(XY_IMAGE);
+  void                        range_slot(QCPRange);
+  void                        linked_range(double, double);
+  void                        linked_cursor(double);
+  void                        mouse_slot(QMouseEvent *);
+  void                        slots_changed();
+  void                        source_changed();
+};
+
+
+
+class PipelineWindow : public QWidget
+{
+  Q_OBJECT
+
+public:
+  PipelineWindow(Window *);
+  QGridLayout *               layout;
+
+private:
+  Window *                    parent;
+  QTableWidget *              table;
+  QTableWidget *              latencyTable;
+  QPushButton *               traceButton;
+  QTableWidget *              memoryTable;
+  QSpinBox *                  limitBox;
+  QSpinBox *                  spillBox;
+  QPushButton *               spillButton;
+  QLabel *                    memoryLabel;
+
+public slots:
+  void                        update_times(std::vector<double>);
+  void                        update_memory();
+  void                        trace_slot();
+  void                        write_trace_slot();
+  void                        set_limit_slot(int);
+  void                        set_spill_slot(int);
+  void                        spill_directory_slot();
+};
+
+
+
 class ColorMapDataChooser : public QWidget
 {
   Q_OBJECT
@@ -249,16 +825,20 @@ public:
   Window();
   void                    start();
 
+  static SCAN_CALIBRATION saved_calibration(double, double, double, double);
+
 
 public:
   Worker *                Worker_Obj;
   QThread                 Thread_Obj;
+  Renderer *              renderer;
+  QThread                 renderThread;
   QEventLoop *            loop;
 
   QSplitter *             splitter;
   QCustomPlot *           timePlot;
   QCustomPlot *           xyPlot;
-  QCPColorMap *           colorMap;
+  QCPItemPixmap *         xyPixmap;
   QToolBar *              toolBar;
 
   UNIT *                  unit;
@@ -268,6 +848,7 @@ public:
   QPushButton *           streamButton;
   QPushButton *           saveButton;
   QPushButton *           videoButton;
+  QPushButton *           recordButton;
   QDoubleSpinBox *        scaleOffsetBox;
   QAction *               scaleOffsetBoxAction;
   QDoubleSpinBox *        scaleAmplitudeBox;
@@ -278,22 +859,56 @@ public:
   double                  greyScaleOffset;
   QSpinBox *              sizeBox;
   QAction*                sizeBoxAction;
+  QSpinBox *              budgetBox;
+  QAction *               budgetBoxAction;
 
   ChannelWindow *         ChannelWindow_Obj;
   QAction *               show_ChannelMenu;
   QMenu *                 view;
   QAction *               split_screen_Action;
   QAction *               timeplot_screen_Action;
+  QAction *               publish_Action;
+  QAction *               replay_Action;
+  ShmWriter *             shmFrames;
   QAction *               xyplot_screen_Action;
   QMenu *                 graphs;
 
   GraphWindow *           GraphWindow_Obj;
   MathWindow *            MathWindow_Obj;
+  LockInWindow *          LockInWindow_Obj;
+  MeasurementWindow *     MeasurementWindow_Obj;
+  AverageWindow *         AverageWindow_Obj;
+  PhosphorWindow *        PhosphorWindow_Obj;
+  FrameWindow *           FrameWindow_Obj;
+  PipelineWindow *        PipelineWindow_Obj;
+  FrameBuilder *          frameBuilder;
+  ScanMap *               frameMap;
+  SCAN_CALIBRATION        scanCalibration;
+  ScanWindow *            ScanWindow_Obj;
+  AlarmWindow *           AlarmWindow_Obj;
+  ViewLink *              viewLink;
+  std::vector<PlotView *> views;
+  int                     xyViews;
+  QCPItemStraightLine *   timeCursor;
+  std::vector<double>     xyBatch;
+  uint64_t                traceBlock;
+  int64_t                 mathStart;
+  int64_t                 mathEnd;
+  int64_t                 replotStart;
+  History *               history;
+  int                     spillEntry;
+  QTimer *                memoryTimer;
+  bool                    memoryPressure;
+  QCPRange                scanX;
+  QCPRange                scanY;
+  int                     frameSyncSlot;
+  QCPItemPixmap *         phosphorPixmap;
 
   QMap<exprtk::expression<double>*, int>   expression_vec;
 
   double *                colorMapData_ptr;
   QVector<double>         mathChannel_vec;
+  std::vector<double>     measure_vec;
 
   ColorMapDataChooser *   ColorMapDataChooser_Obj;
   QAction *               ColorMapDataChooser_Action;
@@ -301,42 +916,97 @@ public:
 public:
   QAction *               show_channel_list;
   QAction *               show_math_channel_window;
+  QAction *               show_lockin_window;
+  QAction *               show_measurement_window;
+  QAction *               show_average_window;
+  QAction *               show_phosphor_window;
+  QAction *               show_frame_window;
+  QAction *               show_pipeline_window;
+  QAction *               show_scan_window;
+  QAction *               show_alarm_window;
+  QAction *               new_time_view;
+  QAction *               new_xy_view;
+  QAction *               new_spectrum_view;
 
 
   int                     counter;
+  int                     sampleStride;   // stream samples each received sample stands for
   bool                    videoIsRunning;
   int                     videoCounter;
   int                     frameCounter;
 
-  void                    open_unit();
-  void                    get_unit_info();
+  int                     unitsReady;
+  QElapsedTimer           startupTimer;
+
+  void                    enumerate_units();
+  void                    register_channels();
+  void                    register_memory();
+  void                    open_unit(int);
+  void                    get_unit_info(int);
   void                    set_channels();
-  void                    set_channels_of_pico();
-  void                    get_allowed_offset();
+  void                    set_channels_of_pico(int);
+  void                    get_allowed_offset(int);
+  void                    cache_offset_bounds(int);
+  void                    load_unit_config(int);
+  void                    save_unit_config();
+  void                    units_attached();
 
   void                    set_main_window();
   void                    set_actions();
   void                    set_connections();
 
   void                    calculate_greyscale();
+  void                    show_frame();
+  void                    refresh_colormap();
+  void                    refresh_history();
+  void                    apply_calibration(const SCAN_CALIBRATION &);
+  void                    load_calibration();
+  void                    open_view(VIEW_KIND);
 
   void                    closeEvent(QCloseEvent *);
 
 signals:
   void                    do_work(UNIT *);
+  void                    do_replay(QString);
+  void                    views_tick();
 
 public slots:
   void                    set_rawValue1(QMouseEvent *);
   void                    set_rawValue2(QRect, QMouseEvent *);
   void                    show_channel_menu_slot();
   void                    set_size_slot(int);
+  void                    set_budget_slot(int);
+  void                    set_scan_range(QCPRange, QCPRange);
+  void                    xy_range_slot();
+  void                    history_range_slot();
+  void                    memory_slot();
   void                    split_screen();
   void                    timeplot_screen();
+  void                    publish_slot(bool);
   void                    xyplot_screen();
   void                    stream_button_slot();
   void                    save_button_slot();
   void                    video_button_slot();
+  void                    record_button_slot();
+  void                    replay_slot();
+  void                    stream_stopped_slot();
   void                    data(std::vector<double>);
+  void                    measurements(std::vector<double>);
+  void                    averaged(std::vector<double>, std::vector<double>);
+  void                    phosphor(QImage);
+  void                    block_stamp(qint64, qint64);
+  void                    history_scales(std::vector<double>);
+  void                    sample_stride(int);
+  void                    replot_started();
+  void                    replot_done();
+  void                    xy_image_slot(XY_IMAGE);
+  void                    unit_ready(int);
+  void                    new_time_view_slot();
+  void                    new_xy_view_slot();
+  void                    new_spectrum_view_slot();
+  void                    linked_range_slot(double, double);
+  void                    linked_cursor_slot(double);
+  void                    time_cursor_slot(QMouseEvent *);
 
 protected:
   void contextMenuEvent(QContextMenuEvent *event) override;